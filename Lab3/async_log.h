@@ -0,0 +1,275 @@
+#ifndef ASYNC_LOG_H_INCLUDED
+#define ASYNC_LOG_H_INCLUDED
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <atomic>
+
+// Асинхронный журнал событий вместо printf на горячих путях.
+//
+// Поток, пишущий событие, не форматирует строку и не обращается к stdout: он кладет
+// запись фиксированного размера (время, номер события, до трех целых аргументов) в свое
+// кольцо (один писатель, один читатель) и сразу продолжает работу. Фоновый поток раз в
+// LOG_FLUSH_MS забирает записи из колец всех потоков, упорядочивает их по времени
+// и печатает по таблице форматов, которую задает программа.
+// Если кольцо заполнено, запись отбрасывается и увеличивается счетчик потерь -
+// писатель никогда не ждет.
+//
+// Уровень задается при запуске и может быть переопределен переменной окружения
+// FUEL_LOG_LEVEL (debug, info, warn, error, off).
+
+enum LogLevel
+{
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+const int LOG_RING_SIZE = 1024; // Записей в кольце одного потока (степень двойки)
+const int LOG_FLUSH_MS = 10;
+const int LOG_MAX_ARGS = 3;
+
+struct LogRecord
+{
+    uint64_t time_ns;
+    uint16_t event;
+    uint16_t level;
+    int32_t args[LOG_MAX_ARGS];
+};
+
+// Кольцо одного потока; голова и хвост в разных строках кэша
+struct LogRing
+{
+    LogRecord records[LOG_RING_SIZE];
+    alignas(64) std::atomic<uint64_t> head; // Пишет владелец
+    std::atomic<uint64_t> dropped;          // Пишет владелец
+    alignas(64) std::atomic<uint64_t> tail; // Пишет фоновый поток
+    LogRing *next;                          // Список всех колец
+    LogRing *next_free;                     // Список свободных колец
+};
+
+static std::atomic<int> log_level(LOG_LEVEL_INFO);
+static const char *const *log_formats = NULL;
+static int log_format_count = 0;
+static FILE *log_output = NULL;
+static uint64_t log_start_ns = 0;
+static volatile int log_running = 0;
+static pthread_t log_thread;
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LogRing *log_rings = NULL;
+static LogRing *log_free = NULL;
+static pthread_key_t log_key;
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+static __thread LogRing *local_log = NULL;
+
+static inline uint64_t LogClockNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Кольцо завершившегося потока достается следующему новому потоку;
+// непрочитанные записи фоновый поток заберет как обычно
+static inline void ReleaseLogRing(void *ring)
+{
+    pthread_mutex_lock(&log_mutex);
+    ((LogRing *)ring)->next_free = log_free;
+    log_free = (LogRing *)ring;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+static inline void CreateLogKey()
+{
+    pthread_key_create(&log_key, ReleaseLogRing);
+}
+
+// Кольцо текущего потока (мьютекс - только при первом событии потока)
+static inline LogRing *LocalLogRing()
+{
+    if (local_log != NULL)
+        return local_log;
+
+    pthread_once(&log_once, CreateLogKey);
+    pthread_mutex_lock(&log_mutex);
+    LogRing *ring = log_free;
+    if (ring != NULL)
+    {
+        log_free = ring->next_free;
+    }
+    else
+    {
+        // new не гарантирует выравнивание на строку кэша, поэтому память выделяется явно
+        void *memory = NULL;
+        if (posix_memalign(&memory, 64, sizeof(LogRing)) != 0)
+        {
+            pthread_mutex_unlock(&log_mutex);
+            return NULL;
+        }
+        ring = new (memory) LogRing;
+        ring->head.store(0);
+        ring->tail.store(0);
+        ring->dropped.store(0);
+        ring->next = log_rings;
+        log_rings = ring;
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    pthread_setspecific(log_key, ring);
+    local_log = ring;
+    return ring;
+}
+
+// Запись события: event - номер строки в таблице форматов, аргументы - целые для %d
+static inline void LogEvent(int level, int event, int a0 = 0, int a1 = 0, int a2 = 0)
+{
+    if (level < log_level.load(std::memory_order_relaxed))
+        return;
+
+    LogRing *ring = LocalLogRing();
+    if (ring == NULL)
+        return;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= (uint64_t)LOG_RING_SIZE)
+    {
+        ring->dropped.store(ring->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord &record = ring->records[head & (LOG_RING_SIZE - 1)];
+    record.time_ns = LogClockNs();
+    record.event = event;
+    record.level = level;
+    record.args[0] = a0;
+    record.args[1] = a1;
+    record.args[2] = a2;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+// Сумма отброшенных записей по всем потокам
+static inline uint64_t LogDropped()
+{
+    uint64_t dropped = 0;
+    pthread_mutex_lock(&log_mutex);
+    for (LogRing *ring = log_rings; ring != NULL; ring = ring->next)
+    {
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&log_mutex);
+    return dropped;
+}
+
+// Один проход фонового потока: забрать записи из всех колец и напечатать по порядку времени
+static inline void DrainLog(std::vector<LogRecord> &batch, uint64_t *reported_drops)
+{
+    batch.clear();
+    uint64_t dropped = 0;
+    pthread_mutex_lock(&log_mutex);
+    for (LogRing *ring = log_rings; ring != NULL; ring = ring->next)
+    {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for (; tail < head; tail++)
+        {
+            batch.push_back(ring->records[tail & (LOG_RING_SIZE - 1)]);
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        dropped += ring->dropped.load(std::memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&log_mutex);
+
+    std::sort(batch.begin(), batch.end(),
+              [](const LogRecord &a, const LogRecord &b) { return a.time_ns < b.time_ns; });
+
+    for (size_t i = 0; i < batch.size(); i++)
+    {
+        const LogRecord &record = batch[i];
+        // Событие вне таблицы или без формата (NULL - программа его не журналирует)
+        if (record.event >= log_format_count || log_formats[record.event] == NULL)
+            continue;
+        uint64_t since = record.time_ns - log_start_ns;
+        fprintf(log_output, "[%5llu.%06llu] ", (unsigned long long)(since / 1000000000ULL),
+                (unsigned long long)(since % 1000000000ULL / 1000));
+        fprintf(log_output, log_formats[record.event], record.args[0], record.args[1], record.args[2]);
+        fputc('\n', log_output);
+    }
+    if (dropped > *reported_drops)
+    {
+        fprintf(log_output, "[log] dropped %llu records (ring overflow)\n",
+                (unsigned long long)(dropped - *reported_drops));
+        *reported_drops = dropped;
+    }
+    if (!batch.empty())
+        fflush(log_output);
+}
+
+static inline void *LogThread(void *arg)
+{
+    std::vector<LogRecord> batch;
+    uint64_t reported_drops = 0;
+    while (log_running)
+    {
+        usleep(LOG_FLUSH_MS * 1000);
+        DrainLog(batch, &reported_drops);
+    }
+    DrainLog(batch, &reported_drops);
+    return NULL;
+}
+
+// Разбор имени уровня; -1, если имя неизвестно
+static inline int ParseLogLevel(const char *name)
+{
+    const char *names[] = {"debug", "info", "warn", "error", "off"};
+    for (int i = 0; i <= LOG_LEVEL_OFF; i++)
+    {
+        if (strcasecmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static inline void SetLogLevel(int level)
+{
+    log_level.store(level);
+}
+
+// Запуск фонового потока. formats - таблица форматов событий (номер события - индекс),
+// каждый формат принимает до трех аргументов %d; NULL - событие не печатается
+static inline void StartAsyncLog(const char *const *formats, int count, int level, FILE *output)
+{
+    log_formats = formats;
+    log_format_count = count;
+    log_output = output;
+    log_start_ns = LogClockNs();
+
+    const char *env = getenv("FUEL_LOG_LEVEL");
+    if (env != NULL && ParseLogLevel(env) >= 0)
+        level = ParseLogLevel(env);
+    SetLogLevel(level);
+
+    log_running = 1;
+    pthread_create(&log_thread, NULL, LogThread, NULL);
+}
+
+// Остановка: оставшиеся записи печатаются перед выходом
+static inline void StopAsyncLog()
+{
+    if (!log_running)
+        return;
+    log_running = 0;
+    pthread_join(log_thread, NULL);
+}
+
+#endif
@@ -0,0 +1,181 @@
+// Скорость приема соединений сервером хранилища в зависимости от числа слушающих потоков.
+// Имитирует "шторм переподключений": клиентские потоки без пауз открывают соединение,
+// выполняют один обмен "SIZE" (ответ означает, что соединение принято и обслужено)
+// и закрывают его. Закрытие через SO_LINGER = 0 (RST) не оставляет сокетов в TIME_WAIT,
+// иначе за несколько секунд кончились бы локальные порты.
+//
+// Программа сама запускает сервер для каждой конфигурации:
+//  - epoll N     - один поток accept() в main() раздает соединения N циклам событий;
+//  - reuseport N - N циклов событий, у каждого свой сокет SO_REUSEPORT на порту 8080.
+// Сервер запускается с -l off -u none -M none, чтобы измерялся только прием TCP.
+// Только Linux.
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_accept bench_accept.cpp
+// Запуск: ./bench_accept [-s путь_к_серверу] [-c клиентских_потоков] [-d секунд] [-L слушателей]
+//         -L - наибольшее число слушателей (перебираются 1, 2, 4, ... до него)
+#include <pthread.h>
+#include "storage_stats.h"
+#include "bench_common.h"
+
+// Параметры запуска
+const char *server_path = "./storage_server";
+int client_count = 8;
+int duration_sec = 3;
+int max_listeners = 0; // 0 - по числу процессоров
+
+volatile int bench_running = 0;
+
+// Клиентский поток и его результаты
+struct Client
+{
+    pthread_t thread;
+    LatencyHistogram latency; // Соединение + обмен + закрытие, нс
+    long completed;
+    long failed;
+};
+
+// Одно соединение: connect, "SIZE", ответ, закрытие. Возвращает false при ошибке
+static bool ConnectOnce()
+{
+    int fd = ConnectStorage(false);
+    if (fd < 0)
+        return false;
+
+    bool ok = write(fd, "SIZE\n", 5) == 5;
+    char reply[64];
+    size_t len = 0;
+    while (ok && (len == 0 || reply[len - 1] != '\n'))
+    {
+        ssize_t n = read(fd, reply + len, sizeof(reply) - len);
+        if (n <= 0)
+            ok = false;
+        else
+            len += n;
+    }
+
+    struct linger hard_close;
+    hard_close.l_onoff = 1;
+    hard_close.l_linger = 0;
+    setsockopt(fd, SOL_SOCKET, SO_LINGER, &hard_close, sizeof(hard_close));
+    close(fd);
+    return ok;
+}
+
+static void *ClientThread(void *arg)
+{
+    Client *client = (Client *)arg;
+    while (bench_running)
+    {
+        uint64_t before = NowNs();
+        if (ConnectOnce())
+        {
+            client->latency.Record(NowNs() - before);
+            client->completed++;
+        }
+        else
+        {
+            client->failed++;
+        }
+    }
+    return NULL;
+}
+
+// Запуск сервера в режиме mode с listeners циклами событий. Возвращает pid или -1
+static pid_t StartServerInMode(const char *mode, int listeners)
+{
+    char loops[16];
+    snprintf(loops, sizeof(loops), "%d", listeners);
+    const char *argv[] = {server_path, "-m", mode, "-t", loops, "-b", "1024",
+                          "-l", "off", "-u", "none", "-M", "none", NULL};
+    return StartServer(argv);
+}
+
+// Один прогон: сервер в режиме mode, client_count клиентов в течение duration_sec
+static void Run(const char *mode, int listeners)
+{
+    pid_t pid = StartServerInMode(mode, listeners);
+    if (pid < 0)
+    {
+        printf("%-10s %9d  failed to start %s\n", mode, listeners, server_path);
+        return;
+    }
+
+    Client *clients = new Client[client_count];
+    bench_running = 1;
+    uint64_t start = NowNs();
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i].completed = 0;
+        clients[i].failed = 0;
+        pthread_create(&clients[i].thread, NULL, ClientThread, &clients[i]);
+    }
+    sleep(duration_sec);
+    bench_running = 0;
+
+    LatencyHistogram latency;
+    long completed = 0;
+    long failed = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        latency.Merge(clients[i].latency);
+        completed += clients[i].completed;
+        failed += clients[i].failed;
+    }
+    double seconds = (NowNs() - start) / 1e9;
+    StopServer(pid);
+
+    printf("%-10s %9d %12.0f %10.1f %10.1f %10.1f %8ld\n", mode, listeners, completed / seconds,
+           latency.Percentile(0.5) / 1000.0, latency.Percentile(0.99) / 1000.0,
+           latency.Max() / 1000.0, failed);
+    delete[] clients;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:d:L:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            server_path = optarg;
+            break;
+        case 'c':
+            client_count = atoi(optarg);
+            break;
+        case 'd':
+            duration_sec = atoi(optarg);
+            break;
+        case 'L':
+            max_listeners = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s server] [-c clients] [-d seconds] [-L listeners]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (client_count < 1)
+        client_count = 1;
+    if (duration_sec < 1)
+        duration_sec = 1;
+    if (max_listeners <= 0)
+        max_listeners = sysconf(_SC_NPROCESSORS_ONLN);
+
+    // Клиенты закрывают соединения сами; запись в сброшенное сервером не должна завершать программу
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d client threads, %d s per run, connect + SIZE + close latency in us\n",
+           client_count, duration_sec);
+    printf("%-10s %9s %12s %10s %10s %10s %8s\n", "mode", "listeners", "accepts/s", "p50", "p99", "max", "failed");
+    for (int listeners = 1;; listeners *= 2)
+    {
+        if (listeners > max_listeners)
+            listeners = max_listeners;
+        Run("epoll", listeners);
+        Run("reuseport", listeners);
+        if (listeners == max_listeners)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,154 @@
+#ifndef BENCH_COMMON_H_INCLUDED
+#define BENCH_COMMON_H_INCLUDED
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+
+// Общие части программ измерения сервера хранилища (bench_accept, bench_size,
+// bench_transport, bench_uring): соединение с сервером на этой машине, обмен строками
+// протокола, разбор STATS и запуск сервера отдельным процессом.
+
+const int STORAGE_PORT = 8080;
+const int STARTUP_MS = 3000; // Сколько ждать, пока запущенный сервер начнет принимать соединения
+
+// TCP-соединение с сервером на loopback. no_delay отключает алгоритм Нейгла (лишний
+// setsockopt, поэтому bench_accept, который измеряет само соединение, его не просит).
+// Возвращает сокет или -1
+static inline int ConnectStorage(bool no_delay = true)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(STORAGE_PORT);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (no_delay)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    return fd;
+}
+
+// Соединение через сокет Unix path. Возвращает сокет или -1
+static inline int ConnectStorageUnix(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Отправка запроса одной записью и чтение lines строк ответа в reply. false при ошибке
+static inline bool Exchange(int fd, const std::string &request, int lines, std::string &reply)
+{
+    if (write(fd, request.data(), request.size()) != (ssize_t)request.size())
+        return false;
+    reply.clear();
+    int seen = 0;
+    char buffer[4096];
+    while (seen < lines)
+    {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n <= 0)
+            return false;
+        for (ssize_t i = 0; i < n; i++)
+        {
+            if (buffer[i] == '\n')
+                seen++;
+        }
+        reply.append(buffer, n);
+    }
+    return true;
+}
+
+// Число после "key": в ответе STATS, начиная с позиции from; -1, если ключа нет
+static inline long long StatsValue(const std::string &stats, const char *key, size_t from = 0)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = stats.find(pattern, from);
+    if (pos == std::string::npos)
+        return -1;
+    return atoll(stats.c_str() + pos + pattern.size());
+}
+
+// Ответ сервера на STATS. false, если сервер недоступен
+static inline bool ReadStats(std::string &reply)
+{
+    int fd = ConnectStorage();
+    if (fd < 0)
+        return false;
+    bool ok = Exchange(fd, "STATS\n", 1, reply);
+    close(fd);
+    return ok;
+}
+
+// Запуск сервера: argv - путь и ключи, список завершается NULL. Вывод сервера
+// отбрасывается. Возвращает pid, когда сервер начал принимать соединения на
+// STORAGE_PORT, или -1, если он завершился или не открыл порт за STARTUP_MS
+static inline pid_t StartServer(const char *const argv[])
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int null_fd = open("/dev/null", O_WRONLY);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        execv(argv[0], (char *const *)argv);
+        _exit(127);
+    }
+    if (pid < 0)
+        return -1;
+
+    for (int waited = 0; waited < STARTUP_MS; waited += 10)
+    {
+        int fd = ConnectStorage(false);
+        if (fd >= 0)
+        {
+            close(fd);
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return -1;
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+// Остановка сервера, запущенного StartServer
+static inline void StopServer(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, NULL, 0);
+}
+
+#endif
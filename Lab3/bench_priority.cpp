@@ -0,0 +1,258 @@
+// Сравнение порядка выдачи топлива со склада: fifo (в порядке производства) и priority
+// (сначала самая высокая марка). Котел горит столько секунд, какова марка привезенной
+// единицы, поэтому чем выше средняя выданная марка, тем меньше рейсов грузовика нужно
+// на час работы котла.
+// Программа без графики и без ожиданий проигрывает смену симулятора one_truck в модельном
+// времени с шагом 50 мс и теми же длительностями: производитель раз в секунду добавляет
+// единицу случайной марки 1..10, если на складе меньше 20 единиц; рейс грузовика - 1.05 с
+// до склада, 0.9 с погрузки, 1.05 с до котла, 0.9 с разгрузки и 0.1 с паузы; привезенная
+// марка заменяет остаток топлива в котле; грузовик едет к первому ждущему котлу, а если
+// таких нет - к случайному. При нескольких грузовиках котел, к которому уже едет другой
+// грузовик, не выбирается (как в two_trucks), а грузовики выезжают со сдвигом в секунду.
+// Склад - FuelStore из fuel_store.h, как в симуляторах.
+// Обе политики получают одну и ту же последовательность марок и выбор котлов (одинаковые
+// зерна), так что разница в результатах - только от порядка выдачи.
+// Для каждой длины смены печатаются рейсы, котло-часы (суммарное время горения всех котлов),
+// рейсы на котло-час, средняя выданная марка и сумма марок, оставшихся на складе к концу.
+// Склад ничего не теряет, поэтому за долгую смену выдается почти все произведенное и
+// средняя марка у обеих политик стремится к 5.5; priority выигрывает на сменах, сравнимых
+// со временем оборота склада, а низкие марки копятся на складе (столбец stock left).
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_priority bench_priority.cpp
+// Запуск: ./bench_priority [-t грузовиков] [-n прогонов] [-c емкость] [-i начальный_запас] [минуты ...]
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fuel_store.h"
+
+const int STEP_MS = 50;
+const int PRODUCE_MS = 1000;
+const int TRAVEL_MS = 1050; // MoveVehicleTo: 21 шаг по 50 мс
+const int LOAD_MS = 900;
+const int UNLOAD_MS = 900;
+const int PAUSE_MS = 100;
+const int BURN_MS_PER_MARK = 1000;
+const int BOILERS = 4;
+const int MAX_TRUCKS = 16;
+
+// Параметры запуска
+int truck_count = 1;
+int run_count = 20;
+int capacity = 20;
+int initial_stock = 10;
+
+enum TruckPhase
+{
+    TO_STORAGE,
+    LOADING,
+    TO_BOILER,
+    UNLOADING,
+    PAUSE
+};
+
+struct Truck
+{
+    TruckPhase phase;
+    int remaining_ms;
+    int fuel;
+    int target;
+};
+
+struct ShiftResult
+{
+    long trips;
+    double boiler_hours;
+    long delivered_marks;
+    long stock_marks; // Сумма марок, оставшихся на складе
+};
+
+// Первый ждущий котел, иначе случайный; котлы, к которым едут другие грузовики, пропускаются
+static int SelectBoiler(const int *level_ms, const bool *targeted, unsigned *target_seed)
+{
+    for (int i = 0; i < BOILERS; i++)
+    {
+        if (level_ms[i] == 0 && !targeted[i])
+            return i;
+    }
+    int start = rand_r(target_seed) % BOILERS;
+    for (int i = 0; i < BOILERS; i++)
+    {
+        int boiler = (start + i) % BOILERS;
+        if (!targeted[boiler])
+            return boiler;
+    }
+    return start;
+}
+
+static ShiftResult RunShift(DispensePolicy policy, int minutes, unsigned seed)
+{
+    FuelStore<32> storage;
+    storage.SetPolicy(policy);
+    unsigned fuel_seed = seed;
+    unsigned target_seed = seed * 2654435761u + 1;
+
+    for (int i = 0; i < initial_stock && i < capacity; i++)
+    {
+        storage.Push(rand_r(&fuel_seed) % 10 + 1);
+    }
+
+    Truck trucks[MAX_TRUCKS];
+    for (int i = 0; i < truck_count; i++)
+    {
+        trucks[i].phase = TO_STORAGE;
+        trucks[i].remaining_ms = TRAVEL_MS + i * 1000;
+        trucks[i].fuel = 0;
+        trucks[i].target = -1;
+    }
+    int level_ms[BOILERS] = {0, 0, 0, 0};
+    bool targeted[BOILERS] = {false, false, false, false};
+
+    ShiftResult result = {0, 0, 0, 0};
+    long burn_ms = 0;
+    long shift_ms = (long)minutes * 60 * 1000;
+    for (long now = 0; now < shift_ms; now += STEP_MS)
+    {
+        if (now % PRODUCE_MS == 0 && (int)storage.Size() < capacity)
+            storage.Push(rand_r(&fuel_seed) % 10 + 1);
+
+        for (int b = 0; b < BOILERS; b++)
+        {
+            if (level_ms[b] > 0)
+            {
+                level_ms[b] -= STEP_MS;
+                burn_ms += STEP_MS;
+            }
+        }
+
+        for (int i = 0; i < truck_count; i++)
+        {
+            Truck &truck = trucks[i];
+            truck.remaining_ms -= STEP_MS;
+            if (truck.remaining_ms > 0)
+                continue;
+
+            switch (truck.phase)
+            {
+            case TO_STORAGE:
+                truck.phase = LOADING;
+                truck.remaining_ms = LOAD_MS;
+                break;
+            case LOADING:
+                if (storage.Pop(&truck.fuel))
+                {
+                    truck.target = SelectBoiler(level_ms, targeted, &target_seed);
+                    targeted[truck.target] = true;
+                    truck.phase = TO_BOILER;
+                    truck.remaining_ms = TRAVEL_MS;
+                }
+                else
+                {
+                    truck.phase = PAUSE;
+                    truck.remaining_ms = PAUSE_MS;
+                }
+                break;
+            case TO_BOILER:
+                truck.phase = UNLOADING;
+                truck.remaining_ms = UNLOAD_MS;
+                break;
+            case UNLOADING:
+                level_ms[truck.target] = truck.fuel * BURN_MS_PER_MARK;
+                targeted[truck.target] = false;
+                result.trips++;
+                result.delivered_marks += truck.fuel;
+                truck.fuel = 0;
+                truck.target = -1;
+                truck.phase = PAUSE;
+                truck.remaining_ms = PAUSE_MS;
+                break;
+            case PAUSE:
+                truck.phase = TO_STORAGE;
+                truck.remaining_ms = TRAVEL_MS;
+                break;
+            }
+        }
+    }
+
+    int mark;
+    while (storage.Pop(&mark))
+    {
+        result.stock_marks += mark;
+    }
+    result.boiler_hours = burn_ms / 3600000.0;
+    return result;
+}
+
+static void Run(DispensePolicy policy, int minutes)
+{
+    ShiftResult total = {0, 0, 0, 0};
+    for (int run = 0; run < run_count; run++)
+    {
+        ShiftResult shift = RunShift(policy, minutes, 12345 + run);
+        total.trips += shift.trips;
+        total.boiler_hours += shift.boiler_hours;
+        total.delivered_marks += shift.delivered_marks;
+        total.stock_marks += shift.stock_marks;
+    }
+
+    double per_hour = total.boiler_hours > 0 ? total.trips / total.boiler_hours : 0;
+    double mean_mark = total.trips > 0 ? (double)total.delivered_marks / total.trips : 0;
+    printf("%8d %-9s %10.1f %12.2f %16.1f %10.2f %12.1f\n", minutes,
+           policy == DISPENSE_PRIORITY ? "priority" : "fifo", (double)total.trips / run_count,
+           total.boiler_hours / run_count, per_hour, mean_mark, (double)total.stock_marks / run_count);
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "t:n:c:i:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            truck_count = atoi(optarg);
+            break;
+        case 'n':
+            run_count = atoi(optarg);
+            break;
+        case 'c':
+            capacity = atoi(optarg);
+            break;
+        case 'i':
+            initial_stock = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t trucks] [-n runs] [-c capacity] [-i initial_stock] [minutes ...]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (truck_count < 1)
+        truck_count = 1;
+    if (truck_count > MAX_TRUCKS)
+        truck_count = MAX_TRUCKS;
+    if (run_count < 1)
+        run_count = 1;
+    if (capacity < 1)
+        capacity = 1;
+    if (capacity > 32)
+        capacity = 32;
+    if (initial_stock < 0)
+        initial_stock = 0;
+
+    printf("%d truck(s), %d boilers, storage capacity %d, initial stock %d, mean of %d runs\n",
+           truck_count, BOILERS, capacity, initial_stock, run_count);
+    printf("%8s %-9s %10s %12s %16s %10s %12s\n", "minutes", "policy", "trips", "boiler-h",
+           "trips/boiler-h", "mean mark", "stock left");
+
+    const int default_minutes[] = {10, 60, 480};
+    int shift_count = optind < argc ? argc - optind : 3;
+    for (int s = 0; s < shift_count; s++)
+    {
+        int minutes = optind < argc ? atoi(argv[optind + s]) : default_minutes[s];
+        if (minutes < 1)
+            continue;
+        Run(DISPENSE_FIFO, minutes);
+        Run(DISPENSE_PRIORITY, minutes);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+// Сравнение хранилища топлива под нагрузкой: std::queue с глобальным мьютексом
+// против кольцевой очереди без блокировок (fuel_ring.h).
+// Каждый клиентский поток многократно извлекает единицу топлива и возвращает ее обратно,
+// так что оба хранилища работают при одинаковой заполненности.
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_ring bench_ring.cpp
+// Запуск: ./bench_ring [операций_всего]
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <queue>
+#include "fuel_ring.h"
+
+// Хранилище в том виде, в котором оно было в storage_server.cpp
+struct MutexQueue
+{
+    pthread_mutex_t mutex;
+    std::queue<int> queue;
+
+    bool Push(int value)
+    {
+        pthread_mutex_lock(&mutex);
+        queue.push(value);
+        pthread_mutex_unlock(&mutex);
+        return true;
+    }
+
+    bool Pop(int *value)
+    {
+        pthread_mutex_lock(&mutex);
+        bool ok = !queue.empty();
+        if (ok)
+        {
+            *value = queue.front();
+            queue.pop();
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+};
+
+MutexQueue mutex_queue = {PTHREAD_MUTEX_INITIALIZER, std::queue<int>()};
+FuelRing<32> ring;
+
+// Параметры одного прогона
+long ops_per_thread = 0;
+pthread_barrier_t start_barrier;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Аргумент клиентского потока: хранилище и число выполненных операций
+template <typename Store>
+struct ClientArg
+{
+    Store *store;
+    long done;
+};
+
+template <typename Store>
+void *ClientThread(void *arg)
+{
+    ClientArg<Store> *client = (ClientArg<Store> *)arg;
+    pthread_barrier_wait(&start_barrier);
+
+    // Неудачный POP (все единицы временно у других потоков) тоже считается операцией
+    int mark;
+    long done = 0;
+    for (long i = 0; i < ops_per_thread; i++)
+    {
+        done++;
+        if (client->store->Pop(&mark))
+        {
+            client->store->Push(mark);
+            done++;
+        }
+    }
+    client->done = done;
+    return NULL;
+}
+
+// Прогон с заданным числом потоков, возвращает миллионы операций (POP и PUSH) в секунду
+template <typename Store>
+double Run(Store *store, int threads)
+{
+    pthread_t ids[64];
+    ClientArg<Store> args[64];
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        args[i].store = store;
+        args[i].done = 0;
+        pthread_create(&ids[i], NULL, ClientThread<Store>, &args[i]);
+    }
+
+    double start = Now();
+    pthread_barrier_wait(&start_barrier);
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+    }
+    double elapsed = Now() - start;
+    pthread_barrier_destroy(&start_barrier);
+
+    long done = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        done += args[i].done;
+    }
+    return done / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    long total_ops = argc > 1 ? atol(argv[1]) : 4000000;
+
+    // Начальное заполнение, как в сервере хранилища: 10 единиц из 20
+    for (int i = 0; i < 10; i++)
+    {
+        mutex_queue.Push(i + 1);
+        ring.Push(i + 1);
+    }
+
+    printf("%8s %16s %16s\n", "threads", "mutex, Mops/s", "ring, Mops/s");
+    for (int threads = 1; threads <= 64; threads *= 2)
+    {
+        ops_per_thread = total_ops / threads;
+        double queue_rate = Run(&mutex_queue, threads);
+        double ring_rate = Run(&ring, threads);
+        printf("%8d %16.2f %16.2f\n", threads, queue_rate, ring_rate);
+    }
+    return 0;
+}
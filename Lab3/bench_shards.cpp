@@ -0,0 +1,184 @@
+// Масштабирование хранилища топлива по числу ядер: одна очередь под глобальным мьютексом,
+// кольцевая очередь без блокировок (fuel_ring.h) и очереди по ядрам с кражей работы
+// (storage_shards.h). На каждое ядро приходится один клиентский поток, закрепленный за ним;
+// в режиме шардов число шардов равно числу ядер. Поток извлекает единицу топлива и
+// возвращает ее обратно, общая емкость - 20 единиц, как в сервере хранилища.
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_shards bench_shards.cpp
+// Запуск: ./bench_shards [макс_ядер] [операций_на_поток]
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <queue>
+#include "fuel_ring.h"
+#include "storage_shards.h"
+
+const int CAPACITY = 20;
+const int MAX_THREADS = 256;
+
+// Хранилище в исходном виде: std::queue под одним мьютексом
+struct MutexQueue
+{
+    pthread_mutex_t mutex;
+    std::queue<int> queue;
+
+    bool Push(int value)
+    {
+        pthread_mutex_lock(&mutex);
+        bool ok = (int)queue.size() < CAPACITY;
+        if (ok)
+            queue.push(value);
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+
+    bool Pop(int *value)
+    {
+        pthread_mutex_lock(&mutex);
+        bool ok = !queue.empty();
+        if (ok)
+        {
+            *value = queue.front();
+            queue.pop();
+        }
+        pthread_mutex_unlock(&mutex);
+        return ok;
+    }
+};
+
+long ops_per_thread = 200000;
+int cpu_count = 1;
+pthread_barrier_t start_barrier;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Закрепление потока за ядром (только Linux)
+static void PinToCpu(int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % cpu_count, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)cpu;
+#endif
+}
+
+template <typename Store>
+struct ClientArg
+{
+    Store *store;
+    int cpu;
+    long done;
+};
+
+template <typename Store>
+void *ClientThread(void *arg)
+{
+    ClientArg<Store> *client = (ClientArg<Store> *)arg;
+    PinToCpu(client->cpu);
+    pthread_barrier_wait(&start_barrier);
+
+    int mark;
+    long done = 0;
+    for (long i = 0; i < ops_per_thread; i++)
+    {
+        done++;
+        if (client->store->Pop(&mark))
+        {
+            client->store->Push(mark);
+            done++;
+        }
+    }
+    client->done = done;
+    return NULL;
+}
+
+// Прогон на заданном числе ядер, возвращает миллионы операций в секунду
+template <typename Store>
+double Run(Store *store, int cores)
+{
+    pthread_t ids[MAX_THREADS];
+    ClientArg<Store> args[MAX_THREADS];
+    pthread_barrier_init(&start_barrier, NULL, cores + 1);
+    for (int i = 0; i < cores; i++)
+    {
+        args[i].store = store;
+        args[i].cpu = i;
+        args[i].done = 0;
+        pthread_create(&ids[i], NULL, ClientThread<Store>, &args[i]);
+    }
+
+    double start = Now();
+    pthread_barrier_wait(&start_barrier);
+    long done = 0;
+    for (int i = 0; i < cores; i++)
+    {
+        pthread_join(ids[i], NULL);
+        done += args[i].done;
+    }
+    double elapsed = Now() - start;
+    pthread_barrier_destroy(&start_barrier);
+    return done / elapsed / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpu_count < 1)
+        cpu_count = 1;
+    int max_cores = argc > 1 ? atoi(argv[1]) : cpu_count;
+    if (max_cores < 1)
+        max_cores = 1;
+    if (max_cores > MAX_THREADS)
+        max_cores = MAX_THREADS;
+    if (argc > 2)
+        ops_per_thread = atol(argv[2]);
+
+    printf("online CPUs: %d, ops per thread: %ld\n", cpu_count, ops_per_thread);
+    printf("%6s %14s %14s %14s\n", "cores", "mutex Mops/s", "ring Mops/s", "shards Mops/s");
+
+    // Число ядер удваивается, последний прогон - ровно на max_cores
+    for (int cores = 1;; cores *= 2)
+    {
+        if (cores > max_cores)
+            cores = max_cores;
+
+        MutexQueue queue;
+        pthread_mutex_init(&queue.mutex, NULL);
+        static FuelRing<32> ring; // Выровненный объект размещается статически
+        int mark;
+        while (ring.Pop(&mark))
+        {
+        }
+        ShardedStore shards;
+        shards.Init(cores, CAPACITY);
+
+        // Начальное заполнение: 10 единиц из 20
+        for (int i = 0; i < 10; i++)
+        {
+            queue.Push(i + 1);
+            ring.Push(i + 1);
+            shards.Push(i + 1);
+        }
+
+        double queue_rate = Run(&queue, cores);
+        double ring_rate = Run(&ring, cores);
+        double shard_rate = Run(&shards, cores);
+        printf("%6d %14.2f %14.2f %14.2f\n", cores, queue_rate, ring_rate, shard_rate);
+
+        pthread_mutex_destroy(&queue.mutex);
+        if (cores == max_cores)
+            break;
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+// Нагрузка из запросов на чтение: 95% "SIZE" и 5% "POP" (доля POP задается ключом -P).
+// Программа сама запускает сервер хранилища с очередью под мьютексом (-s queue) и быстрым
+// производителем, так что POP и производитель постоянно захватывают мьютекс хранилища,
+// и перебирает число клиентских потоков 1, 2, 4, ... Каждый клиент держит одно соединение
+// и в замкнутом цикле отправляет по одной команде.
+// Для каждого прогона печатаются запросы в секунду, задержка SIZE и число захватов
+// мьютекса хранилища на запрос (по счетчику lock_wait_ns.count из STATS): SIZE читает
+// атомарный счетчик и мьютекс не захватывает, поэтому захватов меньше, чем запросов.
+// Чтобы сравнить с версией, где SIZE брал мьютекс, достаточно передать оба сервера:
+//   ./bench_size ./storage_server ./storage_server_old
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_size bench_size.cpp
+// Запуск: ./bench_size [-c клиентов] [-d секунд] [-P процент_POP] [-b хранилище] [сервер ...]
+//         -c - наибольшее число клиентов (перебираются 1, 2, 4, ... до него)
+#include <pthread.h>
+#include "storage_stats.h"
+#include "bench_common.h"
+
+// Параметры запуска
+int max_clients = 8;
+int duration_sec = 3;
+int pop_percent = 5;
+const char *backend = "queue";
+
+volatile int bench_running = 0;
+
+struct Client
+{
+    pthread_t thread;
+    LatencyHistogram size_latency; // Обмен "SIZE", нс
+    long requests;
+    bool failed;
+};
+
+static void *ClientThread(void *arg)
+{
+    Client *client = (Client *)arg;
+    int fd = ConnectStorage();
+    if (fd < 0)
+    {
+        client->failed = true;
+        return NULL;
+    }
+
+    const std::string pop_request = "POP\n";
+    const std::string size_request = "SIZE\n";
+    std::string reply;
+    for (long i = 0; bench_running; i++)
+    {
+        // Команды чередуются равномерно: на каждые 100 запросов pop_percent раз POP
+        bool pop = (i % 100) < pop_percent;
+        uint64_t before = NowNs();
+        if (!Exchange(fd, pop ? pop_request : size_request, 1, reply))
+        {
+            client->failed = true;
+            break;
+        }
+        if (!pop)
+            client->size_latency.Record(NowNs() - before);
+        client->requests++;
+    }
+    close(fd);
+    return NULL;
+}
+
+// Счетчики сервера: выполненные SIZE и POP и захваты мьютекса хранилища
+static bool ReadServerCounters(long long *commands, long long *locks)
+{
+    std::string reply;
+    bool ok = ReadStats(reply);
+    *commands = StatsValue(reply, "SIZE") + StatsValue(reply, "POP");
+    size_t lock_section = reply.find("\"lock_wait_ns\"");
+    *locks = lock_section == std::string::npos ? -1 : StatsValue(reply, "count", lock_section);
+    return ok && *commands >= 0 && *locks >= 0;
+}
+
+// Сервер с хранилищем backend и производителем, который держит склад полным
+static pid_t StartFullServer(const char *server_path)
+{
+    const char *argv[] = {server_path, "-m", "threads", "-s", backend, "-r", "20000", "-B", "20",
+                          "-c", "1024", "-l", "off", "-u", "none", "-M", "none", NULL};
+    return StartServer(argv);
+}
+
+static void Run(const char *server_path, int client_count)
+{
+    pid_t pid = StartFullServer(server_path);
+    if (pid < 0)
+    {
+        printf("%-24s %8d  failed to start\n", server_path, client_count);
+        return;
+    }
+
+    long long commands_before = 0, locks_before = 0;
+    ReadServerCounters(&commands_before, &locks_before);
+
+    Client *clients = new Client[client_count];
+    bench_running = 1;
+    uint64_t start = NowNs();
+    for (int i = 0; i < client_count; i++)
+    {
+        clients[i].requests = 0;
+        clients[i].failed = false;
+        pthread_create(&clients[i].thread, NULL, ClientThread, &clients[i]);
+    }
+    sleep(duration_sec);
+    bench_running = 0;
+
+    LatencyHistogram latency;
+    long requests = 0;
+    int failed = 0;
+    for (int i = 0; i < client_count; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        latency.Merge(clients[i].size_latency);
+        requests += clients[i].requests;
+        failed += clients[i].failed ? 1 : 0;
+    }
+    double seconds = (NowNs() - start) / 1e9;
+
+    long long commands_after = 0, locks_after = 0;
+    bool counted = ReadServerCounters(&commands_after, &locks_after);
+    StopServer(pid);
+
+    double per_request = 0;
+    if (counted && commands_after > commands_before)
+        per_request = (double)(locks_after - locks_before) / (commands_after - commands_before);
+    printf("%-24s %8d %12.0f %10.1f %10.1f %12.3f %8d\n", server_path, client_count, requests / seconds,
+           latency.Percentile(0.5) / 1000.0, latency.Percentile(0.99) / 1000.0, per_request, failed);
+    delete[] clients;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:P:b:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            max_clients = atoi(optarg);
+            break;
+        case 'd':
+            duration_sec = atoi(optarg);
+            break;
+        case 'P':
+            pop_percent = atoi(optarg);
+            break;
+        case 'b':
+            backend = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-c clients] [-d seconds] [-P pop_percent] [-b backend] [server ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (max_clients < 1)
+        max_clients = 1;
+    if (duration_sec < 1)
+        duration_sec = 1;
+    if (pop_percent < 0)
+        pop_percent = 0;
+    if (pop_percent > 100)
+        pop_percent = 100;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d%% SIZE, %d%% POP, storage %s, %d s per run, SIZE latency in us\n",
+           100 - pop_percent, pop_percent, backend, duration_sec);
+    printf("%-24s %8s %12s %10s %10s %12s %8s\n", "server", "clients", "requests/s", "p50", "p99",
+           "locks/req", "failed");
+
+    const char *default_server = "./storage_server";
+    const char **servers = optind < argc ? (const char **)argv + optind : &default_server;
+    int server_count = optind < argc ? argc - optind : 1;
+    for (int s = 0; s < server_count; s++)
+    {
+        for (int clients = 1;; clients *= 2)
+        {
+            if (clients > max_clients)
+                clients = max_clients;
+            Run(servers[s], clients);
+            if (clients == max_clients)
+                break;
+        }
+    }
+    return 0;
+}
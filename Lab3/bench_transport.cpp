@@ -0,0 +1,117 @@
+// Сравнение транспортов между клиентом и сервером хранилища на одной машине:
+// TCP через loopback, сокет Unix и разделяемая память (storage_shm.h).
+// Один клиент выполняет последовательные обмены "SIZE" (запрос - ответ) и измеряет
+// время каждого обмена; SIZE не меняет хранилище, поэтому прогоны не влияют друг на друга.
+// Сервер должен быть запущен заранее с включенными сокетом Unix и сегментом (по умолчанию).
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_transport bench_transport.cpp
+// Запуск: ./bench_transport [обменов]
+#include "storage_stats.h"
+#include "storage_shm.h"
+#include "bench_common.h"
+
+const char *STORAGE_UNIX_PATH = "/tmp/fuel_storage.sock";
+const int WARMUP = 1000;
+const int TIMEOUT_MS = 1000;
+
+long exchanges = 100000;
+
+// Один обмен через сокет: запрос и чтение до '\n'
+static bool SocketExchange(int fd)
+{
+    if (write(fd, "SIZE\n", 5) != 5)
+        return false;
+    char reply[64];
+    size_t len = 0;
+    while (len == 0 || reply[len - 1] != '\n')
+    {
+        ssize_t n = read(fd, reply + len, sizeof(reply) - len);
+        if (n <= 0)
+            return false;
+        len += n;
+    }
+    return true;
+}
+
+// Результат прогона
+static void Report(const char *name, const LatencyHistogram &latency, double seconds)
+{
+    printf("%-6s %12.0f %10.1f %10.1f %10.1f %10.1f\n", name, latency.Count() / seconds,
+           latency.Mean() / 1000.0, latency.Percentile(0.5) / 1000.0,
+           latency.Percentile(0.99) / 1000.0, latency.Percentile(0.999) / 1000.0);
+}
+
+static void RunSocket(const char *name, int fd)
+{
+    if (fd < 0)
+    {
+        printf("%-6s not available\n", name);
+        return;
+    }
+    for (int i = 0; i < WARMUP; i++)
+    {
+        SocketExchange(fd);
+    }
+
+    LatencyHistogram latency;
+    uint64_t start = NowNs();
+    for (long i = 0; i < exchanges; i++)
+    {
+        uint64_t before = NowNs();
+        if (!SocketExchange(fd))
+        {
+            printf("%-6s connection lost\n", name);
+            close(fd);
+            return;
+        }
+        latency.Record(NowNs() - before);
+    }
+    Report(name, latency, (NowNs() - start) / 1e9);
+    close(fd);
+}
+
+static void RunShm()
+{
+    ShmSegment *segment = OpenShmSegment(SHM_DEFAULT_NAME);
+    int slot = segment != NULL ? ClaimShmSlot(segment) : -1;
+    if (slot < 0)
+    {
+        printf("%-6s not available\n", "shm");
+        return;
+    }
+
+    char reply[64];
+    for (int i = 0; i < WARMUP; i++)
+    {
+        ShmRequest(segment, slot, "SIZE\n", reply, sizeof(reply), TIMEOUT_MS);
+    }
+
+    LatencyHistogram latency;
+    uint64_t start = NowNs();
+    for (long i = 0; i < exchanges; i++)
+    {
+        uint64_t before = NowNs();
+        if (ShmRequest(segment, slot, "SIZE\n", reply, sizeof(reply), TIMEOUT_MS) < 0)
+        {
+            printf("%-6s request timed out\n", "shm");
+            break;
+        }
+        latency.Record(NowNs() - before);
+    }
+    Report("shm", latency, (NowNs() - start) / 1e9);
+    ReleaseShmSlot(segment, slot);
+    CloseShmSegment(segment);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1)
+        exchanges = atol(argv[1]);
+
+    printf("%ld SIZE exchanges per transport, latency in us\n", exchanges);
+    printf("%-6s %12s %10s %10s %10s %10s\n", "", "exchanges/s", "mean", "p50", "p99", "p99.9");
+    RunSocket("tcp", ConnectStorage());
+    RunSocket("unix", ConnectStorageUnix(STORAGE_UNIX_PATH));
+    RunShm();
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Сравнение цикла epoll (чтение и запись - отдельный системный вызов на каждое сообщение)
+// и цикла io_uring (запросы отправляются пачками одним io_uring_enter).
+// Программа сама запускает сервер в режимах reuseport (epoll со своим слушающим сокетом,
+// как у io_uring) и uring с одинаковым числом циклов. Клиентские потоки держат по одному
+// соединению и в замкнутом цикле отправляют по depth команд "SIZE" одной записью.
+// Для каждого режима печатаются запросы в секунду и системные вызовы ввода-вывода сервера
+// на запрос - по счетчику io.syscalls из STATS.
+// Только Linux.
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_uring bench_uring.cpp
+// Запуск: ./bench_uring [-s путь_к_серверу] [-c соединений] [-d секунд] [-t циклов] [-D depth]
+#include <pthread.h>
+#include "storage_stats.h"
+#include "bench_common.h"
+
+// Параметры запуска
+const char *server_path = "./storage_server";
+int connection_count = 16;
+int duration_sec = 3;
+int loop_count = 1;
+int depth = 1; // Команд в одной записи клиента
+
+volatile int bench_running = 0;
+
+struct Client
+{
+    pthread_t thread;
+    LatencyHistogram latency; // Время обмена пачкой из depth команд, нс
+    long requests;
+    bool failed;
+};
+
+static void *ClientThread(void *arg)
+{
+    Client *client = (Client *)arg;
+    int fd = ConnectStorage();
+    if (fd < 0)
+    {
+        client->failed = true;
+        return NULL;
+    }
+
+    std::string request;
+    for (int i = 0; i < depth; i++)
+    {
+        request += "SIZE\n";
+    }
+    std::string reply;
+    while (bench_running)
+    {
+        uint64_t before = NowNs();
+        if (!Exchange(fd, request, depth, reply))
+        {
+            client->failed = true;
+            break;
+        }
+        client->latency.Record(NowNs() - before);
+        client->requests += depth;
+    }
+    close(fd);
+    return NULL;
+}
+
+// Счетчики сервера: системные вызовы ввода-вывода и выполненные SIZE
+static bool ReadServerCounters(long long *syscalls, long long *sizes)
+{
+    std::string reply;
+    bool ok = ReadStats(reply);
+    *syscalls = StatsValue(reply, "syscalls");
+    *sizes = StatsValue(reply, "SIZE");
+    return ok && *syscalls >= 0 && *sizes >= 0;
+}
+
+// Сервер в режиме mode с loop_count циклами
+static pid_t StartServerInMode(const char *mode)
+{
+    char loops[16];
+    snprintf(loops, sizeof(loops), "%d", loop_count);
+    const char *argv[] = {server_path, "-m", mode, "-t", loops, "-l", "off", "-u", "none", "-M", "none", NULL};
+    return StartServer(argv);
+}
+
+static void Run(const char *mode)
+{
+    pid_t pid = StartServerInMode(mode);
+    if (pid < 0)
+    {
+        printf("%-10s failed to start %s\n", mode, server_path);
+        return;
+    }
+
+    long long syscalls_before = 0, sizes_before = 0;
+    ReadServerCounters(&syscalls_before, &sizes_before);
+
+    Client *clients = new Client[connection_count];
+    bench_running = 1;
+    uint64_t start = NowNs();
+    for (int i = 0; i < connection_count; i++)
+    {
+        clients[i].requests = 0;
+        clients[i].failed = false;
+        pthread_create(&clients[i].thread, NULL, ClientThread, &clients[i]);
+    }
+    sleep(duration_sec);
+    bench_running = 0;
+
+    LatencyHistogram latency;
+    long requests = 0;
+    int failed = 0;
+    for (int i = 0; i < connection_count; i++)
+    {
+        pthread_join(clients[i].thread, NULL);
+        latency.Merge(clients[i].latency);
+        requests += clients[i].requests;
+        failed += clients[i].failed ? 1 : 0;
+    }
+    double seconds = (NowNs() - start) / 1e9;
+
+    long long syscalls_after = 0, sizes_after = 0;
+    bool counted = ReadServerCounters(&syscalls_after, &sizes_after);
+    StopServer(pid);
+
+    double per_request = 0;
+    if (counted && sizes_after > sizes_before)
+        per_request = (double)(syscalls_after - syscalls_before) / (sizes_after - sizes_before);
+    printf("%-10s %12.0f %14.3f %10.1f %10.1f %8d\n", mode, requests / seconds, per_request,
+           latency.Percentile(0.5) / 1000.0, latency.Percentile(0.99) / 1000.0, failed);
+    delete[] clients;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:d:t:D:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            server_path = optarg;
+            break;
+        case 'c':
+            connection_count = atoi(optarg);
+            break;
+        case 'd':
+            duration_sec = atoi(optarg);
+            break;
+        case 't':
+            loop_count = atoi(optarg);
+            break;
+        case 'D':
+            depth = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-s server] [-c connections] [-d seconds] [-t loops] [-D depth]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (connection_count < 1)
+        connection_count = 1;
+    if (duration_sec < 1)
+        duration_sec = 1;
+    if (loop_count < 1)
+        loop_count = 1;
+    if (depth < 1)
+        depth = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%d connections, %d loop(s), %d SIZE per write, %d s per run, latency in us\n",
+           connection_count, loop_count, depth, duration_sec);
+    printf("%-10s %12s %14s %10s %10s %8s\n", "mode", "requests/s", "syscalls/req", "p50", "p99", "failed");
+    Run("reuseport");
+    Run("uring");
+    return 0;
+}
@@ -0,0 +1,141 @@
+// Цена журнала операций (storage_wal.h) на пропускной способности POP.
+// Клиентские потоки извлекают единицу топлива из кольцевой очереди и возвращают ее обратно;
+// с включенным журналом каждая операция дополнительно записывается в журнал, а отдельный
+// поток раз в 10 мс выполняет групповую фиксацию, как в storage_server -w.
+// В конце измеряется время восстановления из полностью заполненного сегмента.
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o bench_wal bench_wal.cpp
+// Запуск: ./bench_wal [каталог] [операций_на_поток]
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "fuel_ring.h"
+#include "storage_wal.h"
+
+const size_t SEGMENT_RECORDS = 1 << 20;
+const int SYNC_MS = 10;
+
+FuelRing<32> ring;
+FuelWal wal;
+bool wal_on = false;
+volatile int sync_running = 0;
+long ops_per_thread = 500000;
+pthread_barrier_t start_barrier;
+
+static double Now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Групповая фиксация журнала
+void *SyncThread(void *arg)
+{
+    while (sync_running)
+    {
+        usleep(SYNC_MS * 1000);
+        wal.Sync();
+    }
+    return NULL;
+}
+
+void *ClientThread(void *arg)
+{
+    long *done = (long *)arg;
+    pthread_barrier_wait(&start_barrier);
+
+    int mark;
+    long count = 0;
+    for (long i = 0; i < ops_per_thread; i++)
+    {
+        count++;
+        if (ring.Pop(&mark))
+        {
+            if (wal_on)
+                wal.Append(WAL_POP, mark);
+            ring.Push(mark);
+            if (wal_on)
+                wal.Append(WAL_PUSH, mark);
+            count++;
+        }
+    }
+    *done = count;
+    return NULL;
+}
+
+// Прогон, возвращает операций в секунду
+double Run(int threads)
+{
+    pthread_t ids[64];
+    long done[64];
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_create(&ids[i], NULL, ClientThread, &done[i]);
+    }
+
+    double start = Now();
+    pthread_barrier_wait(&start_barrier);
+    long total = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_join(ids[i], NULL);
+        total += done[i];
+    }
+    double elapsed = Now() - start;
+    pthread_barrier_destroy(&start_barrier);
+    return total / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    if (argc > 2)
+        ops_per_thread = atol(argv[2]);
+
+    if (!wal.Open(dir, SEGMENT_RECORDS))
+    {
+        fprintf(stderr, "Failed to open log in %s\n", dir);
+        return 1;
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        ring.Push(i + 1);
+    }
+
+    sync_running = 1;
+    pthread_t sync_thread;
+    pthread_create(&sync_thread, NULL, SyncThread, NULL);
+
+    printf("%8s %16s %16s %10s\n", "threads", "log off, ops/s", "log on, ops/s", "cost");
+    for (int threads = 1; threads <= 8; threads *= 2)
+    {
+        wal_on = false;
+        double off = Run(threads);
+        wal_on = true;
+        double on = Run(threads);
+        printf("%8d %16.0f %16.0f %9.1f%%\n", threads, off, on, (off - on) * 100.0 / off);
+    }
+
+    sync_running = 0;
+    pthread_join(sync_thread, NULL);
+
+    // Восстановление: заполняем сегмент почти целиком и открываем журнал заново
+    wal.Checkpoint(false);
+    for (size_t i = 0; i + 1 < SEGMENT_RECORDS; i += 2)
+    {
+        wal.Append(WAL_PUSH, 5);
+        wal.Append(WAL_POP, 5);
+    }
+    size_t pending = wal.Pending();
+    wal.Close();
+
+    FuelWal restored;
+    double start = Now();
+    restored.Open(dir, SEGMENT_RECORDS);
+    printf("replayed %zu records in %.1f ms\n", pending, (Now() - start) * 1000);
+    return 0;
+}
@@ -5,11 +5,20 @@
 #include <stdio.h>
 #include <string.h>
 #include <queue>
+#include <atomic>
 #include <termios.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include "sim_events.h"
+#include "storage_shm.h"
+#include "storage_stats.h"
+#include "storage_client.h"
+#include "fuel_bar.h"
+#include "text_overlay.h"
+#include "scene_snapshot.h"
 
 // Состояния элементов
 enum VehicleState
@@ -32,7 +41,92 @@ volatile int run_flag = 1;
 // Сетевые настройки
 const char *STORAGE_SERVER = "localhost";
 const int STORAGE_PORT = 8080;
-int storage_socket = -1;
+const char *STORAGE_UNIX_PATH = "/tmp/fuel_storage.sock";
+
+// Пул соединений с хранилищем (storage_client.h): по соединению на поток ввода-вывода,
+// переподключение после обрыва и срок на каждый обмен
+const int STORAGE_IO_THREADS = 2;
+StorageClient storage_client;
+
+// Способ связи с хранилищем: если сервер на этой же машине, вместо TCP используется
+// разделяемая память или, если сегмента нет, сокет Unix
+enum StorageTransport
+{
+    TRANSPORT_TCP,
+    TRANSPORT_UNIX,
+    TRANSPORT_SHM
+};
+StorageTransport storage_transport = TRANSPORT_TCP;
+ShmSegment *storage_shm = NULL;
+int storage_shm_slot = -1;           // Ячейка первого потока ввода-вывода, занятая при подключении
+__thread int io_shm_slot = -1;       // Ячейка текущего потока ввода-вывода
+
+// Клиент хранилища асинхронный: с хранилищем работают только потоки ввода-вывода
+// StorageIoThread. Грузовик ставит запрос в очередь и продолжает анимацию, а поток по
+// готовности вызывает done запроса. Состояние симуляции (mutex) захватывается только
+// чтобы применить результат, сетевой обмен идет без него
+enum StorageCallType
+{
+    CALL_RESERVE, // Резерв топлива перед поездкой к хранилищу
+    CALL_LOAD     // Погрузка: получение резерва или запрос топлива
+};
+
+struct StorageCall
+{
+    StorageCallType type;
+    int truck;                       // Номер грузовика (1 или 2)
+    StorageCall *reserve;            // CALL_LOAD: резерв этого рейса; очередь FIFO, поэтому он уже взят в работу
+    long result;                     // Номер резерва (-1 - нет) или количество топлива
+    int mark;                        // CALL_LOAD: наибольшая марка погруженных единиц
+    bool completed;                  // Под mutex
+    void (*done)(StorageCall *call); // Вызывается потоком ввода-вывода
+};
+
+std::queue<StorageCall *> storage_calls;
+pthread_mutex_t storage_calls_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t storage_calls_cond = PTHREAD_COND_INITIALIZER;
+bool storage_calls_closed = false;
+pthread_cond_t storage_done_cond = PTHREAD_COND_INITIALIZER; // Готовность запросов, пара к mutex
+
+// Запросы грузовиков; у каждого не больше одного резерва и одной погрузки в очереди
+StorageCall vehicle1_reserve, vehicle1_load;
+StorageCall vehicle2_reserve, vehicle2_load;
+
+// Сервер поддерживает запросы по марке (POPMAX); сбрасывается при первом ответе ERR
+std::atomic<bool> grade_queries(true);
+
+// Сколько грузовик ждет топливо у пустого хранилища (POPWAIT), мс
+const int STORAGE_WAIT_MS = 3000;
+
+// Срок резерва топлива (RESERVE), мс: с запасом на поездку к хранилищу и погрузку
+const int RESERVE_TTL_MS = 5000;
+
+// Сервер поддерживает RESERVE и COMMIT; сбрасывается при первом ответе ERR
+std::atomic<bool> reservations_supported(true);
+
+// Подписка на изменения хранилища (SUBSCRIBE) по отдельному соединению: сервер сам сообщает
+// размер хранилища, и грузовик запрашивает топливо, только когда оно есть.
+// Если подписаться не удалось, грузовики работают как раньше - через POPWAIT
+const int INVENTORY_INTERVAL_MS = 100;
+int inventory_socket = -1;
+pthread_mutex_t inventory_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t inventory_cond = PTHREAD_COND_INITIALIZER;
+bool inventory_subscribed = false;
+int inventory_size = 0;
+
+// Вместимость грузовика (единиц топлива за один рейс) и котла
+const int TRUCK_CAPACITY = 2;
+const int MAX_BOILER_FUEL = 20;
+
+// Тексты событий sim_events.h: склад на сервере хранилища, грузовик везет несколько единиц
+const char *event_formats[EV_COUNT] = {
+    NULL,
+    "Storage returned %d of %d requested units",
+    "Truck%d loaded %d units of fuel, target boiler %d",
+    "Truck%d got no fuel from storage",
+    "Truck%d delivered %d units of fuel to boiler %d",
+    "Boiler %d is out of fuel",
+};
 
 // Общие данные
 BoilerState boiler_states[4] = {WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL};
@@ -44,15 +138,33 @@ bool boiler_low_fuel[4] = {false, false, false, false};
 // Данные для первого грузовика
 VehicleState vehicle1_state = MOVING_TO_STORAGE;
 int vehicle1_fuel = 0;
+int vehicle1_mark = 0; // Наибольшая марка в кузове
 int vehicle1_target_boiler = -1;
 int vehicle1_x = 100, vehicle1_y = 235;
 
 // Данные для второго грузовика
 VehicleState vehicle2_state = MOVING_TO_STORAGE;
 int vehicle2_fuel = 0;
+int vehicle2_mark = 0; // Наибольшая марка в кузове
 int vehicle2_target_boiler = -1;
 int vehicle2_x = 100, vehicle2_y = 165;
 
+// Копия общих данных для потока отрисовки
+struct Scene
+{
+    BoilerState boiler_states[4];
+    int boiler_fuel_level[4];
+    int boiler_fuel_marks[4];
+    bool boiler_targeted[4];
+    bool boiler_low_fuel[4];
+    VehicleState vehicle1_state, vehicle2_state;
+    int vehicle1_fuel, vehicle2_fuel;
+    int vehicle1_target_boiler, vehicle2_target_boiler;
+    int vehicle1_x, vehicle1_y, vehicle2_x, vehicle2_y;
+};
+SceneSnapshot<Scene> scene_snapshot; // Последний опубликованный снимок
+const int RENDER_PERIOD_MS = 50;     // Период кадра потока отрисовки
+
 // Размеры объектов
 const int STORAGE_W = 80, STORAGE_H = 160;
 const int VEHICLE_W = 80, VEHICLE_H = 40;
@@ -75,62 +187,474 @@ const int BOILER_STOP_Y1 = 235;
 const int BOILER_STOP_Y2 = 165;
 
 // Идентификаторы графических элементов
-int storage_id, vehicle1_id, vehicle2_id, boiler_ids[4], text_ids[15], fuel_bar_ids[4];
+int storage_id, vehicle1_id, vehicle2_id, boiler_ids[4];
+TextOverlay text_overlay; // Надписи окна
+
+// Слоты надписей: 0..14 - строки вверху окна, дальше - подписи объектов
+const int LABEL_VEHICLE1 = 17, LABEL_VEHICLE2 = 18, LABEL_BOILER = 20;
+FuelBar fuel_bars[4]; // Индикаторы топлива котлов
+
+// Длительность кадра потока отрисовки (чтение снимка и DrawState), нс.
+// Пишет только поток отрисовки; сводка печатается при выходе. Кадр дольше
+// RENDER_STALL_MS считается задержкой отрисовки
+LatencyHistogram render_frames;
+long render_stalls = 0;
+const int RENDER_STALL_MS = 20;
+
+// Ожидание mutex потоками котлов, нс. Пишется уже под mutex, поэтому потоки не мешают друг другу
+LatencyHistogram boiler_lock_waits;
+
+// Подключение к серверу на этой же машине через разделяемую память или сокет Unix.
+// Пул переключается на сокет Unix: по нему идут запросы, если нет разделяемой памяти,
+// и подписка
+bool ConnectLocalStorage(const StorageClientOptions &options)
+{
+    storage_shm = OpenShmSegment(SHM_DEFAULT_NAME);
+    if (storage_shm != NULL)
+    {
+        storage_shm_slot = ClaimShmSlot(storage_shm);
+        if (storage_shm_slot >= 0)
+        {
+            storage_transport = TRANSPORT_SHM;
+            storage_client.Open(STORAGE_UNIX_PATH, 0, options);
+            printf("Connected to storage server via shared memory %s\n", SHM_DEFAULT_NAME);
+            return true;
+        }
+        CloseShmSegment(storage_shm);
+        storage_shm = NULL;
+    }
+
+    if (storage_client.Open(STORAGE_UNIX_PATH, 0, options) && storage_client.Connect())
+    {
+        storage_transport = TRANSPORT_UNIX;
+        printf("Connected to storage server via %s\n", STORAGE_UNIX_PATH);
+        return true;
+    }
+    return false;
+}
 
-// Функции для работы с сетью
+// Функции для работы с сетью. Адрес ищется через getaddrinfo, соединения пула
+// подключаются без блокировки и после обрыва восстанавливаются при следующем запросе
 bool ConnectToStorageServer()
 {
-    storage_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (storage_socket < 0)
+    StorageClientOptions options;
+    options.connections = STORAGE_IO_THREADS;
+
+    if (!storage_client.Open(STORAGE_SERVER, STORAGE_PORT, options))
+        return false;
+
+    // Адрес 127.x.x.x или ::1 - сервер на этой машине
+    if (storage_client.IsLocal() && ConnectLocalStorage(options))
+        return true;
+
+    if (!storage_client.Open(STORAGE_SERVER, STORAGE_PORT, options) || !storage_client.Connect())
     {
-        perror("socket");
+        fprintf(stderr, "Error: cannot connect to %s:%d\n", STORAGE_SERVER, STORAGE_PORT);
         return false;
     }
+    printf("Connected to storage server at %s:%d\n", STORAGE_SERVER, STORAGE_PORT);
+    return true;
+}
 
-    struct sockaddr_in serv_addr;
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_port = htons(STORAGE_PORT);
+// Обмен с хранилищем из потока ввода-вывода: команды (без '\n') уходят одной пачкой,
+// в replies - по строке ответа на команду. false при ошибке или тайм-ауте
+bool StorageExchange(const std::vector<std::string> &commands, std::vector<std::string> &replies)
+{
+    if (storage_transport != TRANSPORT_SHM)
+        return storage_client.Batch(commands, replies) == STORAGE_OK;
 
-    struct hostent *server = gethostbyname(STORAGE_SERVER);
-    if (server == NULL)
+    std::string request;
+    for (size_t i = 0; i < commands.size(); i++)
+    {
+        request += commands[i];
+        request += '\n';
+    }
+    char response[512];
+    int len = ShmRequest(storage_shm, io_shm_slot, request.c_str(), response, sizeof(response),
+                         STORAGE_WAIT_MS + 1000);
+    if (len < 0)
     {
-        fprintf(stderr, "Error: no such host\n");
+        fprintf(stderr, "Storage request over shared memory timed out\n");
         return false;
     }
 
-    memcpy(&serv_addr.sin_addr.s_addr, server->h_addr, server->h_length);
+    replies.clear();
+    const char *line = response;
+    const char *eol;
+    while (replies.size() < commands.size() && (eol = strchr(line, '\n')) != NULL)
+    {
+        replies.push_back(std::string(line, eol - line));
+        line = eol + 1;
+    }
+    return replies.size() == commands.size();
+}
 
-    if (connect(storage_socket, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+// Разбор ответа на "POP n": "k m1 ... mk"
+// Марки записываются в marks, возвращается число единиц или -1 при ошибке формата
+int ParseBatchReply(const char *line, int *marks, int max_units)
+{
+    const char *p = line;
+    char *end;
+    int count = strtol(p, &end, 10);
+    if (end == p || count < 0)
+        return -1;
+
+    int received = 0;
+    for (int i = 0; i < count && received < max_units; i++)
     {
-        perror("connect");
-        return false;
+        p = end;
+        int mark = strtol(p, &end, 10);
+        if (end == p)
+            break;
+        marks[received++] = mark;
     }
+    return received;
+}
 
-    printf("Connected to storage server at %s:%d\n", STORAGE_SERVER, STORAGE_PORT);
-    return true;
+// Запрос пакета топлива. Первая единица запрашивается через POPWAIT: если хранилище пусто,
+// сервер держит запрос до появления топлива, и грузовик не гоняет впустую.
+// Остальные добираются "POP n". Оба запроса уходят одной пачкой, ответы приходят по порядку.
+// Возвращает число полученных единиц или -1 при ошибке
+int RequestFuelFromStorage(int *marks, int max_units)
+{
+    if (max_units <= 0)
+        return -1;
+
+    char command[32];
+    std::vector<std::string> commands, replies;
+    snprintf(command, sizeof(command), "POPWAIT %d", STORAGE_WAIT_MS);
+    commands.push_back(command);
+    snprintf(command, sizeof(command), "POP %d", max_units - 1);
+    commands.push_back(command);
+
+    int received = -1;
+    if (StorageExchange(commands, replies))
+    {
+        received = 0;
+        int mark = atoi(replies[0].c_str());
+        if (mark > 0)
+            marks[received++] = mark;
+
+        int more = ParseBatchReply(replies[1].c_str(), marks + received, max_units - received);
+        if (more > 0)
+            received += more;
+    }
+    LogEvent(LOG_LEVEL_DEBUG, EV_RECEIVED, received, max_units);
+    return received;
 }
 
-int RequestFuelFromStorage()
+// Запрос топлива высоких марок: max_units команд POPMAX одной пачкой.
+// Сервер отвечает на них, только если запущен с корзинами по маркам (-s grade);
+// иначе приходит ERR, и больше такие запросы не отправляются.
+// Возвращает число полученных единиц или -1 при ошибке
+int RequestBestFuelFromStorage(int *marks, int max_units)
 {
-    if (storage_socket < 0)
+    if (max_units <= 0)
         return -1;
 
-    const char *request = "POP";
-    if (write(storage_socket, request, strlen(request)) < 0)
+    std::vector<std::string> commands(max_units, "POPMAX"), replies;
+    if (!StorageExchange(commands, replies))
     {
-        perror("write");
+        LogEvent(LOG_LEVEL_DEBUG, EV_RECEIVED, -1, max_units);
         return -1;
     }
 
-    char buffer[32];
-    int n = read(storage_socket, buffer, sizeof(buffer) - 1);
-    if (n > 0)
+    int received = 0;
+    for (int i = 0; i < max_units; i++)
     {
-        buffer[n] = '\0';
-        return atoi(buffer);
+        if (strncmp(replies[i].c_str(), "ERR", 3) == 0)
+        {
+            grade_queries = false;
+            continue;
+        }
+        int mark = atoi(replies[i].c_str());
+        if (mark > 0)
+            marks[received++] = mark;
     }
+    LogEvent(LOG_LEVEL_DEBUG, EV_RECEIVED, received, max_units);
+    return received;
+}
 
-    return -1;
+// Резервирование топлива перед поездкой к хранилищу: сервер сразу откладывает единицы,
+// и к прибытию грузовик уже знает, что топливо его ждет.
+// Возвращает номер резерва или -1 (хранилище пусто, ошибка или старый сервер)
+long ReserveFuelInStorage(int max_units)
+{
+    if (!reservations_supported)
+        return -1;
+
+    char command[64];
+    snprintf(command, sizeof(command), "RESERVE %d %d", max_units, RESERVE_TTL_MS);
+    std::vector<std::string> commands(1, command), replies;
+
+    // Ответ "id k m1 ... mk"; марки придут еще раз в ответе на COMMIT
+    long id = -1;
+    if (StorageExchange(commands, replies))
+    {
+        if (strncmp(replies[0].c_str(), "ERR", 3) == 0)
+            reservations_supported = false;
+        else
+            id = strtol(replies[0].c_str(), NULL, 10);
+    }
+    return id > 0 ? id : -1;
+}
+
+// Получение зарезервированного топлива по прибытии.
+// Возвращает число полученных единиц; 0 - резерв истек, -1 - ошибка
+int CommitReservation(long id, int *marks, int max_units)
+{
+    char command[64];
+    snprintf(command, sizeof(command), "COMMIT %ld", id);
+    std::vector<std::string> commands(1, command), replies;
+
+    int received = -1;
+    if (StorageExchange(commands, replies))
+    {
+        received = ParseBatchReply(replies[0].c_str(), marks, max_units);
+        if (received < 0)
+            received = 0; // "-1": резерв истек и вернулся в хранилище
+    }
+    LogEvent(LOG_LEVEL_DEBUG, EV_RECEIVED, received, max_units);
+    return received;
+}
+
+// Есть ли котел на исходе топлива
+bool AnyBoilerLow()
+{
+    bool low = false;
+    pthread_mutex_lock(&mutex);
+    for (int i = 0; i < 4; i++)
+    {
+        if (boiler_low_fuel[i])
+            low = true;
+    }
+    pthread_mutex_unlock(&mutex);
+    return low;
+}
+
+// Соединение для подписки - отдельное соединение вне пула, тем же путем, что и запросы
+// (сокет Unix для локального сервера, иначе TCP). Разделяемая память подписку не
+// поддерживает - для нее пул открыт на сокет Unix
+bool SubscribeToInventory()
+{
+    int fd = storage_client.Dial();
+    if (fd < 0)
+        return false;
+
+    // Порог 1: состояние "above" означает, что в хранилище есть хотя бы одна единица
+    char request[32];
+    snprintf(request, sizeof(request), "SUBSCRIBE %d 1\n", INVENTORY_INTERVAL_MS);
+    if (write(fd, request, strlen(request)) < 0)
+    {
+        close(fd);
+        return false;
+    }
+    inventory_socket = fd;
+    inventory_subscribed = true;
+    return true;
+}
+
+// Поток подписки: разбор строк "INV size added state" и пробуждение ждущих грузовиков.
+// Ответ, отличный от "OK" (старый сервер), или обрыв соединения отключают подписку
+void *InventoryThread(void *arg)
+{
+    char buffer[256];
+    size_t len = 0;
+    bool confirmed = false;
+    bool valid = true;
+    while (run_flag && valid)
+    {
+        int n = read(inventory_socket, buffer + len, sizeof(buffer) - len);
+        if (n <= 0)
+            break;
+        len += n;
+
+        char *start = buffer;
+        char *eol;
+        while (valid && (eol = (char *)memchr(start, '\n', buffer + len - start)) != NULL)
+        {
+            *eol = '\0';
+            int size;
+            if (!confirmed)
+            {
+                confirmed = valid = strcmp(start, "OK") == 0;
+            }
+            else if (sscanf(start, "INV %d", &size) == 1)
+            {
+                pthread_mutex_lock(&inventory_mutex);
+                inventory_size = size;
+                pthread_cond_broadcast(&inventory_cond);
+                pthread_mutex_unlock(&inventory_mutex);
+            }
+            start = eol + 1;
+        }
+        len -= start - buffer;
+        memmove(buffer, start, len);
+        if (len == sizeof(buffer))
+            len = 0; // Строка не помещается в буфер - отбрасываем
+    }
+
+    pthread_mutex_lock(&inventory_mutex);
+    inventory_subscribed = false;
+    pthread_cond_broadcast(&inventory_cond);
+    pthread_mutex_unlock(&inventory_mutex);
+    return NULL;
+}
+
+// Срок для pthread_cond_timedwait: через ms миллисекунд (ms < 1000)
+static void DeadlineAfterMs(struct timespec *deadline, int ms)
+{
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_nsec += ms * 1000000L;
+    if (deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000;
+    }
+}
+
+// Ожидание топлива в хранилище по событиям подписки. Тайм-аут нужен для проверки run_flag
+void WaitForInventory()
+{
+    pthread_mutex_lock(&inventory_mutex);
+    while (inventory_subscribed && inventory_size <= 0 && run_flag)
+    {
+        struct timespec deadline;
+        DeadlineAfterMs(&deadline, 500);
+        pthread_cond_timedwait(&inventory_cond, &inventory_mutex, &deadline);
+    }
+    pthread_mutex_unlock(&inventory_mutex);
+}
+
+// Загрузка грузовика: до TRUCK_CAPACITY единиц за один сетевой обмен.
+// Если какой-то котел на исходе, сначала просится топливо самых высоких марок:
+// оно горит дольше. При пустом хранилище - обычный запрос с ожиданием. При подписке
+// сначала ожидается событие о появлении топлива, а не POPWAIT на соединении хранилища.
+// Если перед поездкой топливо удалось зарезервировать (reservation > 0), оно просто забирается.
+// Единица марки m горит m секунд, поэтому котел получает сумму марок всех единиц кузова
+// (не больше MAX_BOILER_FUEL): это и возвращается. В best_mark записывается наибольшая
+// марка погруженных единиц, она выводится у котла как "Mark"
+int LoadTruckFromStorage(long reservation, int *best_mark)
+{
+    *best_mark = 0;
+    int marks[TRUCK_CAPACITY];
+    int count = 0;
+    if (reservation > 0)
+        count = CommitReservation(reservation, marks, TRUCK_CAPACITY);
+    if (count <= 0)
+    {
+        count = 0;
+        WaitForInventory();
+        if (!run_flag)
+            return 0;
+        if (grade_queries && AnyBoilerLow())
+            count = RequestBestFuelFromStorage(marks, TRUCK_CAPACITY);
+        if (count == 0)
+            count = RequestFuelFromStorage(marks, TRUCK_CAPACITY);
+    }
+
+    int fuel = 0;
+    for (int i = 0; i < count; i++)
+    {
+        fuel += marks[i];
+        if (marks[i] > *best_mark)
+            *best_mark = marks[i];
+    }
+    if (fuel > MAX_BOILER_FUEL)
+        fuel = MAX_BOILER_FUEL;
+    return fuel;
+}
+
+// Результат запроса, который уже выполняет другой поток ввода-вывода
+long AwaitStorageCall(StorageCall *call)
+{
+    pthread_mutex_lock(&mutex);
+    while (!call->completed)
+    {
+        pthread_cond_wait(&storage_done_cond, &mutex);
+    }
+    long result = call->result;
+    pthread_mutex_unlock(&mutex);
+    return result;
+}
+
+// Поток ввода-вывода хранилища. Потоки берут запросы из общей очереди по порядку, у каждого
+// свое соединение пула (или своя ячейка разделяемой памяти), так что ожидание топлива одним
+// грузовиком (POPWAIT) не задерживает запросы другого. После выхода (run_flag = 0)
+// оставшиеся запросы завершаются без обращения к серверу
+void *StorageIoThread(void *arg)
+{
+    int index = *((int *)arg);
+    if (storage_transport == TRANSPORT_SHM)
+    {
+        io_shm_slot = index == 0 ? storage_shm_slot : ClaimShmSlot(storage_shm);
+        if (io_shm_slot < 0)
+            return NULL; // Свободных ячеек нет - запросы выполнят остальные потоки
+    }
+
+    while (true)
+    {
+        pthread_mutex_lock(&storage_calls_mutex);
+        while (storage_calls.empty() && !storage_calls_closed)
+        {
+            pthread_cond_wait(&storage_calls_cond, &storage_calls_mutex);
+        }
+        if (storage_calls.empty())
+        {
+            pthread_mutex_unlock(&storage_calls_mutex);
+            break;
+        }
+        StorageCall *call = storage_calls.front();
+        storage_calls.pop();
+        pthread_mutex_unlock(&storage_calls_mutex);
+
+        if (call->type == CALL_RESERVE)
+        {
+            call->result = run_flag ? ReserveFuelInStorage(TRUCK_CAPACITY) : -1;
+        }
+        else
+        {
+            // Резерв взят из очереди раньше, но мог еще выполняться в другом потоке
+            long reservation = AwaitStorageCall(call->reserve);
+            call->result = run_flag ? LoadTruckFromStorage(reservation, &call->mark) : 0;
+        }
+        call->done(call);
+    }
+
+    if (storage_transport == TRANSPORT_SHM && index != 0)
+        ReleaseShmSlot(storage_shm, io_shm_slot);
+    return NULL;
+}
+
+// Постановка запроса в очередь потока ввода-вывода
+void SubmitStorageCall(StorageCall *call, StorageCallType type, int truck, StorageCall *reserve,
+                       void (*done)(StorageCall *call))
+{
+    call->type = type;
+    call->truck = truck;
+    call->reserve = reserve;
+    call->result = -1;
+    call->mark = 0;
+    call->completed = false;
+    call->done = done;
+
+    pthread_mutex_lock(&storage_calls_mutex);
+    storage_calls.push(call);
+    pthread_cond_signal(&storage_calls_cond);
+    pthread_mutex_unlock(&storage_calls_mutex);
+}
+
+// Остановка потоков ввода-вывода после выполнения всех запросов
+void StopStorageClient(pthread_t *io_threads)
+{
+    pthread_mutex_lock(&storage_calls_mutex);
+    storage_calls_closed = true;
+    pthread_cond_broadcast(&storage_calls_cond);
+    pthread_mutex_unlock(&storage_calls_mutex);
+    for (int i = 0; i < STORAGE_IO_THREADS; i++)
+    {
+        pthread_join(io_threads[i], NULL);
+    }
 }
 
 // Функция для неблокирующего ввода
@@ -143,6 +667,10 @@ static void set_raw_mode(int enable)
         tcgetattr(0, &oldt);
         newt = oldt;
         newt.c_lflag &= ~(ICANON | ECHO);
+        // read возвращается сразу, даже если клавиша не нажата: иначе главный цикл
+        // отрисовки ждал бы ввода и рисовал кадр только на нажатие
+        newt.c_cc[VMIN] = 0;
+        newt.c_cc[VTIME] = 0;
         tcsetattr(0, TCSANOW, &newt);
     }
     else
@@ -151,8 +679,31 @@ static void set_raw_mode(int enable)
     }
 }
 
+// Публикация снимка для потока отрисовки. Вызывается под mutex после изменения общих данных
+void PublishScene()
+{
+    Scene scene;
+    memset(&scene, 0, sizeof(scene));
+    memcpy(scene.boiler_states, boiler_states, sizeof(boiler_states));
+    memcpy(scene.boiler_fuel_level, boiler_fuel_level, sizeof(boiler_fuel_level));
+    memcpy(scene.boiler_fuel_marks, boiler_fuel_marks, sizeof(boiler_fuel_marks));
+    memcpy(scene.boiler_targeted, boiler_targeted, sizeof(boiler_targeted));
+    memcpy(scene.boiler_low_fuel, boiler_low_fuel, sizeof(boiler_low_fuel));
+    scene.vehicle1_state = vehicle1_state;
+    scene.vehicle1_fuel = vehicle1_fuel;
+    scene.vehicle1_target_boiler = vehicle1_target_boiler;
+    scene.vehicle1_x = vehicle1_x;
+    scene.vehicle1_y = vehicle1_y;
+    scene.vehicle2_state = vehicle2_state;
+    scene.vehicle2_fuel = vehicle2_fuel;
+    scene.vehicle2_target_boiler = vehicle2_target_boiler;
+    scene.vehicle2_x = vehicle2_x;
+    scene.vehicle2_y = vehicle2_y;
+    scene_snapshot.Publish(scene);
+}
+
 // Функция для плавного перемещения грузовика
-void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y, int vehicle_id)
+void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y)
 {
     int steps = 20;
     int start_x = *vehicle_x;
@@ -164,33 +715,34 @@ void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y, i
         int new_x = start_x + (target_x - start_x) * progress;
         int new_y = start_y + (target_y - start_y) * progress;
 
-        MoveTo(new_x, new_y, vehicle_id);
+        pthread_mutex_lock(&mutex);
+        *vehicle_x = new_x;
+        *vehicle_y = new_y;
+        PublishScene();
+        pthread_mutex_unlock(&mutex);
         usleep(50000);
     }
 
+    pthread_mutex_lock(&mutex);
     *vehicle_x = target_x;
     *vehicle_y = target_y;
+    PublishScene();
+    pthread_mutex_unlock(&mutex);
 }
 
 // Функция для обновления индикатора топлива в котле
-void UpdateBoilerFuelIndicator(int boiler_id)
+void UpdateBoilerFuelIndicator(const Scene &scene, int boiler_id)
 {
-    if (fuel_bar_ids[boiler_id] != 0)
-    {
-        Delete(fuel_bar_ids[boiler_id]);
-        fuel_bar_ids[boiler_id] = 0;
-    }
-
-    if (boiler_fuel_level[boiler_id] > 0)
+    if (scene.boiler_fuel_level[boiler_id] > 0)
     {
         int max_fuel_height = BOILER_H - 20;
-        int fuel_height = (boiler_fuel_level[boiler_id] * max_fuel_height) / 20;
+        int fuel_height = (scene.boiler_fuel_level[boiler_id] * max_fuel_height) / MAX_BOILER_FUEL;
         int fuel_y = BOILER_Y + BOILER_H - fuel_height - 10;
 
         int color;
-        if (boiler_states[boiler_id] == BURNING)
+        if (scene.boiler_states[boiler_id] == BURNING)
         {
-            if (boiler_low_fuel[boiler_id])
+            if (scene.boiler_low_fuel[boiler_id])
                 color = RGB(255, 0, 0);
             else
                 color = RGB(255, 165, 0);
@@ -200,13 +752,11 @@ void UpdateBoilerFuelIndicator(int boiler_id)
             color = RGB(0, 200, 0);
         }
 
-        fuel_bar_ids[boiler_id] = Rect(
-            BOILER_X[boiler_id] + 10,
-            fuel_y,
-            BOILER_W - 20,
-            fuel_height,
-            0,
-            color);
+        fuel_bars[boiler_id].Update(BOILER_X[boiler_id] + 10, fuel_y, BOILER_W - 20, fuel_height, color);
+    }
+    else
+    {
+        fuel_bars[boiler_id].Hide();
     }
 }
 
@@ -235,66 +785,65 @@ int SelectAvailableBoiler()
 }
 
 // Функция для обновления текстовой информации
-void UpdateTextInfo()
+void UpdateTextInfo(const Scene &scene)
 {
-    for (int i = 0; i < 15; i++)
-    {
-        if (text_ids[i] != 0)
-        {
-            Delete(text_ids[i]);
-            text_ids[i] = 0;
-        }
-    }
-
     int y_offset = 10;
 
     char vehicle1_fuel_text[50];
-    sprintf(vehicle1_fuel_text, "Truck1 Fuel: %d", vehicle1_fuel);
-    text_ids[0] = Text(10, y_offset, vehicle1_fuel_text, RGB(255, 255, 255));
+    sprintf(vehicle1_fuel_text, "Truck1 Fuel: %d", scene.vehicle1_fuel);
+    text_overlay.Put(0, 10, y_offset, vehicle1_fuel_text, RGB(255, 255, 255));
 
     char vehicle1_target_text[50];
-    if (vehicle1_target_boiler != -1)
+    if (scene.vehicle1_target_boiler != -1)
     {
-        sprintf(vehicle1_target_text, "Truck1 Target: %d", vehicle1_target_boiler + 1);
+        sprintf(vehicle1_target_text, "Truck1 Target: %d", scene.vehicle1_target_boiler + 1);
     }
     else
     {
         sprintf(vehicle1_target_text, "Truck1 Target: None");
     }
-    text_ids[1] = Text(10, y_offset + 20, vehicle1_target_text, RGB(255, 255, 255));
+    text_overlay.Put(1, 10, y_offset + 20, vehicle1_target_text, RGB(255, 255, 255));
 
     char vehicle2_fuel_text[50];
-    sprintf(vehicle2_fuel_text, "Truck2 Fuel: %d", vehicle2_fuel);
-    text_ids[2] = Text(10, y_offset + 40, vehicle2_fuel_text, RGB(255, 255, 255));
+    sprintf(vehicle2_fuel_text, "Truck2 Fuel: %d", scene.vehicle2_fuel);
+    text_overlay.Put(2, 10, y_offset + 40, vehicle2_fuel_text, RGB(255, 255, 255));
 
     char vehicle2_target_text[50];
-    if (vehicle2_target_boiler != -1)
+    if (scene.vehicle2_target_boiler != -1)
     {
-        sprintf(vehicle2_target_text, "Truck2 Target: %d", vehicle2_target_boiler + 1);
+        sprintf(vehicle2_target_text, "Truck2 Target: %d", scene.vehicle2_target_boiler + 1);
     }
     else
     {
         sprintf(vehicle2_target_text, "Truck2 Target: None");
     }
-    text_ids[3] = Text(10, y_offset + 60, vehicle2_target_text, RGB(255, 255, 255));
+    text_overlay.Put(3, 10, y_offset + 60, vehicle2_target_text, RGB(255, 255, 255));
 
     for (int i = 0; i < 4; i++)
     {
         char boiler_mark_text[50];
-        sprintf(boiler_mark_text, "Boiler %d: Mark %d, %s", i + 1, boiler_fuel_marks[i],
-                boiler_low_fuel[i] ? "LOW FUEL!" : (boiler_targeted[i] ? "Targeted" : "Free"));
-        text_ids[7 + i] = Text(375, y_offset + i * 20, boiler_mark_text,
-                               boiler_low_fuel[i] ? RGB(255, 0, 0) : RGB(255, 255, 255));
+        sprintf(boiler_mark_text, "Boiler %d: Mark %d, %s", i + 1, scene.boiler_fuel_marks[i],
+                scene.boiler_low_fuel[i] ? "LOW FUEL!" : (scene.boiler_targeted[i] ? "Targeted" : "Free"));
+        text_overlay.Put(7 + i, 375, y_offset + i * 20, boiler_mark_text,
+                         scene.boiler_low_fuel[i] ? RGB(255, 0, 0) : RGB(255, 255, 255));
     }
 }
 
-// Функция для отрисовки состояния
-void DrawState()
+// Функция для отрисовки состояния. previous - снимок прошлого кадра (NULL в первом кадре):
+// перемещение грузовиков и индикаторы топлива меняются только при отличиях
+void DrawState(const Scene &scene, const Scene *previous)
 {
-    pthread_mutex_lock(&mutex);
+    if (previous == NULL || scene.vehicle1_x != previous->vehicle1_x || scene.vehicle1_y != previous->vehicle1_y)
+    {
+        MoveTo(scene.vehicle1_x, scene.vehicle1_y, vehicle1_id);
+    }
+    if (previous == NULL || scene.vehicle2_x != previous->vehicle2_x || scene.vehicle2_y != previous->vehicle2_y)
+    {
+        MoveTo(scene.vehicle2_x, scene.vehicle2_y, vehicle2_id);
+    }
 
     const char *v1state = "";
-    switch (vehicle1_state)
+    switch (scene.vehicle1_state)
     {
     case MOVING_TO_STORAGE:
         v1state = "To Storage";
@@ -309,10 +858,10 @@ void DrawState()
         v1state = "Unloading";
         break;
     }
-    SetText(vehicle1_id, v1state);
+    text_overlay.Label(LABEL_VEHICLE1, vehicle1_id, v1state, TEXT_OVERLAY_KEEP_COLOR);
 
     const char *v2state = "";
-    switch (vehicle2_state)
+    switch (scene.vehicle2_state)
     {
     case MOVING_TO_STORAGE:
         v2state = "To Storage";
@@ -327,29 +876,115 @@ void DrawState()
         v2state = "Unloading";
         break;
     }
-    SetText(vehicle2_id, v2state);
+    text_overlay.Label(LABEL_VEHICLE2, vehicle2_id, v2state, TEXT_OVERLAY_KEEP_COLOR);
 
     for (int i = 0; i < 4; i++)
     {
         char boiler_text[100];
-        const char *bstate = boiler_states[i] == BURNING ? "Burning" : "Waiting";
+        const char *bstate = scene.boiler_states[i] == BURNING ? "Burning" : "Waiting";
         sprintf(boiler_text, "Boiler %d: %s", i + 1, bstate);
-        SetText(boiler_ids[i], boiler_text);
 
-        if (boiler_states[i] == BURNING)
+        int color;
+        if (scene.boiler_states[i] == BURNING)
         {
-            if (boiler_low_fuel[i])
-                SetColor(boiler_ids[i], RGB(255, 0, 0));
+            if (scene.boiler_low_fuel[i])
+                color = RGB(255, 0, 0);
             else
-                SetColor(boiler_ids[i], RGB(255, 50, 50));
+                color = RGB(255, 50, 50);
         }
         else
         {
-            SetColor(boiler_ids[i], RGB(200, 100, 100));
+            color = RGB(200, 100, 100);
+        }
+        text_overlay.Label(LABEL_BOILER + i, boiler_ids[i], boiler_text, color);
+
+        if (previous == NULL || scene.boiler_fuel_level[i] != previous->boiler_fuel_level[i] ||
+            scene.boiler_states[i] != previous->boiler_states[i] ||
+            scene.boiler_low_fuel[i] != previous->boiler_low_fuel[i])
+        {
+            UpdateBoilerFuelIndicator(scene, i);
         }
     }
 
-    UpdateTextInfo();
+    UpdateTextInfo(scene);
+    text_overlay.EndFrame();
+}
+
+// Поток отрисовки: с постоянной частотой читает последний снимок и рисует изменения.
+// После запуска потоков графику вызывает только он, поэтому грузовики, котлы и
+// обратные вызовы хранилища не ждут графический сервер, а отрисовка не занимает mutex
+void *RenderThread(void *arg)
+{
+    Scene previous, current;
+    bool first = true;
+    timespec next_frame;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+    while (run_flag)
+    {
+        uint64_t frame_start = NowNs();
+        scene_snapshot.Read(&current);
+        DrawState(current, first ? NULL : &previous);
+        previous = current;
+        first = false;
+        uint64_t frame_ns = NowNs() - frame_start;
+        render_frames.Record(frame_ns);
+        if (frame_ns > RENDER_STALL_MS * 1000000ULL)
+            render_stalls++;
+
+        // Следующий кадр через RENDER_PERIOD_MS от начала текущего
+        next_frame.tv_nsec += RENDER_PERIOD_MS * 1000000L;
+        if (next_frame.tv_nsec >= 1000000000L)
+        {
+            next_frame.tv_sec++;
+            next_frame.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+    }
+    return NULL;
+}
+
+// Завершение резерва: номер уже в call->result, достаточно отметить готовность
+void OnReserveDone(StorageCall *call)
+{
+    pthread_mutex_lock(&mutex);
+    call->completed = true;
+    pthread_cond_broadcast(&storage_done_cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+// Завершение погрузки: топливо сразу попадает в грузовик
+void OnLoadDone(StorageCall *call)
+{
+    pthread_mutex_lock(&mutex);
+    if (call->result > 0)
+    {
+        if (call->truck == 1)
+        {
+            vehicle1_fuel = call->result;
+            vehicle1_mark = call->mark;
+        }
+        else
+        {
+            vehicle2_fuel = call->result;
+            vehicle2_mark = call->mark;
+        }
+        PublishScene();
+    }
+    call->completed = true;
+    pthread_cond_broadcast(&storage_done_cond);
+    pthread_mutex_unlock(&mutex);
+}
+
+// Ожидание запроса к хранилищу; анимацию тем временем рисует поток отрисовки.
+// Запрос завершается всегда (при выходе - без обращения к серверу), поэтому
+// run_flag здесь не проверяется: после возврата поток ввода-вывода call не трогает
+void WaitForStorageCall(StorageCall *call)
+{
+    pthread_mutex_lock(&mutex);
+    while (!call->completed)
+    {
+        pthread_cond_wait(&storage_done_cond, &mutex);
+    }
     pthread_mutex_unlock(&mutex);
 }
 
@@ -360,61 +995,67 @@ void *Vehicle1Thread(void *arg)
     {
         if (vehicle1_state == MOVING_TO_STORAGE)
         {
-            MoveVehicleTo(&vehicle1_x, &vehicle1_y, STORAGE_STOP_X, STORAGE_STOP_Y1, vehicle1_id);
+            // Резерв выполняется, пока грузовик едет; если грузовик не доедет (выход), резерв истечет сам
+            SubmitStorageCall(&vehicle1_reserve, CALL_RESERVE, 1, NULL, OnReserveDone);
+            MoveVehicleTo(&vehicle1_x, &vehicle1_y, STORAGE_STOP_X, STORAGE_STOP_Y1);
 
             if (!run_flag)
                 break;
 
             pthread_mutex_lock(&mutex);
             vehicle1_state = LOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
+            // Погрузка запрашивается сразу: обмен с хранилищем идет одновременно с анимацией
+            SubmitStorageCall(&vehicle1_load, CALL_LOAD, 1, &vehicle1_reserve, OnLoadDone);
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
+            WaitForStorageCall(&vehicle1_load);
 
             pthread_mutex_lock(&mutex);
-            int fuel = RequestFuelFromStorage();
+            int fuel = vehicle1_load.result;
             if (fuel > 0)
             {
-                vehicle1_fuel = fuel;
                 vehicle1_target_boiler = SelectAvailableBoiler();
 
                 if (vehicle1_target_boiler != -1)
                 {
                     vehicle1_state = MOVING_TO_BOILER;
+                    LogEvent(LOG_LEVEL_INFO, EV_LOADED, 1, fuel, vehicle1_target_boiler + 1);
                 }
                 else
                 {
                     vehicle1_state = MOVING_TO_STORAGE;
                 }
-                UpdateTextInfo();
             }
             else
             {
                 vehicle1_state = MOVING_TO_STORAGE;
+                LogEvent(LOG_LEVEL_WARN, EV_STORAGE_EMPTY, 1);
             }
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
         if (vehicle1_state == MOVING_TO_BOILER && vehicle1_target_boiler != -1 && run_flag)
         {
             int target_x = BOILER_X[vehicle1_target_boiler];
-            MoveVehicleTo(&vehicle1_x, &vehicle1_y, target_x, BOILER_STOP_Y1, vehicle1_id);
+            MoveVehicleTo(&vehicle1_x, &vehicle1_y, target_x, BOILER_STOP_Y1);
 
             if (!run_flag)
                 break;
 
             pthread_mutex_lock(&mutex);
             vehicle1_state = UNLOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
@@ -422,18 +1063,18 @@ void *Vehicle1Thread(void *arg)
             {
                 boiler_states[vehicle1_target_boiler] = BURNING;
                 boiler_fuel_level[vehicle1_target_boiler] = vehicle1_fuel;
-                boiler_fuel_marks[vehicle1_target_boiler] = vehicle1_fuel;
+                boiler_fuel_marks[vehicle1_target_boiler] = vehicle1_mark;
+                LogEvent(LOG_LEVEL_INFO, EV_DELIVERED, 1, vehicle1_fuel, vehicle1_target_boiler + 1);
                 boiler_low_fuel[vehicle1_target_boiler] = false;
                 boiler_targeted[vehicle1_target_boiler] = false;
-                UpdateBoilerFuelIndicator(vehicle1_target_boiler);
 
                 vehicle1_fuel = 0;
+                vehicle1_mark = 0;
                 vehicle1_target_boiler = -1;
-                UpdateTextInfo();
             }
 
-            DrawState();
             vehicle1_state = MOVING_TO_STORAGE;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -449,61 +1090,67 @@ void *Vehicle2Thread(void *arg)
     {
         if (vehicle2_state == MOVING_TO_STORAGE)
         {
-            MoveVehicleTo(&vehicle2_x, &vehicle2_y, STORAGE_STOP_X, STORAGE_STOP_Y2, vehicle2_id);
+            // Резерв выполняется, пока грузовик едет; если грузовик не доедет (выход), резерв истечет сам
+            SubmitStorageCall(&vehicle2_reserve, CALL_RESERVE, 2, NULL, OnReserveDone);
+            MoveVehicleTo(&vehicle2_x, &vehicle2_y, STORAGE_STOP_X, STORAGE_STOP_Y2);
 
             if (!run_flag)
                 break;
 
             pthread_mutex_lock(&mutex);
             vehicle2_state = LOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
+            // Погрузка запрашивается сразу: обмен с хранилищем идет одновременно с анимацией
+            SubmitStorageCall(&vehicle2_load, CALL_LOAD, 2, &vehicle2_reserve, OnLoadDone);
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
+            WaitForStorageCall(&vehicle2_load);
 
             pthread_mutex_lock(&mutex);
-            int fuel = RequestFuelFromStorage();
+            int fuel = vehicle2_load.result;
             if (fuel > 0)
             {
-                vehicle2_fuel = fuel;
                 vehicle2_target_boiler = SelectAvailableBoiler();
 
                 if (vehicle2_target_boiler != -1)
                 {
                     vehicle2_state = MOVING_TO_BOILER;
+                    LogEvent(LOG_LEVEL_INFO, EV_LOADED, 2, fuel, vehicle2_target_boiler + 1);
                 }
                 else
                 {
                     vehicle2_state = MOVING_TO_STORAGE;
                 }
-                UpdateTextInfo();
             }
             else
             {
                 vehicle2_state = MOVING_TO_STORAGE;
+                LogEvent(LOG_LEVEL_WARN, EV_STORAGE_EMPTY, 2);
             }
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
         if (vehicle2_state == MOVING_TO_BOILER && vehicle2_target_boiler != -1 && run_flag)
         {
             int target_x = BOILER_X[vehicle2_target_boiler];
-            MoveVehicleTo(&vehicle2_x, &vehicle2_y, target_x, BOILER_STOP_Y2, vehicle2_id);
+            MoveVehicleTo(&vehicle2_x, &vehicle2_y, target_x, BOILER_STOP_Y2);
 
             if (!run_flag)
                 break;
 
             pthread_mutex_lock(&mutex);
             vehicle2_state = UNLOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
@@ -511,18 +1158,18 @@ void *Vehicle2Thread(void *arg)
             {
                 boiler_states[vehicle2_target_boiler] = BURNING;
                 boiler_fuel_level[vehicle2_target_boiler] = vehicle2_fuel;
-                boiler_fuel_marks[vehicle2_target_boiler] = vehicle2_fuel;
+                boiler_fuel_marks[vehicle2_target_boiler] = vehicle2_mark;
+                LogEvent(LOG_LEVEL_INFO, EV_DELIVERED, 2, vehicle2_fuel, vehicle2_target_boiler + 1);
                 boiler_low_fuel[vehicle2_target_boiler] = false;
                 boiler_targeted[vehicle2_target_boiler] = false;
-                UpdateBoilerFuelIndicator(vehicle2_target_boiler);
 
                 vehicle2_fuel = 0;
+                vehicle2_mark = 0;
                 vehicle2_target_boiler = -1;
-                UpdateTextInfo();
             }
 
-            DrawState();
             vehicle2_state = MOVING_TO_STORAGE;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -537,7 +1184,9 @@ void *BoilerThread(void *arg)
     int id = *((int *)arg);
     while (run_flag)
     {
+        uint64_t wait_start = NowNs();
         pthread_mutex_lock(&mutex);
+        boiler_lock_waits.Record(NowNs() - wait_start);
         if (boiler_states[id] == BURNING)
         {
             if (boiler_fuel_level[id] > 0)
@@ -548,20 +1197,15 @@ void *BoilerThread(void *arg)
                 {
                     boiler_low_fuel[id] = true;
                 }
-                UpdateBoilerFuelIndicator(id);
             }
             else
             {
                 boiler_states[id] = WAITING_FOR_FUEL;
                 boiler_fuel_marks[id] = 0;
+                LogEvent(LOG_LEVEL_INFO, EV_BOILER_EMPTY, id + 1);
                 boiler_low_fuel[id] = false;
-
-                if (fuel_bar_ids[id] != 0)
-                {
-                    Delete(fuel_bar_ids[id]);
-                    fuel_bar_ids[id] = 0;
-                }
             }
+            PublishScene();
         }
         pthread_mutex_unlock(&mutex);
         usleep(1000000);
@@ -578,20 +1222,30 @@ int main()
         return 1;
     }
 
+    // Потоки ввода-вывода хранилища
+    pthread_t storage_io_threads[STORAGE_IO_THREADS];
+    int storage_io_index[STORAGE_IO_THREADS];
+    for (int i = 0; i < STORAGE_IO_THREADS; i++)
+    {
+        storage_io_index[i] = i;
+        pthread_create(&storage_io_threads[i], NULL, StorageIoThread, &storage_io_index[i]);
+    }
+
+    // Подписка на изменения хранилища
+    pthread_t inventory_thread;
+    bool subscribed = SubscribeToInventory();
+    if (subscribed)
+        pthread_create(&inventory_thread, NULL, InventoryThread, NULL);
+    else
+        fprintf(stderr, "Inventory subscription unavailable, trucks will poll storage\n");
+
     ConnectGraph("Power Station Simulation - Boiler Server");
 
     // Инициализация случайного генератора
     srand(time(NULL));
 
-    // Инициализация ID
-    for (int i = 0; i < 15; i++)
-    {
-        text_ids[i] = 0;
-    }
-    for (int i = 0; i < 4; i++)
-    {
-        fuel_bar_ids[i] = 0;
-    }
+    StartAsyncLog(event_formats, EV_COUNT, LOG_LEVEL_WARN, stdout);
+
 
     // Создание графических элементов
     storage_id = Rect(STORAGE_X, STORAGE_Y, STORAGE_W, STORAGE_H, 5, RGB(200, 200, 100));
@@ -612,6 +1266,12 @@ int main()
         SetText(boiler_ids[i], boiler_name);
     }
 
+    // Индикаторы топлива создаются скрытыми поверх котлов и дальше только меняются
+    for (int i = 0; i < 4; i++)
+    {
+        fuel_bars[i].Create(BOILER_X[i] + 10, BOILER_Y + 10, BOILER_W - 20, BOILER_H - 20, RGB(0, 200, 0));
+    }
+
     Text(10, 120, "Boiler Server - Press 'q' to quit", RGB(255, 255, 255));
 
     // Дороги
@@ -620,10 +1280,15 @@ int main()
     Line(50, 215, 530, 215, RGB(255, 255, 255));
     Line(50, 220, 530, 220, RGB(255, 255, 255));
 
-    // Запуск потоков
-    pthread_t vehicle1_thread, vehicle2_thread, boiler_threads[4];
+    timespec started; // Для расчета графических вызовов в секунду
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Запуск потоков; первый снимок публикуется до них
+    PublishScene();
+    pthread_t vehicle1_thread, vehicle2_thread, boiler_threads[4], render_thread;
     int boiler_ids_arg[4] = {0, 1, 2, 3};
 
+    pthread_create(&render_thread, NULL, RenderThread, NULL);
     pthread_create(&vehicle1_thread, NULL, Vehicle1Thread, NULL);
     pthread_create(&vehicle2_thread, NULL, Vehicle2Thread, NULL);
 
@@ -636,11 +1301,10 @@ int main()
     set_raw_mode(1);
     printf("Boiler server started. Press 'q' to quit\n");
 
-    // Главный цикл визуализации
+    // Главный цикл: отрисовкой занят RenderThread, здесь только ввод
     char c;
     while (run_flag)
     {
-        DrawState();
         usleep(50000);
 
         if (read(0, &c, 1) == 1)
@@ -665,12 +1329,41 @@ int main()
     {
         pthread_join(boiler_threads[i], NULL);
     }
+    pthread_join(render_thread, NULL);
 
-    if (storage_socket >= 0)
+    // Грузовики дождались своих запросов; очередь пуста или завершится без обмена
+    StopStorageClient(storage_io_threads);
+
+    if (subscribed)
+    {
+        // Прерывает блокирующее чтение потока подписки
+        shutdown(inventory_socket, SHUT_RDWR);
+        pthread_join(inventory_thread, NULL);
+        close(inventory_socket);
+    }
+    if (storage_transport != TRANSPORT_SHM)
     {
-        close(storage_socket);
+        printf("Storage client: %ld connects, %ld failed attempts, %ld drops, %ld timeouts, %ld late units\n",
+               storage_client.Connects(), storage_client.ConnectFailures(), storage_client.Drops(),
+               storage_client.Timeouts(), storage_client.LateUnits());
     }
+    storage_client.Close();
+    if (storage_shm != NULL)
+    {
+        ReleaseShmSlot(storage_shm, storage_shm_slot);
+        CloseShmSegment(storage_shm);
+    }
+
+    printf("Render loop: %llu frames, frame p50 %.3f ms, p99 %.3f ms, max %.3f ms, %ld over %d ms\n",
+           (unsigned long long)render_frames.Count(), render_frames.Percentile(0.5) / 1e6,
+           render_frames.Percentile(0.99) / 1e6, render_frames.Max() / 1e6, render_stalls, RENDER_STALL_MS);
+    printf("Boiler lock wait: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", boiler_lock_waits.Percentile(0.5) / 1e6,
+           boiler_lock_waits.Percentile(0.99) / 1e6, boiler_lock_waits.Max() / 1e6);
+
+    PrintFuelBarStats(fuel_bars, 4, SecondsSince(started));
+    text_overlay.PrintStats();
 
+    StopAsyncLog();
     CloseGraph();
     return 0;
 }
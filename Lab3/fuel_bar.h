@@ -0,0 +1,140 @@
+#ifndef FUEL_BAR_H_INCLUDED
+#define FUEL_BAR_H_INCLUDED
+
+#include <stdio.h>
+#include <time.h>
+#include "vingraph.h"
+
+// Индикатор уровня топлива котла, который создается один раз и дальше только меняется.
+// Прежний индикатор на каждое изменение уровня удалял прямоугольник (Delete) и создавал
+// новый (Rect): два обращения к графическому серверу и новый объект в нем. Здесь
+// размер меняет EnlargeTo, цвет - SetColor, а пустой котел прячет Hide. Вызов
+// пропускается, если соответствующее свойство не изменилось.
+// Create вызывается из main() до запуска потоков, Update и Hide - только из потока
+// отрисовки, а счетчики читаются после его завершения. Так у объекта в каждый момент
+// один владелец, и мьютекс не нужен.
+class FuelBar
+{
+public:
+    FuelBar()
+        : id(0), visible(false), x(0), y(0), w(0), h(0), color(0), updates(0), calls(0), legacy_calls(0)
+    {
+    }
+
+    // Создает скрытый прямоугольник. Вызывается до запуска потоков
+    void Create(int left, int top, int width, int height, int fill)
+    {
+        id = Rect(left, top, width, height, 0, fill);
+        ::Hide(id);
+        x = left;
+        y = top;
+        w = width;
+        h = height;
+        color = fill;
+        visible = false;
+        calls += 2;
+    }
+
+    // Показывает полосу с заданными границами и цветом; высота 0 прячет ее
+    void Update(int left, int top, int width, int height, int fill)
+    {
+        updates++;
+        legacy_calls += (visible ? 1 : 0) + (height > 0 ? 1 : 0);
+        if (height <= 0)
+        {
+            HideBar();
+            return;
+        }
+        if (left != x || top != y || width != w || height != h)
+        {
+            EnlargeTo(left, top, width, height, id);
+            x = left;
+            y = top;
+            w = width;
+            h = height;
+            calls++;
+        }
+        if (fill != color)
+        {
+            SetColor(id, fill);
+            color = fill;
+            calls++;
+        }
+        if (!visible)
+        {
+            Show(id);
+            visible = true;
+            calls++;
+        }
+    }
+
+    // Прячет полосу (котел пуст)
+    void Hide()
+    {
+        updates++;
+        legacy_calls += visible ? 1 : 0;
+        HideBar();
+    }
+
+    long Updates() const
+    {
+        return updates;
+    }
+
+    // Графические вызовы, сделанные индикатором, включая создание
+    long Calls() const
+    {
+        return calls;
+    }
+
+    // Сколько вызовов сделал бы прежний индикатор (Delete + Rect) на тех же изменениях
+    long LegacyCalls() const
+    {
+        return legacy_calls;
+    }
+
+private:
+    void HideBar()
+    {
+        if (visible)
+        {
+            ::Hide(id);
+            visible = false;
+            calls++;
+        }
+    }
+
+    int id;
+    bool visible;
+    int x, y, w, h;
+    int color;
+    long updates;
+    long calls;
+    long legacy_calls;
+};
+
+// Секунды с момента start по CLOCK_MONOTONIC
+static inline double SecondsSince(const timespec &start)
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// Печатает число графических вызовов индикаторов в секунду и сравнение с Delete + Rect
+static inline void PrintFuelBarStats(const FuelBar *bars, int count, double seconds)
+{
+    long updates = 0, calls = 0, legacy_calls = 0;
+    for (int i = 0; i < count; i++)
+    {
+        updates += bars[i].Updates();
+        calls += bars[i].Calls();
+        legacy_calls += bars[i].LegacyCalls();
+    }
+    if (seconds <= 0)
+        seconds = 1;
+    printf("Fuel bars: %ld updates, %ld graphics calls (%.1f/s), Delete+Rect would need %ld (%.1f/s)\n",
+           updates, calls, calls / seconds, legacy_calls, legacy_calls / seconds);
+}
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef FUEL_BUCKETS_H_INCLUDED
+#define FUEL_BUCKETS_H_INCLUDED
+
+#include <pthread.h>
+#include <stdint.h>
+#include <atomic>
+
+// Хранилище, разложенное по маркам: для каждой марки 1..10 своя "корзина" и бит
+// в маске занятости (бит m установлен, если есть топливо марки m).
+// Поиск нужной марки - одна операция над маской: младший установленный бит не ниже x
+// (__builtin_ctz) или старший установленный бит (__builtin_clz). Стоимость запроса
+// не зависит от того, сколько единиц лежит в хранилище.
+//
+// Единицы одной марки неразличимы (единица топлива - это только ее марка), поэтому
+// корзина - счетчик, а не очередь значений.
+
+const int FUEL_MIN_MARK = 1;
+const int FUEL_MAX_MARK = 10;
+
+class FuelBuckets
+{
+public:
+    FuelBuckets() : capacity(0), mask(0)
+    {
+        for (int i = 0; i <= FUEL_MAX_MARK; i++)
+        {
+            counts[i] = 0;
+        }
+        total.store(0);
+        pthread_mutex_init(&mutex, NULL);
+    }
+
+    ~FuelBuckets()
+    {
+        pthread_mutex_destroy(&mutex);
+    }
+
+    void Init(int max_units)
+    {
+        capacity = max_units;
+    }
+
+    // Добавление единицы. Возвращает false, если хранилище заполнено или марка неверна
+    bool Push(int mark)
+    {
+        if (mark < FUEL_MIN_MARK || mark > FUEL_MAX_MARK)
+            return false;
+        pthread_mutex_lock(&mutex);
+        bool pushed = total.load(std::memory_order_relaxed) < capacity;
+        if (pushed)
+        {
+            counts[mark]++;
+            mask |= 1u << mark;
+            total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        pthread_mutex_unlock(&mutex);
+        return pushed;
+    }
+
+    // Любая единица: берется самая низкая марка, чтобы высокие оставались
+    // для тех, кто просит их явно. Возвращает марку или -1
+    int Pop()
+    {
+        return PopMin(FUEL_MIN_MARK);
+    }
+
+    // Самая низкая марка не ниже min_mark ("POP mark >= X")
+    int PopMin(int min_mark)
+    {
+        if (min_mark < FUEL_MIN_MARK)
+            min_mark = FUEL_MIN_MARK;
+        if (min_mark > FUEL_MAX_MARK)
+            return -1;
+        pthread_mutex_lock(&mutex);
+        uint32_t candidates = mask & ~((1u << min_mark) - 1);
+        int mark = candidates != 0 ? __builtin_ctz(candidates) : -1;
+        Take(mark);
+        pthread_mutex_unlock(&mutex);
+        return mark;
+    }
+
+    // Самая высокая из имеющихся марок
+    int PopMax()
+    {
+        pthread_mutex_lock(&mutex);
+        int mark = mask != 0 ? 31 - __builtin_clz(mask) : -1;
+        Take(mark);
+        pthread_mutex_unlock(&mutex);
+        return mark;
+    }
+
+    // Единица ровно марки mark
+    int PopExact(int mark)
+    {
+        if (mark < FUEL_MIN_MARK || mark > FUEL_MAX_MARK)
+            return -1;
+        pthread_mutex_lock(&mutex);
+        if ((mask & (1u << mark)) == 0)
+            mark = -1;
+        Take(mark);
+        pthread_mutex_unlock(&mutex);
+        return mark;
+    }
+
+    // Размер без захвата мьютекса
+    int Size() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Снятие единицы из корзины mark (под мьютексом); mark < 0 - ничего не найдено
+    void Take(int mark)
+    {
+        if (mark < 0)
+            return;
+        if (--counts[mark] == 0)
+            mask &= ~(1u << mark);
+        total.store(total.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    pthread_mutex_t mutex;
+    int capacity;
+    int counts[FUEL_MAX_MARK + 1];
+    uint32_t mask;
+    std::atomic<int> total; // Пишется под мьютексом, читается без него
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef FUEL_RING_H_INCLUDED
+#define FUEL_RING_H_INCLUDED
+
+#include <stddef.h>
+#include <atomic>
+
+// Размер строки кэша: счетчики, которые меняют разные потоки,
+// размещаются в разных строках, чтобы не было ложного разделения
+#define CACHE_LINE 64
+
+// Ограниченная кольцевая очередь без блокировок для многих производителей
+// и многих потребителей (схема Д. Вьюкова). У каждой ячейки есть номер
+// последовательности: по нему поток понимает, свободна ли ячейка для записи
+// на текущем круге или уже содержит значение для чтения.
+// N - емкость очереди, обязательно степень двойки.
+template <size_t N>
+class FuelRing
+{
+public:
+    FuelRing()
+    {
+        for (size_t i = 0; i < N; i++)
+        {
+            slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+    }
+
+    // Добавление значения. Возвращает false, если очередь заполнена или в ней уже
+    // limit значений. Предел проверяется перед захватом позиции, тем же CAS, поэтому
+    // несколько производителей вместе не превысят его: head только растет, и занятость
+    // на момент CAS не больше прочитанной
+    bool Push(int value, size_t limit = N)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            size_t h = head.load(std::memory_order_acquire);
+            if (pos >= h && pos - h >= limit)
+                return false;
+            Slot &slot = slots[pos & (N - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                // Ячейка свободна на этом круге - пробуем занять позицию
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    slot.value = value;
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Потребители еще не освободили ячейку - очередь полна
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Извлечение значения. Возвращает false, если очередь пуста
+    bool Pop(int *value)
+    {
+        size_t pos = head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot &slot = slots[pos & (N - 1)];
+            size_t seq = slot.seq.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    *value = slot.value;
+                    // Освобождаем ячейку для производителя следующего круга
+                    slot.seq.store(pos + N, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false; // Производитель еще не записал значение - очередь пуста
+            }
+            else
+            {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Приблизительный размер очереди (точен, когда нет одновременных операций)
+    size_t Size() const
+    {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return t > h ? t - h : 0;
+    }
+
+    bool Empty() const
+    {
+        return Size() == 0;
+    }
+
+    static size_t Capacity()
+    {
+        return N;
+    }
+
+private:
+    struct Slot
+    {
+        std::atomic<size_t> seq;
+        int value;
+    };
+
+    // Емкость должна быть степенью двойки, чтобы позиция в кольце считалась маской
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "FuelRing size must be a power of two");
+
+    alignas(CACHE_LINE) Slot slots[N];
+    alignas(CACHE_LINE) std::atomic<size_t> head; // Позиция следующего извлечения
+    alignas(CACHE_LINE) std::atomic<size_t> tail; // Позиция следующей вставки
+    char pad[CACHE_LINE - sizeof(std::atomic<size_t>)];
+};
+
+#endif
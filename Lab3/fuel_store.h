@@ -0,0 +1,86 @@
+#ifndef FUEL_STORE_H_INCLUDED
+#define FUEL_STORE_H_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+#include "fuel_ring.h"
+#include "fuel_buckets.h"
+
+// Порядок выдачи топлива со склада симулятора
+enum DispensePolicy
+{
+    DISPENSE_FIFO,    // В порядке производства (кольцо без блокировок)
+    DISPENSE_PRIORITY // Сначала самая высокая марка (корзины по маркам)
+};
+
+// Склад симулятора: тот же Push/Pop/Size, что у FuelRing, но порядок выдачи выбирается.
+// Котел горит столько, какова марка привезенной единицы, поэтому при DISPENSE_PRIORITY
+// каждый рейс грузовика дает котлу больше времени горения.
+// Единицы одной марки неразличимы, так что корзины выдают самую высокую марку за O(1)
+// (старший бит маски занятости) без кучи.
+// Политика задается до запуска потоков и дальше не меняется.
+template <size_t N>
+class FuelStore
+{
+public:
+    FuelStore() : policy(DISPENSE_FIFO)
+    {
+        buckets.Init(N);
+    }
+
+    void SetPolicy(DispensePolicy value)
+    {
+        policy = value;
+    }
+
+    DispensePolicy Policy() const
+    {
+        return policy;
+    }
+
+    bool Push(int value)
+    {
+        if (policy == DISPENSE_PRIORITY)
+            return buckets.Push(value);
+        return ring.Push(value);
+    }
+
+    bool Pop(int *value)
+    {
+        if (policy == DISPENSE_PRIORITY)
+        {
+            int mark = buckets.PopMax();
+            if (mark < 0)
+                return false;
+            *value = mark;
+            return true;
+        }
+        return ring.Pop(value);
+    }
+
+    size_t Size() const
+    {
+        if (policy == DISPENSE_PRIORITY)
+            return buckets.Size();
+        return ring.Size();
+    }
+
+private:
+    DispensePolicy policy;
+    FuelRing<N> ring;
+    FuelBuckets buckets;
+};
+
+// Разбор имени политики ("fifo" или "priority"). false, если имя неизвестно
+static inline bool ParseDispensePolicy(const char *name, DispensePolicy *policy)
+{
+    if (strcmp(name, "fifo") == 0)
+        *policy = DISPENSE_FIFO;
+    else if (strcmp(name, "priority") == 0)
+        *policy = DISPENSE_PRIORITY;
+    else
+        return false;
+    return true;
+}
+
+#endif
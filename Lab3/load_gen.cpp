@@ -0,0 +1,472 @@
+// Генератор нагрузки для протокола хранилища (storage_server.cpp).
+// Открывает N соединений и отправляет смесь команд POP и SIZE в одном из режимов:
+//  - замкнутый цикл (по умолчанию): каждое соединение отправляет следующий запрос сразу
+//    после ответа на предыдущий - максимальная пропускная способность;
+//  - открытый цикл (-r): запросы отправляются с заданной суммарной частотой по расписанию,
+//    не дожидаясь ответов (конвейером). Задержка отсчитывается от запланированного момента
+//    отправки, а не от фактического, поэтому задержка самого генератора и очередь на сервере
+//    не прячутся из статистики (поправка на coordinated omission).
+// Соединения делятся между потоками, у каждого потока свой цикл epoll и своя гистограмма
+// (storage_stats.h); в конце гистограммы складываются.
+// Только Linux (epoll).
+//
+// Сборка: g++ -std=c++11 -O2 -pthread -o load_gen load_gen.cpp
+// Запуск: ./load_gen [-H адрес] [-p порт] [-c соединений] [-t потоков] [-d секунд]
+//                    [-r запросов_в_секунду] [-P процент_POP]
+#include <unistd.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "storage_stats.h"
+
+// Параметры запуска
+const char *host = "127.0.0.1";
+int port = 8080;
+int connection_count = 8;
+int thread_count = 1;
+int duration_sec = 10;
+double rate = 0;     // Суммарная частота запросов; 0 - замкнутый цикл
+int pop_percent = 50; // Доля POP в смеси, остальное - SIZE
+
+// Время на получение ответов на запросы, отправленные до окончания прогона
+const uint64_t DRAIN_NS = 1000000000ULL;
+
+// Состояние одного соединения
+struct LoadConnection
+{
+    int fd;
+    char in[4096];
+    size_t in_len;
+    std::string out;           // Еще не отправленные байты
+    std::deque<uint64_t> sent; // Моменты отправки запросов, ожидающих ответа (по порядку)
+    uint64_t next_send;        // Запланированный момент следующего запроса (открытый цикл)
+    bool writable;             // Нет недописанных данных, EPOLLOUT не нужен
+};
+
+// Поток генератора и его результаты
+struct Worker
+{
+    pthread_t thread;
+    int first;  // Номер первого соединения потока
+    int count;  // Число соединений потока
+    unsigned seed;
+    LatencyHistogram latency;
+    long completed;
+    long in_run;     // Ответы, полученные до конца прогона (end_ns) - для пропускной способности
+    long empty;      // POP, вернувшие -1
+    long errors;     // Ответы ERR
+    long unanswered; // Запросы без ответа к концу прогона
+    bool failed;
+};
+
+uint64_t start_ns = 0;
+uint64_t end_ns = 0;
+
+// Адреса сервера. Ищутся один раз в main() до запуска потоков, потоки их только читают
+struct ServerAddress
+{
+    struct sockaddr_storage storage;
+    socklen_t length;
+};
+std::vector<ServerAddress> server_addresses;
+
+// Поиск адресов host:port через getaddrinfo (IPv4 и IPv6). false, если адрес не найден
+static bool ResolveServer()
+{
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+    struct addrinfo *found = NULL;
+    int error = getaddrinfo(host, service, &hints, &found);
+    if (error != 0)
+    {
+        fprintf(stderr, "Unknown host %s: %s\n", host, gai_strerror(error));
+        return false;
+    }
+    for (struct addrinfo *ai = found; ai != NULL; ai = ai->ai_next)
+    {
+        ServerAddress address;
+        memset(&address, 0, sizeof(address));
+        memcpy(&address.storage, ai->ai_addr, ai->ai_addrlen);
+        address.length = ai->ai_addrlen;
+        server_addresses.push_back(address);
+    }
+    freeaddrinfo(found);
+    return !server_addresses.empty();
+}
+
+// Соединение с сервером: адреса перебираются по очереди. Возвращает дескриптор или -1
+static int Connect()
+{
+    int fd = -1;
+    for (size_t i = 0; i < server_addresses.size() && fd < 0; i++)
+    {
+        const ServerAddress &address = server_addresses[i];
+        fd = socket(address.storage.ss_family, SOCK_STREAM, 0);
+        if (fd < 0)
+            continue;
+        if (connect(fd, (const struct sockaddr *)&address.storage, address.length) < 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd < 0)
+    {
+        perror("connect");
+        return -1;
+    }
+
+    // Запросы короткие: без алгоритма Нейгла они уходят сразу
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    return fd;
+}
+
+// Отправка накопленных запросов; при заполненном буфере сокета ждем EPOLLOUT
+static bool Flush(int epfd, LoadConnection *conn)
+{
+    while (!conn->out.empty())
+    {
+        ssize_t n = write(conn->fd, conn->out.data(), conn->out.size());
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return false;
+            if (conn->writable)
+            {
+                struct epoll_event ev;
+                ev.events = EPOLLIN | EPOLLOUT;
+                ev.data.ptr = conn;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+                conn->writable = false;
+            }
+            return true;
+        }
+        conn->out.erase(0, n);
+    }
+
+    if (!conn->writable)
+    {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->writable = true;
+    }
+    return true;
+}
+
+// Постановка запроса в очередь на отправку; when - момент, от которого считается задержка
+static void QueueRequest(Worker *worker, LoadConnection *conn, uint64_t when)
+{
+    if ((int)(rand_r(&worker->seed) % 100) < pop_percent)
+        conn->out += "POP\n";
+    else
+        conn->out += "SIZE\n";
+    conn->sent.push_back(when);
+}
+
+// Разбор полученных ответов. Возвращает false при ошибке сокета или закрытии сервером
+static bool ReadResponses(Worker *worker, int epfd, LoadConnection *conn, bool sending)
+{
+    while (true)
+    {
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+        if (n == 0)
+            return false;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn->in_len += n;
+
+        uint64_t now = NowNs();
+        size_t pos = 0;
+        char *eol;
+        while ((eol = (char *)memchr(conn->in + pos, '\n', conn->in_len - pos)) != NULL)
+        {
+            const char *line = conn->in + pos;
+            if (!conn->sent.empty())
+            {
+                worker->latency.Record(now - conn->sent.front());
+                conn->sent.pop_front();
+            }
+            worker->completed++;
+            if (now < end_ns)
+                worker->in_run++;
+            if (strncmp(line, "-1", 2) == 0)
+                worker->empty++;
+            else if (strncmp(line, "ERR", 3) == 0)
+                worker->errors++;
+
+            // Замкнутый цикл: следующий запрос сразу после ответа
+            if (rate <= 0 && sending)
+                QueueRequest(worker, conn, now);
+            pos = eol - conn->in + 1;
+        }
+        memmove(conn->in, conn->in + pos, conn->in_len - pos);
+        conn->in_len -= pos;
+
+        if (!Flush(epfd, conn))
+            return false;
+    }
+}
+
+void *WorkerThread(void *arg)
+{
+    Worker *worker = (Worker *)arg;
+    int epfd = epoll_create1(0);
+    LoadConnection *conns = new LoadConnection[worker->count];
+
+    // Интервал между запросами одного соединения в открытом цикле
+    uint64_t interval = rate > 0 ? (uint64_t)(1e9 * connection_count / rate) : 0;
+
+    for (int i = 0; i < worker->count; i++)
+    {
+        LoadConnection *conn = &conns[i];
+        conn->fd = Connect();
+        if (conn->fd < 0)
+        {
+            worker->failed = true;
+            worker->count = i;
+            break;
+        }
+        conn->in_len = 0;
+        conn->writable = true;
+        // Расписания соединений сдвинуты друг относительно друга, чтобы запросы не шли пачками
+        conn->next_send = start_ns + interval * (worker->first + i) / connection_count;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conn->fd, &ev);
+    }
+
+    // Все потоки начинают одновременно, после установки соединений
+    struct timespec start_time;
+    start_time.tv_sec = start_ns / 1000000000ULL;
+    start_time.tv_nsec = start_ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &start_time, NULL) == EINTR)
+    {
+    }
+
+    if (rate <= 0)
+    {
+        for (int i = 0; i < worker->count; i++)
+        {
+            QueueRequest(worker, &conns[i], NowNs());
+            Flush(epfd, &conns[i]);
+        }
+    }
+
+    struct epoll_event events[64];
+    uint64_t now = NowNs();
+    while (now < end_ns + DRAIN_NS)
+    {
+        bool sending = now < end_ns;
+        int timeout = 100;
+
+        // Открытый цикл: отправляем все запросы, чье время подошло, независимо от ответов
+        if (rate > 0 && sending)
+        {
+            uint64_t earliest = end_ns;
+            for (int i = 0; i < worker->count; i++)
+            {
+                LoadConnection *conn = &conns[i];
+                while (conn->next_send <= now && conn->next_send < end_ns)
+                {
+                    QueueRequest(worker, conn, conn->next_send);
+                    conn->next_send += interval;
+                }
+                Flush(epfd, conn);
+                if (conn->next_send < earliest)
+                    earliest = conn->next_send;
+            }
+            timeout = earliest > now ? (int)((earliest - now + 999999) / 1000000) : 0;
+        }
+
+        int n = epoll_wait(epfd, events, 64, timeout);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            LoadConnection *conn = (LoadConnection *)events[i].data.ptr;
+            bool alive = ReadResponses(worker, epfd, conn, sending);
+            if (alive && (events[i].events & EPOLLOUT))
+                alive = Flush(epfd, conn);
+            if (!alive)
+            {
+                fprintf(stderr, "Connection closed by server\n");
+                worker->failed = true;
+                epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+            }
+        }
+
+        // Все ответы получены - ждать до конца отведенного времени незачем
+        now = NowNs();
+        if (now >= end_ns)
+        {
+            bool pending = false;
+            for (int i = 0; i < worker->count && !pending; i++)
+            {
+                pending = !conns[i].sent.empty();
+            }
+            if (!pending)
+                break;
+        }
+    }
+
+    // Запросы без ответа учитываются с задержкой не меньше прошедшего времени
+    now = NowNs();
+    for (int i = 0; i < worker->count; i++)
+    {
+        while (!conns[i].sent.empty())
+        {
+            worker->latency.Record(now - conns[i].sent.front());
+            conns[i].sent.pop_front();
+            worker->unanswered++;
+        }
+        close(conns[i].fd);
+    }
+    delete[] conns;
+    close(epfd);
+    return NULL;
+}
+
+static void PrintUsage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-H host] [-p port] [-c connections] [-t threads] [-d seconds] [-r rate] [-P pop%%]\n", prog);
+    fprintf(stderr, "  -H  адрес сервера хранилища (по умолчанию 127.0.0.1)\n");
+    fprintf(stderr, "  -p  порт (по умолчанию 8080)\n");
+    fprintf(stderr, "  -c  число соединений (по умолчанию 8)\n");
+    fprintf(stderr, "  -t  число потоков генератора (по умолчанию 1)\n");
+    fprintf(stderr, "  -d  длительность прогона, с (по умолчанию 10)\n");
+    fprintf(stderr, "  -r  суммарная частота запросов в секунду - открытый цикл;\n");
+    fprintf(stderr, "      без ключа - замкнутый цикл на максимальной скорости\n");
+    fprintf(stderr, "  -P  доля POP в процентах, остальное - SIZE (по умолчанию 50)\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "H:p:c:t:d:r:P:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            host = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            connection_count = atoi(optarg);
+            break;
+        case 't':
+            thread_count = atoi(optarg);
+            break;
+        case 'd':
+            duration_sec = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'P':
+            pop_percent = atoi(optarg);
+            break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (connection_count < 1)
+        connection_count = 1;
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > connection_count)
+        thread_count = connection_count;
+    if (duration_sec < 1)
+        duration_sec = 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!ResolveServer())
+        return 1;
+
+    if (rate > 0)
+        printf("open loop: %.0f req/s", rate);
+    else
+        printf("closed loop");
+    printf(", %d connections, %d threads, %d s, POP %d%% / SIZE %d%%\n",
+           connection_count, thread_count, duration_sec, pop_percent, 100 - pop_percent);
+
+    // Соединения распределяются по потокам поровну
+    Worker *workers = new Worker[thread_count];
+    start_ns = NowNs() + 500000000ULL; // Запас на установку соединений
+    end_ns = start_ns + duration_sec * 1000000000ULL;
+    int first = 0;
+    for (int i = 0; i < thread_count; i++)
+    {
+        Worker *worker = &workers[i];
+        worker->first = first;
+        worker->count = connection_count / thread_count + (i < connection_count % thread_count ? 1 : 0);
+        worker->seed = time(NULL) + i;
+        worker->completed = 0;
+        worker->in_run = 0;
+        worker->empty = 0;
+        worker->errors = 0;
+        worker->unanswered = 0;
+        worker->failed = false;
+        first += worker->count;
+        pthread_create(&worker->thread, NULL, WorkerThread, worker);
+    }
+
+    LatencyHistogram latency;
+    long completed = 0, in_run = 0, empty = 0, errors = 0, unanswered = 0;
+    bool failed = false;
+    for (int i = 0; i < thread_count; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        latency.Merge(workers[i].latency);
+        completed += workers[i].completed;
+        in_run += workers[i].in_run;
+        empty += workers[i].empty;
+        errors += workers[i].errors;
+        unanswered += workers[i].unanswered;
+        failed = failed || workers[i].failed;
+    }
+    delete[] workers;
+
+    printf("requests: %ld completed, %ld unanswered, %ld empty POP, %ld errors\n",
+           completed, unanswered, empty, errors);
+    // Ответы, полученные при дочитывании после end_ns, в пропускную способность не входят
+    printf("throughput: %.0f req/s\n", in_run / (double)duration_sec);
+    printf("latency, us: p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           latency.Percentile(0.5) / 1000.0, latency.Percentile(0.99) / 1000.0,
+           latency.Percentile(0.999) / 1000.0, latency.Max() / 1000.0);
+    return failed ? 1 : 0;
+}
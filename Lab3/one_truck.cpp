@@ -4,8 +4,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <queue>
 #include <termios.h>
+#include "fuel_store.h"
+#include "sim_events.h"
+#include "fuel_bar.h"
+#include "text_overlay.h"
+#include "scene_snapshot.h"
 
 // Состояния элементов
 enum VehicleState
@@ -25,8 +29,18 @@ enum BoilerState
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 volatile int run_flag = 1;
 
+// Тексты событий sim_events.h; грузовик один, поэтому без номера
+const char *event_formats[EV_COUNT] = {
+    "Generated fuel: %d, Storage size: %d",
+    NULL,
+    "Truck loaded fuel mark %d, target boiler %d",
+    "Truck found storage empty",
+    "Truck delivered fuel mark %d to boiler %d",
+    "Boiler %d is out of fuel",
+};
+
 // Общие данные
-std::queue<int> fuel_storage;
+FuelStore<32> fuel_storage; // Не требует mutex; порядок выдачи задается ключом -s
 VehicleState vehicle_state = MOVING_TO_STORAGE;
 BoilerState boiler_states[4] = {WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL};
 int vehicle_fuel = 0;
@@ -37,6 +51,20 @@ int boiler_fuel_marks[4] = {0, 0, 0, 0};
 // Позиции для анимации
 int vehicle_x = 100, vehicle_y = 235;
 
+// Копия общих данных для потока отрисовки
+struct Scene
+{
+    int vehicle_x, vehicle_y;
+    VehicleState vehicle_state;
+    int vehicle_fuel;
+    int vehicle_target_boiler;
+    BoilerState boiler_states[4];
+    int boiler_fuel_level[4];
+    int boiler_fuel_marks[4];
+};
+SceneSnapshot<Scene> scene_snapshot; // Последний опубликованный снимок
+const int RENDER_PERIOD_MS = 50;     // Период кадра потока отрисовки
+
 // Размеры объектов (высота:ширина = 2:1)
 const int STORAGE_W = 80, STORAGE_H = 160;
 const int VEHICLE_W = 80, VEHICLE_H = 40;
@@ -58,7 +86,12 @@ const int STORAGE_STOP_Y = 235;
 const int BOILER_STOP_Y = 235;
 
 // Идентификаторы графических элементов
-int storage_id, vehicle_id, boiler_ids[4], text_ids[10], fuel_bar_ids[4];
+int storage_id, vehicle_id, boiler_ids[4];
+TextOverlay text_overlay; // Надписи окна
+
+// Слоты надписей: 0..9 - строки вверху окна, дальше - подписи объектов
+const int LABEL_STORAGE = 16, LABEL_VEHICLE = 17, LABEL_BOILER = 20;
+FuelBar fuel_bars[4]; // Индикаторы топлива котлов
 
 // Функция для неблокирующего ввода
 static void set_raw_mode(int enable)
@@ -78,6 +111,22 @@ static void set_raw_mode(int enable)
     }
 }
 
+// Публикация снимка для потока отрисовки. Вызывается под mutex после изменения общих данных
+void PublishScene()
+{
+    Scene scene;
+    memset(&scene, 0, sizeof(scene));
+    scene.vehicle_x = vehicle_x;
+    scene.vehicle_y = vehicle_y;
+    scene.vehicle_state = vehicle_state;
+    scene.vehicle_fuel = vehicle_fuel;
+    scene.vehicle_target_boiler = vehicle_target_boiler;
+    memcpy(scene.boiler_states, boiler_states, sizeof(boiler_states));
+    memcpy(scene.boiler_fuel_level, boiler_fuel_level, sizeof(boiler_fuel_level));
+    memcpy(scene.boiler_fuel_marks, boiler_fuel_marks, sizeof(boiler_fuel_marks));
+    scene_snapshot.Publish(scene);
+}
+
 // Функция для плавного перемещения грузовика к целевой позиции
 void MoveVehicleTo(int target_x, int target_y)
 {
@@ -91,18 +140,25 @@ void MoveVehicleTo(int target_x, int target_y)
         int new_x = start_x + (target_x - start_x) * progress;
         int new_y = start_y + (target_y - start_y) * progress;
 
-        MoveTo(new_x, new_y, vehicle_id);
+        pthread_mutex_lock(&mutex);
+        vehicle_x = new_x;
+        vehicle_y = new_y;
+        PublishScene();
+        pthread_mutex_unlock(&mutex);
         usleep(50000);
     }
 
+    pthread_mutex_lock(&mutex);
     vehicle_x = target_x;
     vehicle_y = target_y;
+    PublishScene();
+    pthread_mutex_unlock(&mutex);
 }
 
 // Функция для обновления цвета грузовика в зависимости от загрузки
-void UpdateVehicleColor()
+void UpdateVehicleColor(const Scene &scene)
 {
-    if (vehicle_fuel > 0)
+    if (scene.vehicle_fuel > 0)
     {
         // Загруженный грузовик - зеленый
         SetColor(vehicle_id, RGB(0, 200, 0));
@@ -115,99 +171,89 @@ void UpdateVehicleColor()
 }
 
 // Функция для обновления индикатора топлива в котле
-void UpdateBoilerFuelIndicator(int boiler_id)
+void UpdateBoilerFuelIndicator(const Scene &scene, int boiler_id)
 {
-    // Удаляем старый индикатор
-    if (fuel_bar_ids[boiler_id] != 0)
-    {
-        Delete(fuel_bar_ids[boiler_id]);
-        fuel_bar_ids[boiler_id] = 0;
-    }
-
-    // Создаем новый индикатор, если есть топливо
-    if (boiler_fuel_level[boiler_id] > 0)
+    // Показываем индикатор, если есть топливо
+    if (scene.boiler_fuel_level[boiler_id] > 0)
     {
         int max_fuel_height = BOILER_H - 20; // Оставляем отступы
-        int fuel_height = (boiler_fuel_level[boiler_id] * max_fuel_height) / 20;
+        int fuel_height = (scene.boiler_fuel_level[boiler_id] * max_fuel_height) / 20;
         int fuel_y = BOILER_Y + BOILER_H - fuel_height - 10; // Отступ снизу
 
-        fuel_bar_ids[boiler_id] = Rect(
-            BOILER_X[boiler_id] + 10,
-            fuel_y,
-            BOILER_W - 20,
-            fuel_height,
-            0,
-            boiler_states[boiler_id] == BURNING ? RGB(255, 165, 0) : RGB(0, 200, 0));
+        int color = scene.boiler_states[boiler_id] == BURNING ? RGB(255, 165, 0) : RGB(0, 200, 0);
+        fuel_bars[boiler_id].Update(BOILER_X[boiler_id] + 10, fuel_y, BOILER_W - 20, fuel_height, color);
+    }
+    else
+    {
+        fuel_bars[boiler_id].Hide();
     }
 }
 
 // Функция для обновления текстовой информации
-void UpdateTextInfo()
+void UpdateTextInfo(const Scene &scene)
 {
-    // Очистка предыдущих текстовых элементов
-    for (int i = 0; i < 10; i++)
-    {
-        if (text_ids[i] != 0)
-        {
-            Delete(text_ids[i]);
-            text_ids[i] = 0;
-        }
-    }
-
     // Вывод общей информации В ВЕРХУ ОКНА
     int y_offset = 10;
 
     char vehicle_fuel_text[50];
-    sprintf(vehicle_fuel_text, "Vehicle Fuel: %d", vehicle_fuel);
-    text_ids[0] = Text(10, y_offset, vehicle_fuel_text, RGB(255, 255, 255));
+    sprintf(vehicle_fuel_text, "Vehicle Fuel: %d", scene.vehicle_fuel);
+    text_overlay.Put(0, 10, y_offset, vehicle_fuel_text, RGB(255, 255, 255));
 
     char target_boiler_text[50];
-    if (vehicle_target_boiler != -1)
+    if (scene.vehicle_target_boiler != -1)
     {
-        sprintf(target_boiler_text, "Target Boiler: %d", vehicle_target_boiler + 1);
+        sprintf(target_boiler_text, "Target Boiler: %d", scene.vehicle_target_boiler + 1);
     }
     else
     {
         sprintf(target_boiler_text, "Target Boiler: None");
     }
-    text_ids[1] = Text(10, y_offset + 20, target_boiler_text, RGB(255, 255, 255));
+    text_overlay.Put(1, 10, y_offset + 20, target_boiler_text, RGB(255, 255, 255));
 
     char storage_count_text[50];
-    sprintf(storage_count_text, "Storage: %d units", (int)fuel_storage.size());
-    text_ids[2] = Text(10, y_offset + 40, storage_count_text, RGB(255, 255, 255));
+    sprintf(storage_count_text, "Storage: %d units", (int)fuel_storage.Size());
+    text_overlay.Put(2, 10, y_offset + 40, storage_count_text, RGB(255, 255, 255));
 
     char vehicle_state_text[50];
     sprintf(vehicle_state_text, "Vehicle State: %s",
-            vehicle_state == MOVING_TO_STORAGE ? "To Storage" : vehicle_state == LOADING        ? "Loading"
-                                                            : vehicle_state == MOVING_TO_BOILER ? "To Boiler"
-                                                                                                : "Unloading");
-    text_ids[3] = Text(200, y_offset, vehicle_state_text, RGB(255, 255, 255));
+            scene.vehicle_state == MOVING_TO_STORAGE ? "To Storage" : scene.vehicle_state == LOADING        ? "Loading"
+                                                                  : scene.vehicle_state == MOVING_TO_BOILER ? "To Boiler"
+                                                                                                            : "Unloading");
+    text_overlay.Put(3, 200, y_offset, vehicle_state_text, RGB(255, 255, 255));
 
     for (int i = 0; i < 4; i++)
     {
         char boiler_mark_text[50];
-        sprintf(boiler_mark_text, "Boiler %d Mark: %d", i + 1, boiler_fuel_marks[i]);
-        text_ids[4 + i] = Text(200, y_offset + 20 + i * 20, boiler_mark_text, RGB(255, 255, 255));
+        sprintf(boiler_mark_text, "Boiler %d Mark: %d", i + 1, scene.boiler_fuel_marks[i]);
+        text_overlay.Put(4 + i, 200, y_offset + 20 + i * 20, boiler_mark_text, RGB(255, 255, 255));
     }
 }
 
-// Функция для отрисовки состояния
-void DrawState()
+// Функция для отрисовки состояния. previous - снимок прошлого кадра (NULL в первом кадре):
+// перемещение, цвет грузовика и индикаторы топлива меняются только при отличиях
+void DrawState(const Scene &scene, const Scene *previous)
 {
-    pthread_mutex_lock(&mutex);
+    // Перемещение грузовика
+    if (previous == NULL || scene.vehicle_x != previous->vehicle_x || scene.vehicle_y != previous->vehicle_y)
+    {
+        MoveTo(scene.vehicle_x, scene.vehicle_y, vehicle_id);
+    }
 
     // Обновление цвета грузовика
-    UpdateVehicleColor();
+    if (previous == NULL || (scene.vehicle_fuel > 0) != (previous->vehicle_fuel > 0))
+    {
+        UpdateVehicleColor(scene);
+        SetColor(vehicle_id, RGB(255, 255, 255));
+    }
 
     // Обновление хранилища
     char storage_text[50];
-    sprintf(storage_text, "Storage: %d units", (int)fuel_storage.size());
-    SetText(storage_id, storage_text);
-    SetColor(storage_id, RGB(255, 255, 255));
+    sprintf(storage_text, "Storage: %d units", (int)fuel_storage.Size());
+    text_overlay.Label(LABEL_STORAGE, storage_id, storage_text, RGB(255, 255, 255));
 
     // Обновление состояния транспорта
     const char *vstate = "";
-    switch (vehicle_state)
+    switch (scene.vehicle_state)
     {
     case MOVING_TO_STORAGE:
         vstate = "To Storage";
@@ -222,33 +268,58 @@ void DrawState()
         vstate = "Unloading";
         break;
     }
-    SetText(vehicle_id, vstate);
-    SetColor(vehicle_id, RGB(255, 255, 255));
+    text_overlay.Label(LABEL_VEHICLE, vehicle_id, vstate, TEXT_OVERLAY_KEEP_COLOR);
 
     // Обновление котлов
     for (int i = 0; i < 4; i++)
     {
         char boiler_text[100];
-        const char *bstate = boiler_states[i] == BURNING ? "Burning" : "Waiting";
+        const char *bstate = scene.boiler_states[i] == BURNING ? "Burning" : "Waiting";
         sprintf(boiler_text, "Boiler %d: %s", i + 1, bstate);
-        SetText(boiler_ids[i], boiler_text);
-        SetColor(boiler_ids[i], RGB(255, 255, 255));
 
-        // Изменение цвета котла при горении
-        if (boiler_states[i] == BURNING)
-        {
-            SetColor(boiler_ids[i], RGB(255, 50, 50));
-        }
-        else
+        // Цвет котла зависит от горения
+        int color = scene.boiler_states[i] == BURNING ? RGB(255, 50, 50) : RGB(200, 100, 100);
+        text_overlay.Label(LABEL_BOILER + i, boiler_ids[i], boiler_text, color);
+
+        // Индикатор топлива
+        if (previous == NULL || scene.boiler_fuel_level[i] != previous->boiler_fuel_level[i] ||
+            scene.boiler_states[i] != previous->boiler_states[i])
         {
-            SetColor(boiler_ids[i], RGB(200, 100, 100));
+            UpdateBoilerFuelIndicator(scene, i);
         }
     }
 
     // Обновление текстовой информации
-    UpdateTextInfo();
+    UpdateTextInfo(scene);
+    text_overlay.EndFrame();
+}
 
-    pthread_mutex_unlock(&mutex);
+// Поток отрисовки: с постоянной частотой читает последний снимок и рисует изменения.
+// После запуска потоков графику вызывает только он, поэтому потоки симуляции не ждут
+// графический сервер, а отрисовка не занимает mutex
+void *RenderThread(void *arg)
+{
+    Scene previous, current;
+    bool first = true;
+    timespec next_frame;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+    while (run_flag)
+    {
+        scene_snapshot.Read(&current);
+        DrawState(current, first ? NULL : &previous);
+        previous = current;
+        first = false;
+
+        // Следующий кадр через RENDER_PERIOD_MS от начала текущего
+        next_frame.tv_nsec += RENDER_PERIOD_MS * 1000000L;
+        if (next_frame.tv_nsec >= 1000000000L)
+        {
+            next_frame.tv_sec++;
+            next_frame.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+    }
+    return NULL;
 }
 
 // Поток для хранилища
@@ -256,13 +327,14 @@ void *StorageThread(void *arg)
 {
     while (run_flag)
     {
-        pthread_mutex_lock(&mutex);
-        if (fuel_storage.size() < 20)
+        // Грузовик только забирает топливо, поэтому между проверкой и Push
+        // размер склада может лишь уменьшиться
+        if (fuel_storage.Size() < 20)
         {
             int mark = rand() % 10 + 1;
-            fuel_storage.push(mark);
+            fuel_storage.Push(mark);
+            LogEvent(LOG_LEVEL_DEBUG, EV_GENERATED, mark, (int)fuel_storage.Size());
         }
-        pthread_mutex_unlock(&mutex);
         usleep(1000000);
     }
     return NULL;
@@ -285,20 +357,20 @@ void *VehicleThread(void *arg)
             // Начинаем загрузку
             pthread_mutex_lock(&mutex);
             vehicle_state = LOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация загрузки
+            // Загрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
-            if (!fuel_storage.empty())
+            int mark;
+            if (fuel_storage.Pop(&mark))
             {
-                vehicle_fuel = fuel_storage.front();
-                fuel_storage.pop();
+                vehicle_fuel = mark;
 
                 // Выбор котла после загрузки топлива
                 vehicle_target_boiler = -1;
@@ -316,14 +388,16 @@ void *VehicleThread(void *arg)
                 }
 
                 vehicle_state = MOVING_TO_BOILER;
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler
-                UpdateTextInfo();
+                LogEvent(LOG_LEVEL_INFO, EV_LOADED, mark, vehicle_target_boiler + 1);
             }
             else
             {
                 vehicle_state = MOVING_TO_STORAGE;
+                LogEvent(LOG_LEVEL_WARN, EV_STORAGE_EMPTY);
             }
+
+            // Публикуем Vehicle Fuel и Target Boiler
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -340,13 +414,13 @@ void *VehicleThread(void *arg)
             // Начинаем разгрузку
             pthread_mutex_lock(&mutex);
             vehicle_state = UNLOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация разгрузки
+            // Разгрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
@@ -356,21 +430,15 @@ void *VehicleThread(void *arg)
                 boiler_states[vehicle_target_boiler] = BURNING;
                 boiler_fuel_level[vehicle_target_boiler] = vehicle_fuel * 2;
                 boiler_fuel_marks[vehicle_target_boiler] = vehicle_fuel;
-
-                // Обновляем индикатор топлива в котле
-                UpdateBoilerFuelIndicator(vehicle_target_boiler);
+                LogEvent(LOG_LEVEL_INFO, EV_DELIVERED, vehicle_fuel, vehicle_target_boiler + 1);
 
                 vehicle_fuel = 0;
                 vehicle_target_boiler = -1;
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler (обнуляем)
-                UpdateTextInfo();
             }
 
-            // Отрисовываем состояние ДО того, как грузовик начнет движение обратно
-            DrawState();
-
+            // Публикуем котел с новым топливом и пустой грузовик перед движением обратно
             vehicle_state = MOVING_TO_STORAGE;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -391,22 +459,16 @@ void *BoilerThread(void *arg)
             if (boiler_fuel_level[id] > 0)
             {
                 boiler_fuel_level[id]--;
-
-                // Обновляем индикатор уровня топлива
-                UpdateBoilerFuelIndicator(id);
             }
             else
             {
                 boiler_states[id] = WAITING_FOR_FUEL;
                 boiler_fuel_marks[id] = 0;
-
-                // Удаляем индикатор уровня топлива
-                if (fuel_bar_ids[id] != 0)
-                {
-                    Delete(fuel_bar_ids[id]);
-                    fuel_bar_ids[id] = 0;
-                }
+                LogEvent(LOG_LEVEL_INFO, EV_BOILER_EMPTY, id + 1);
             }
+
+            // Публикуем уровень топлива для индикатора
+            PublishScene();
         }
         pthread_mutex_unlock(&mutex);
 
@@ -415,27 +477,32 @@ void *BoilerThread(void *arg)
     return NULL;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Порядок выдачи со склада: fifo (по умолчанию) или priority - сначала высокие марки
+    DispensePolicy policy = DISPENSE_FIFO;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:h")) != -1)
+    {
+        if (opt != 's' || !ParseDispensePolicy(optarg, &policy))
+        {
+            fprintf(stderr, "Usage: %s [-s fifo|priority]\n", argv[0]);
+            return 1;
+        }
+    }
+    fuel_storage.SetPolicy(policy);
+
     ConnectGraph("Power Station Simulation");
 
     // Инициализация случайного генератора
     srand(time(NULL));
 
+    StartAsyncLog(event_formats, EV_COUNT, LOG_LEVEL_WARN, stdout);
+
     // Инициализация хранилища
     for (int i = 0; i < 10; i++)
     {
-        fuel_storage.push(rand() % 10 + 1);
-    }
-
-    // Инициализация ID
-    for (int i = 0; i < 10; i++)
-    {
-        text_ids[i] = 0;
-    }
-    for (int i = 0; i < 4; i++)
-    {
-        fuel_bar_ids[i] = 0;
+        fuel_storage.Push(rand() % 10 + 1);
     }
 
     // Создание графических элементов
@@ -456,6 +523,12 @@ int main()
         SetColor(boiler_ids[i], RGB(255, 255, 255));
     }
 
+    // Индикаторы топлива создаются скрытыми поверх котлов и дальше только меняются
+    for (int i = 0; i < 4; i++)
+    {
+        fuel_bars[i].Create(BOILER_X[i] + 10, BOILER_Y + 10, BOILER_W - 20, BOILER_H - 20, RGB(0, 200, 0));
+    }
+
     // Инструкция вверху окна
     Text(10, 120, "Power Station Simulation - Press 'q' to quit", RGB(255, 255, 255));
 
@@ -463,10 +536,15 @@ int main()
     Line(50, 285, 530, 285, RGB(255, 255, 255));
     Line(50, 290, 530, 290, RGB(255, 255, 255));
 
-    // Запуск потоков
-    pthread_t storage_thread, vehicle_thread, boiler_threads[4];
+    timespec started; // Для расчета графических вызовов в секунду
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Запуск потоков; первый снимок публикуется до них
+    PublishScene();
+    pthread_t storage_thread, vehicle_thread, boiler_threads[4], render_thread;
     int boiler_ids_arg[4] = {0, 1, 2, 3};
 
+    pthread_create(&render_thread, NULL, RenderThread, NULL);
     pthread_create(&storage_thread, NULL, StorageThread, NULL);
     pthread_create(&vehicle_thread, NULL, VehicleThread, NULL);
 
@@ -479,11 +557,10 @@ int main()
     set_raw_mode(1);
     printf("Power Station Simulation started. Press 'q' to quit\n");
 
-    // Главный цикл визуализации
+    // Главный цикл: отрисовкой занят RenderThread, здесь только ввод
     char c;
     while (run_flag)
     {
-        DrawState();
         usleep(50000);
 
         // Проверка ввода
@@ -509,7 +586,12 @@ int main()
     {
         pthread_join(boiler_threads[i], NULL);
     }
+    pthread_join(render_thread, NULL);
+
+    PrintFuelBarStats(fuel_bars, 4, SecondsSince(started));
+    text_overlay.PrintStats();
 
+    StopAsyncLog();
     CloseGraph();
     return 0;
 }
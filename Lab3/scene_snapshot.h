@@ -0,0 +1,79 @@
+#ifndef SCENE_SNAPSHOT_H_INCLUDED
+#define SCENE_SNAPSHOT_H_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+#include <atomic>
+
+// Снимок состояния симуляции для потока отрисовки (seqlock).
+// Потоки симуляции после каждого изменения публикуют копию состояния, поток отрисовки
+// читает последнюю копию и сам вызывает графику. Писатель никогда не ждет читателя:
+// запись - это счетчик версии и копирование слов. Читатель повторяет чтение, если во
+// время копирования версия изменилась (нечетная версия - запись идет прямо сейчас).
+// Слова копируются атомарными операциями, поэтому гонки данных нет даже при повторе.
+// Писатель должен быть один в каждый момент: симуляторы публикуют под своим mutex.
+// T - простая структура без указателей (копируется memcpy).
+template <class T>
+class SceneSnapshot
+{
+public:
+    SceneSnapshot()
+    {
+        sequence.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < WORDS; i++)
+        {
+            data[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Публикация нового состояния (вызывает один писатель)
+    void Publish(const T &value)
+    {
+        unsigned words[WORDS];
+        memset(words, 0, sizeof(words));
+        memcpy(words, &value, sizeof(T));
+
+        unsigned seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < WORDS; i++)
+        {
+            data[i].store(words[i], std::memory_order_relaxed);
+        }
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // Чтение последнего опубликованного состояния. Возвращает его версию
+    unsigned Read(T *value) const
+    {
+        unsigned words[WORDS];
+        while (true)
+        {
+            unsigned before = sequence.load(std::memory_order_acquire);
+            if (before & 1)
+            {
+                sched_yield();
+                continue;
+            }
+            for (size_t i = 0; i < WORDS; i++)
+            {
+                words[i] = data[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before)
+            {
+                memcpy(value, words, sizeof(T));
+                return before;
+            }
+        }
+    }
+
+private:
+    static const size_t WORDS = (sizeof(T) + sizeof(unsigned) - 1) / sizeof(unsigned);
+
+    std::atomic<unsigned> sequence;
+    std::atomic<unsigned> data[WORDS];
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef SIM_EVENTS_H_INCLUDED
+#define SIM_EVENTS_H_INCLUDED
+
+#include "async_log.h"
+
+// События журнала симуляторов (one_truck, two_trucks, boiler_server).
+// По умолчанию печатаются только предупреждения, подробный ход симуляции включается
+// переменной окружения FUEL_LOG_LEVEL=info. Номера событий общие, а таблицу форматов
+// каждая программа задает сама: аргументы различаются (номер грузовика, число единиц).
+// Событие, которого в программе нет, получает в таблице NULL
+enum SimEvent
+{
+    EV_GENERATED,     // Склад симулятора получил единицу: марка, размер склада
+    EV_RECEIVED,      // boiler_server получил ответ хранилища: выдано, запрошено
+    EV_LOADED,        // Грузовик загружен
+    EV_STORAGE_EMPTY, // Грузовик не получил топлива
+    EV_DELIVERED,     // Грузовик разгрузился у котла
+    EV_BOILER_EMPTY,  // Котел погас
+    EV_COUNT
+};
+
+#endif
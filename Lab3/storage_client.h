@@ -0,0 +1,805 @@
+#ifndef STORAGE_CLIENT_H_INCLUDED
+#define STORAGE_CLIENT_H_INCLUDED
+
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <ctype.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+
+// Клиент протокола хранилища (команда - строка, ответ - одна строка) для многих потоков.
+//
+// Пул соединений: поток берет свободное соединение на время обмена, так что обмены разных
+// потоков идут параллельно и ответы не перемешиваются. Соединения открываются по
+// требованию; подключение неблокирующее (connect с O_NONBLOCK и poll не дольше
+// connect_timeout_ms), адреса ищутся через getaddrinfo (IPv4 и IPv6) или задаются путем
+// сокета Unix.
+//
+// Оборванное соединение закрывается, а следующий обмен подключается заново. Если
+// подключиться не удалось, повторная попытка этого соединения откладывается на случайное
+// время от 0 до base * 2^(неудачи - 1), не больше max ("full jitter"): клиенты не
+// переподключаются к перезапущенному серверу все разом. Пока все свободные соединения
+// ждут повторной попытки, обмен сразу получает STORAGE_UNAVAILABLE.
+//
+// Пачка команд уходит конвейером: одной записью, ответы читаются по порядку. Пачка длиннее
+// batch_split команд делится на части не больше batch_split команд, по одной на уже
+// подключенное свободное соединение (если таких меньше, части выходят длиннее): сначала
+// отправляются все части, потом собираются ответы. Части выполняются сервером параллельно,
+// поэтому команды такой пачки не должны зависеть друг от друга.
+//
+// У каждого обмена свой срок (по умолчанию request_timeout_ms), для "POPWAIT ms" он
+// продлевается на ms. Команды, на которые ответ не пришел вовремя, остаются за соединением:
+// следующий обмен на нем сначала дочитывает опоздавшие ответы, а выданное по ним топливо
+// кладет в запас клиента. Запас раздается следующим POP, "POP n" и POPWAIT того же склада
+// без обращения к серверу, так что единица, которую сервер выдал уже после тайм-аута, не
+// теряется, а серверу не нужно верить клиенту, возвращающему топливо. Запас живет, пока
+// клиент открыт. Соединения с долгами берутся последними. Повтора после обрыва нет -
+// POP не идемпотентен, решение остается за вызывающим.
+// SUBSCRIBE и другие команды с потоком ответов через пул не работают, для них есть Dial().
+
+enum StorageStatus
+{
+    STORAGE_OK,
+    STORAGE_TIMEOUT,     // Ответ не пришел вовремя
+    STORAGE_UNAVAILABLE, // Нет соединения: сервер недоступен или идет пауза перед переподключением
+    STORAGE_FAILED       // Соединение оборвалось во время обмена
+};
+
+struct StorageClientOptions
+{
+    int connections;        // Размер пула
+    int connect_timeout_ms; // Срок подключения
+    int request_timeout_ms; // Срок обмена по умолчанию, включая ожидание свободного соединения
+    int backoff_base_ms;    // Пауза после первой неудачной попытки подключения (верхняя граница)
+    int backoff_max_ms;     // Наибольшая пауза
+    int batch_split;        // Наибольшая часть пачки на одно соединение
+
+    StorageClientOptions()
+        : connections(2), connect_timeout_ms(1000), request_timeout_ms(5000),
+          backoff_base_ms(50), backoff_max_ms(5000), batch_split(16)
+    {
+    }
+};
+
+class StorageClient
+{
+public:
+    StorageClient() : connects(0), connect_failures(0), drops(0), timeouts(0), late_units(0)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&released, &attr);
+        pthread_condattr_destroy(&attr);
+        seed = (unsigned)time(NULL) ^ ((unsigned)getpid() << 16) ^ (unsigned)(uintptr_t)this;
+    }
+
+    ~StorageClient()
+    {
+        Close();
+        pthread_cond_destroy(&released);
+        pthread_mutex_destroy(&mutex);
+    }
+
+    // Поиск адресов сервера. host, начинающийся с '/', - путь сокета Unix (port не нужен).
+    // Соединения не открываются; false, если адрес не найден
+    bool Open(const char *host, int port, const StorageClientOptions &value = StorageClientOptions())
+    {
+        Close();
+        options = value;
+        connects = connect_failures = drops = timeouts = late_units = 0;
+        if (options.connections < 1)
+            options.connections = 1;
+        if (options.batch_split < 1)
+            options.batch_split = 1;
+
+        if (host[0] == '/')
+        {
+            Address address;
+            memset(&address, 0, sizeof(address));
+            struct sockaddr_un *un = (struct sockaddr_un *)&address.storage;
+            un->sun_family = AF_UNIX;
+            strncpy(un->sun_path, host, sizeof(un->sun_path) - 1);
+            address.length = sizeof(struct sockaddr_un);
+            addresses.push_back(address);
+        }
+        else
+        {
+            struct addrinfo hints;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            char service[16];
+            snprintf(service, sizeof(service), "%d", port);
+            struct addrinfo *found = NULL;
+            int error = getaddrinfo(host, service, &hints, &found);
+            if (error != 0)
+            {
+                fprintf(stderr, "Storage client: %s: %s\n", host, gai_strerror(error));
+                return false;
+            }
+            for (struct addrinfo *ai = found; ai != NULL; ai = ai->ai_next)
+            {
+                Address address;
+                memset(&address, 0, sizeof(address));
+                memcpy(&address.storage, ai->ai_addr, ai->ai_addrlen);
+                address.length = ai->ai_addrlen;
+                addresses.push_back(address);
+            }
+            freeaddrinfo(found);
+        }
+
+        pool.resize(options.connections);
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            pool[i].fd = -1;
+            pool[i].busy = false;
+            pool[i].failures = 0;
+            pool[i].retry_at = 0;
+        }
+        return !addresses.empty();
+    }
+
+    // Закрытие всех соединений. Вызывается, когда обменов больше нет
+    void Close()
+    {
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            if (pool[i].fd >= 0)
+                close(pool[i].fd);
+        }
+        pool.clear();
+        addresses.clear();
+        stash.clear();
+    }
+
+    // Подключение всех соединений пула сразу; true, если подключилось хотя бы одно
+    bool Connect()
+    {
+        uint64_t deadline = NowMs() + options.connect_timeout_ms;
+        bool any = false;
+        for (size_t i = 0; i < pool.size(); i++)
+        {
+            pthread_mutex_lock(&mutex);
+            Connection *connection = pool[i].busy ? NULL : &pool[i];
+            if (connection != NULL)
+                connection->busy = true;
+            pthread_mutex_unlock(&mutex);
+            if (connection == NULL)
+                continue;
+            if (EnsureConnected(connection, deadline))
+                any = true;
+            Release(connection, false);
+        }
+        return any;
+    }
+
+    // Сервер на этой же машине: сокет Unix или адрес 127.x.x.x / ::1
+    bool IsLocal() const
+    {
+        for (size_t i = 0; i < addresses.size(); i++)
+        {
+            const struct sockaddr *sa = (const struct sockaddr *)&addresses[i].storage;
+            if (sa->sa_family == AF_UNIX)
+                return true;
+            if (sa->sa_family == AF_INET &&
+                (ntohl(((const struct sockaddr_in *)sa)->sin_addr.s_addr) >> 24) == 127)
+                return true;
+            if (sa->sa_family == AF_INET6 && IN6_IS_ADDR_LOOPBACK(&((const struct sockaddr_in6 *)sa)->sin6_addr))
+                return true;
+        }
+        return false;
+    }
+
+    // Отдельное соединение вне пула (для SUBSCRIBE): подключается так же, как соединения
+    // пула, после подключения блокирующее. Закрывает вызывающий; -1 при ошибке
+    int Dial()
+    {
+        int fd = ConnectAny(NowMs() + options.connect_timeout_ms);
+        if (fd >= 0)
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+        return fd;
+    }
+
+    // Одна команда (без '\n') и строка ответа (без '\n'). timeout_ms < 0 - срок по умолчанию
+    StorageStatus Request(const char *command, std::string &reply, int timeout_ms = -1)
+    {
+        std::vector<std::string> commands(1, command);
+        std::vector<std::string> replies;
+        StorageStatus status = Batch(commands, replies, timeout_ms);
+        reply = replies[0];
+        return status;
+    }
+
+    // Пачка команд конвейером; replies[i] - ответ на commands[i] (пустой, если его нет).
+    // Возвращает худший из статусов частей пачки
+    StorageStatus Batch(const std::vector<std::string> &commands, std::vector<std::string> &replies,
+                        int timeout_ms = -1)
+    {
+        replies.assign(commands.size(), std::string());
+        if (commands.empty())
+            return STORAGE_OK;
+
+        // Сначала команды получают единицы из запаса, серверу уходит только остаток
+        std::vector<std::vector<int> > local(commands.size());
+        std::vector<std::string> sent;
+        std::vector<size_t> origin; // Номер команды пачки для каждой из sent
+        pthread_mutex_lock(&mutex);
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            std::string depot;
+            bool many = false;
+            int wanted = 0;
+            if (ParseTake(commands[i], depot, &many, &wanted))
+            {
+                int mark;
+                while ((int)local[i].size() < wanted && TakeStashed(depot, &mark))
+                    local[i].push_back(mark);
+            }
+            int rest = wanted - (int)local[i].size();
+            if (local[i].empty())
+            {
+                sent.push_back(commands[i]);
+                origin.push_back(i);
+            }
+            else if (many && rest > 0)
+            {
+                char command[64];
+                snprintf(command, sizeof(command), "POP%s%s %d", depot.empty() ? "" : " ", depot.c_str(), rest);
+                sent.push_back(command);
+                origin.push_back(i);
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+
+        std::vector<std::string> sent_replies(sent.size());
+        StorageStatus status = STORAGE_OK;
+        if (!sent.empty())
+        {
+            uint64_t deadline = NowMs() + (timeout_ms < 0 ? options.request_timeout_ms : timeout_ms);
+            for (size_t i = 0; i < sent.size(); i++)
+            {
+                // Сервер держит "POPWAIT ms" до ms, ответ на него не опаздывает
+                if (sent[i].compare(0, 8, "POPWAIT ") == 0)
+                    deadline += atoi(sent[i].c_str() + 8);
+            }
+            status = Exchange(sent, sent_replies, deadline);
+        }
+        for (size_t j = 0; j < sent.size(); j++)
+            replies[origin[j]] = sent_replies[j];
+
+        for (size_t i = 0; i < commands.size(); i++)
+        {
+            if (local[i].empty())
+                continue;
+            std::string depot;
+            bool many = false;
+            int wanted = 0;
+            ParseTake(commands[i], depot, &many, &wanted);
+            if (status != STORAGE_OK)
+            {
+                // Вызывающий не увидит ответа - единицы возвращаются в запас
+                pthread_mutex_lock(&mutex);
+                for (size_t k = 0; k < local[i].size(); k++)
+                    Stash(depot, local[i][k]);
+                pthread_mutex_unlock(&mutex);
+                continue;
+            }
+            replies[i] = JoinMarks(local[i], replies[i], many);
+        }
+        return status;
+    }
+
+    // Счетчики: подключения, неудачные попытки, обрывы, тайм-ауты обменов и единицы,
+    // попавшие в запас из опоздавших ответов
+    long Connects()
+    {
+        return Read(&connects);
+    }
+
+    long ConnectFailures()
+    {
+        return Read(&connect_failures);
+    }
+
+    long Drops()
+    {
+        return Read(&drops);
+    }
+
+    long Timeouts()
+    {
+        return Read(&timeouts);
+    }
+
+    long LateUnits()
+    {
+        return Read(&late_units);
+    }
+
+private:
+    struct Address
+    {
+        struct sockaddr_storage storage;
+        socklen_t length;
+    };
+
+    struct Connection
+    {
+        int fd;
+        bool busy;         // Занято обменом (под mutex)
+        int failures;      // Неудачные попытки подключения подряд
+        uint64_t retry_at; // Раньше этого момента (мс) не подключаться
+        std::string rx;    // Принятое, но еще не разобранное
+        std::vector<std::string> owed; // Отправленные команды, ответы на которые не дождались
+    };
+
+    // Единица из опоздавшего ответа; depot пустой - склад по умолчанию
+    struct Stashed
+    {
+        std::string depot;
+        int mark;
+    };
+
+    static uint64_t NowMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+    }
+
+    // Сколько осталось до срока, мс (не меньше 0)
+    static int Remaining(uint64_t deadline)
+    {
+        uint64_t now = NowMs();
+        return deadline > now ? (int)(deadline - now) : 0;
+    }
+
+    // Свободное соединение: сначала подключенное, затем то, которому можно переподключаться,
+    // затем подключенное с долгами. wait = false - только подключенные без долгов и без ожидания. NULL, если взять нечего; причина в *status
+    Connection *Acquire(uint64_t deadline, bool wait, StorageStatus *status)
+    {
+        pthread_mutex_lock(&mutex);
+        while (true)
+        {
+            Connection *ready = NULL;
+            Connection *reconnect = NULL;
+            Connection *owing = NULL;
+            bool any_busy = false;
+            uint64_t now = NowMs();
+            for (size_t i = 0; i < pool.size() && ready == NULL; i++)
+            {
+                Connection *connection = &pool[i];
+                if (connection->busy)
+                    any_busy = true;
+                else if (connection->fd >= 0 && connection->owed.empty())
+                    ready = connection;
+                else if (connection->fd >= 0)
+                    owing = connection;
+                else if (reconnect == NULL && now >= connection->retry_at)
+                    reconnect = connection;
+            }
+            // Соединение с долгами - последним: сначала ему дочитывать опоздавшие ответы
+            if (ready == NULL && wait)
+                ready = reconnect != NULL ? reconnect : owing;
+            Connection *taken = ready;
+            if (taken != NULL)
+            {
+                taken->busy = true;
+                pthread_mutex_unlock(&mutex);
+                return taken;
+            }
+            if (!wait || !any_busy)
+            {
+                // Все свободные соединения ждут повторной попытки подключения
+                if (status != NULL)
+                    *status = STORAGE_UNAVAILABLE;
+                break;
+            }
+
+            struct timespec until;
+            until.tv_sec = deadline / 1000;
+            until.tv_nsec = (deadline % 1000) * 1000000L;
+            if (pthread_cond_timedwait(&released, &mutex, &until) == ETIMEDOUT && NowMs() >= deadline)
+            {
+                if (status != NULL)
+                    *status = STORAGE_TIMEOUT;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        return NULL;
+    }
+
+    // Возврат соединения в пул; broken - закрыть, следующий обмен подключится заново
+    void Release(Connection *connection, bool broken)
+    {
+        pthread_mutex_lock(&mutex);
+        if (broken && connection->fd >= 0)
+        {
+            close(connection->fd);
+            connection->fd = -1;
+            connection->rx.clear();
+            connection->owed.clear();
+        }
+        connection->busy = false;
+        pthread_cond_signal(&released);
+        pthread_mutex_unlock(&mutex);
+    }
+
+    // Подключение занятого вызывающим соединения, если оно закрыто
+    bool EnsureConnected(Connection *connection, uint64_t deadline)
+    {
+        if (connection->fd >= 0)
+            return true;
+        uint64_t connect_deadline = NowMs() + options.connect_timeout_ms;
+        int fd = ConnectAny(connect_deadline < deadline ? connect_deadline : deadline);
+
+        pthread_mutex_lock(&mutex);
+        if (fd >= 0)
+        {
+            connection->fd = fd;
+            connection->failures = 0;
+            connects++;
+        }
+        else
+        {
+            connection->failures++;
+            connect_failures++;
+            int shift = connection->failures - 1 < 16 ? connection->failures - 1 : 16;
+            uint64_t limit = (uint64_t)options.backoff_base_ms << shift;
+            if (limit > (uint64_t)options.backoff_max_ms)
+                limit = options.backoff_max_ms;
+            connection->retry_at = NowMs() + rand_r(&seed) % (limit + 1);
+        }
+        pthread_mutex_unlock(&mutex);
+        return fd >= 0;
+    }
+
+    // Неблокирующее подключение по адресам по очереди. Сокет остается неблокирующим
+    int ConnectAny(uint64_t deadline)
+    {
+        for (size_t i = 0; i < addresses.size(); i++)
+        {
+            const struct sockaddr *sa = (const struct sockaddr *)&addresses[i].storage;
+            int fd = socket(sa->sa_family, SOCK_STREAM, 0);
+            if (fd < 0)
+                continue;
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+            bool connected = connect(fd, sa, addresses[i].length) == 0;
+            if (!connected && errno == EINPROGRESS)
+            {
+                struct pollfd pfd = {fd, POLLOUT, 0};
+                int error = 0;
+                socklen_t len = sizeof(error);
+                connected = poll(&pfd, 1, Remaining(deadline)) == 1 &&
+                            getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) == 0 && error == 0;
+            }
+            if (connected)
+            {
+                if (sa->sa_family != AF_UNIX)
+                {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                }
+                return fd;
+            }
+            close(fd);
+            if (Remaining(deadline) == 0)
+                break;
+        }
+        return -1;
+    }
+
+    StorageStatus Send(Connection *connection, const std::string &text, uint64_t deadline)
+    {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL; // Обрыв - ошибка обмена, а не SIGPIPE
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < text.size())
+        {
+            ssize_t n = send(connection->fd, text.data() + sent, text.size() - sent, flags);
+            if (n > 0)
+            {
+                sent += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                return STORAGE_FAILED;
+            struct pollfd pfd = {connection->fd, POLLOUT, 0};
+            if (poll(&pfd, 1, Remaining(deadline)) <= 0)
+                return STORAGE_TIMEOUT;
+        }
+        return STORAGE_OK;
+    }
+
+    // Чтение ответов на команды [next, end) в replies. После возврата next - первая
+    // команда, ответ на которую не прочитан
+    StorageStatus Receive(Connection *connection, std::vector<std::string> &replies, size_t &next, size_t end,
+                          uint64_t deadline)
+    {
+        char buffer[4096];
+        while (true)
+        {
+            size_t start = 0;
+            size_t eol;
+            while (next < end && (eol = connection->rx.find('\n', start)) != std::string::npos)
+            {
+                replies[next++].assign(connection->rx, start, eol - start);
+                start = eol + 1;
+            }
+            connection->rx.erase(0, start);
+            if (next == end)
+                return STORAGE_OK;
+
+            ssize_t n = read(connection->fd, buffer, sizeof(buffer));
+            if (n > 0)
+            {
+                connection->rx.append(buffer, n);
+                continue;
+            }
+            if (n == 0)
+                return STORAGE_FAILED;
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return STORAGE_FAILED;
+            struct pollfd pfd = {connection->fd, POLLIN, 0};
+            if (poll(&pfd, 1, Remaining(deadline)) <= 0)
+                return STORAGE_TIMEOUT;
+        }
+    }
+
+    // Обмен пачкой с сервером до срока deadline
+    StorageStatus Exchange(const std::vector<std::string> &commands, std::vector<std::string> &replies,
+                           uint64_t deadline)
+    {
+        StorageStatus status = STORAGE_OK;
+        std::vector<Connection *> parts;
+        Connection *first = Acquire(deadline, true, &status);
+        if (first == NULL)
+            return status;
+        parts.push_back(first);
+
+        // Длинная пачка делится между свободными соединениями, которые уже подключены
+        size_t wanted = (commands.size() + options.batch_split - 1) / options.batch_split;
+        while (parts.size() < wanted)
+        {
+            Connection *extra = Acquire(deadline, false, NULL);
+            if (extra == NULL)
+                break;
+            parts.push_back(extra);
+        }
+
+        size_t count = parts.size();
+        std::vector<StorageStatus> part_status(count, STORAGE_OK);
+        for (size_t p = 0; p < count; p++)
+        {
+            if (!EnsureConnected(parts[p], deadline))
+            {
+                part_status[p] = STORAGE_UNAVAILABLE;
+                continue;
+            }
+            part_status[p] = Settle(parts[p], deadline);
+            if (part_status[p] != STORAGE_OK)
+                continue;
+            std::string text;
+            for (size_t i = commands.size() * p / count; i < commands.size() * (p + 1) / count; i++)
+            {
+                text += commands[i];
+                text += '\n';
+            }
+            part_status[p] = Send(parts[p], text, deadline);
+            if (part_status[p] == STORAGE_TIMEOUT)
+                part_status[p] = STORAGE_FAILED; // Часть строки осталась неотправленной
+        }
+        for (size_t p = 0; p < count; p++)
+        {
+            size_t next = commands.size() * p / count;
+            size_t end = commands.size() * (p + 1) / count;
+            if (part_status[p] == STORAGE_OK)
+            {
+                part_status[p] = Receive(parts[p], replies, next, end, deadline);
+                if (part_status[p] == STORAGE_TIMEOUT)
+                    parts[p]->owed.assign(commands.begin() + next, commands.begin() + end);
+            }
+
+            // Тайм-аут оставляет соединение открытым: ответы дочитает Settle
+            bool broken = part_status[p] == STORAGE_FAILED;
+            if (part_status[p] == STORAGE_TIMEOUT)
+                Bump(&timeouts);
+            if (part_status[p] == STORAGE_FAILED)
+                Bump(&drops);
+            Release(parts[p], broken);
+            if (part_status[p] > status)
+                status = part_status[p];
+        }
+        return status;
+    }
+
+    // Долги соединения: дочитывание опоздавших ответов, топливо из них уходит в запас.
+    // STORAGE_OK - долгов не осталось
+    StorageStatus Settle(Connection *connection, uint64_t deadline)
+    {
+        if (connection->owed.empty())
+            return STORAGE_OK;
+        std::vector<std::string> late(connection->owed.size());
+        size_t got = 0;
+        StorageStatus status = Receive(connection, late, got, late.size(), deadline);
+
+        pthread_mutex_lock(&mutex);
+        for (size_t i = 0; i < got; i++)
+        {
+            std::string depot;
+            bool many = false;
+            int wanted = 0;
+            if (!ParseTake(connection->owed[i], depot, &many, &wanted))
+                continue;
+            std::vector<int> marks;
+            ParseMarks(late[i], many, marks);
+            for (size_t k = 0; k < marks.size(); k++)
+            {
+                Stash(depot, marks[k]);
+                late_units++;
+            }
+        }
+        pthread_mutex_unlock(&mutex);
+        connection->owed.erase(connection->owed.begin(), connection->owed.begin() + got);
+        return status;
+    }
+
+    // Разбор команды, выдающей топливо: склад (пустой - по умолчанию), формат ответа
+    // (many - "k m1 ... mk", иначе одна марка) и сколько единиц команда может взять из
+    // запаса (0 - команда выбирает марку или резерв, запас ей не подходит).
+    // false - команда топливо не выдает. Резерв (RESERVE) сервер снимет сам по сроку
+    static bool ParseTake(const std::string &command, std::string &depot, bool *many, int *wanted)
+    {
+        char name[16] = "";
+        char second[32] = "";
+        int count = 0;
+        int fields = sscanf(command.c_str(), "%15s %31s %d", name, second, &count);
+        bool named = fields >= 2 && isalpha((unsigned char)second[0]);
+        depot.clear();
+        *many = false;
+        *wanted = 0;
+        if (strcmp(name, "POP") == 0)
+        {
+            if (named && strcmp(second, "default") != 0)
+                depot = second;
+            *many = fields == (named ? 3 : 2);
+            *wanted = !*many ? 1 : named ? count : atoi(second);
+        }
+        else if (strcmp(name, "POPWAIT") == 0)
+        {
+            *wanted = 1;
+        }
+        else if (strcmp(name, "COMMIT") == 0)
+        {
+            *many = true;
+        }
+        else if (strcmp(name, "POPMIN") != 0 && strcmp(name, "POPMAX") != 0 && strcmp(name, "POPEXACT") != 0)
+        {
+            return false;
+        }
+        if (*wanted < 0)
+            *wanted = 0;
+        return true;
+    }
+
+    // Марки выданных единиц из ответа
+    static void ParseMarks(const std::string &reply, bool many, std::vector<int> &marks)
+    {
+        const char *p = reply.c_str();
+        char *end;
+        long units = 1;
+        if (many)
+        {
+            units = strtol(p, &end, 10);
+            p = end;
+        }
+        for (long i = 0; i < units; i++)
+        {
+            long mark = strtol(p, &end, 10);
+            if (end == p)
+                break;
+            p = end;
+            if (mark > 0)
+                marks.push_back(mark);
+        }
+    }
+
+    // Ответ команды, часть единиц которой взята из запаса (local), остальное - reply сервера
+    static std::string JoinMarks(const std::vector<int> &local, const std::string &reply, bool many)
+    {
+        char text[16];
+        if (!many)
+        {
+            snprintf(text, sizeof(text), "%d", local[0]);
+            return text;
+        }
+        std::vector<int> marks(local);
+        ParseMarks(reply, true, marks);
+        snprintf(text, sizeof(text), "%d", (int)marks.size());
+        std::string joined = text;
+        for (size_t i = 0; i < marks.size(); i++)
+        {
+            snprintf(text, sizeof(text), " %d", marks[i]);
+            joined += text;
+        }
+        return joined;
+    }
+
+    // Запас (под mutex)
+    void Stash(const std::string &depot, int mark)
+    {
+        Stashed unit;
+        unit.depot = depot;
+        unit.mark = mark;
+        stash.push_back(unit);
+    }
+
+    bool TakeStashed(const std::string &depot, int *mark)
+    {
+        for (size_t i = 0; i < stash.size(); i++)
+        {
+            if (stash[i].depot == depot)
+            {
+                *mark = stash[i].mark;
+                stash.erase(stash.begin() + i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Bump(long *counter)
+    {
+        pthread_mutex_lock(&mutex);
+        (*counter)++;
+        pthread_mutex_unlock(&mutex);
+    }
+
+    long Read(long *counter)
+    {
+        pthread_mutex_lock(&mutex);
+        long value = *counter;
+        pthread_mutex_unlock(&mutex);
+        return value;
+    }
+
+    StorageClientOptions options;
+    std::vector<Address> addresses;
+    std::vector<Connection> pool;
+    pthread_mutex_t mutex;
+    pthread_cond_t released; // Соединение вернулось в пул
+    unsigned seed;           // Разброс пауз (под mutex)
+    long connects;
+    long connect_failures;
+    long drops;
+    long timeouts;
+    long late_units;
+    std::vector<Stashed> stash; // Запас из опоздавших ответов (под mutex)
+};
+
+#endif
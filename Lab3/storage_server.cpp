@@ -3,159 +3,3091 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 #include <queue>
+#include <string>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <list>
+#include <map>
+#include <vector>
+#include <poll.h>
+#include <atomic>
+#include <stdint.h>
+#include "fuel_ring.h"
+#include "storage_shards.h"
+#include "fuel_buckets.h"
+#include "timer_wheel.h"
+#include "storage_wal.h"
+#include "storage_stats.h"
+#include "async_log.h"
+#include "storage_shm.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "storage_uring.h"
+#endif
+
+// Режимы обслуживания клиентов
+enum ServerMode
+{
+    MODE_THREADS, // Отдельный поток на каждое соединение
+    MODE_EPOLL,    // Цикл событий epoll в одном или нескольких потоках
+    MODE_POOL,     // Заранее запущенные рабочие потоки и ограниченная очередь соединений
+    MODE_REUSEPORT, // У каждого цикла epoll свой слушающий сокет SO_REUSEPORT на том же порту
+    MODE_URING      // Циклы io_uring со своими слушающими сокетами SO_REUSEPORT
+};
+
+// Способ хранения топлива
+enum StorageBackend
+{
+    STORAGE_RING,  // Кольцевая очередь без блокировок
+    STORAGE_QUEUE, // std::queue под мьютексом склада
+    STORAGE_SHARDS, // Очереди по ядрам с кражей у соседей
+    STORAGE_GRADE,  // Корзины по маркам с маской занятости (POPMIN, POPMAX, POPEXACT)
+    STORAGE_PRIORITY // Те же корзины, но POP выдает самую высокую марку первой
+};
+
+// Хранилище разложено по маркам и принимает запросы по марке
+static inline bool GradedBackend(StorageBackend backend)
+{
+    return backend == STORAGE_GRADE || backend == STORAGE_PRIORITY;
+}
 
 // Глобальные структуры для синхронизации
-pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 volatile int run_flag = 1;
 
-// Общие данные
-std::queue<int> fuel_storage;
+// Параметры запуска
+ServerMode server_mode = MODE_THREADS;
+int loop_count = 1;
+StorageBackend storage_backend = STORAGE_RING;
+int shard_count = 0; // 0 - по числу процессоров
+const char *wal_dir = NULL; // Каталог журнала; NULL - хранилище не сохраняется
+int pool_size = 4;          // Рабочих потоков в режиме pool
+int pool_queue_size = 64;   // Соединений, ожидающих свободного рабочего потока
+bool pool_reject = false;   // Переполнение очереди: отказ (true) или ожидание в accept (false)
+int listen_backlog = 128;   // Очередь установленных, но не принятых соединений в ядре
+const char *unix_path = "/tmp/fuel_storage.sock"; // Сокет Unix для локальных клиентов; NULL - выключен
+const char *shm_name = SHM_DEFAULT_NAME;          // Сегмент разделяемой памяти; NULL - выключен
+const char *depot_config = NULL; // Файл со списком именованных складов (ключ -D)
+
+// События журнала (async_log.h): номер события - индекс в таблице форматов
+enum ServerEvent
+{
+    EV_DISPENSED,
+    EV_EMPTY,
+    EV_BATCH,
+    EV_GENERATED,
+    EV_GENERATED_BATCH,
+    EV_CONNECTED,
+    EV_DEPOT_GENERATED,
+    EV_SHM_RETURNED,
+    EV_COUNT
+};
+
+const char *event_formats[EV_COUNT] = {
+    "Dispensed fuel: %d, Storage size: %d",
+    "Storage empty, cannot dispense fuel",
+    "Dispensed %d of %d requested units, Storage size: %d",
+    "Generated fuel: %d, Storage size: %d",
+    "Generated %d units, Storage size: %d",
+    "New client connected",
+    "Depot %d: generated %d units, size: %d",
+    "Returned %d of %d units of a cancelled shared memory request",
+};
+
+int log_level_option = -1; // -1 - ключ -l не задан
+
+// Максимальное количество единиц топлива в хранилище (ключ -c)
+int storage_capacity = 20;
+
+// Производитель склада по умолчанию (ключи -r и -B)
+double produce_rate = 1.0; // Единиц в секунду
+int produce_burst = 1;     // Единиц за один такт
+
+// Предел емкости: размер кольцевой очереди
+const int MAX_STORAGE_CAPACITY = 1024;
+
+// Число единиц на складе - атомарный счетчик в отдельной строке кэша.
+// SIZE, STATS и проверки производителя читают его одной загрузкой, не захватывая мьютекс
+// хранилища и не обходя шарды. Вставка увеличивает счетчик до операции, извлечение
+// уменьшает после, поэтому счетчик не бывает меньше настоящего размера и не уходит в минус
+struct alignas(CACHE_LINE) InventoryCounter
+{
+    std::atomic<int> units;
+    char pad[CACHE_LINE - sizeof(std::atomic<int>)];
+};
+
+// Склад топлива: свое хранилище, емкость, производитель и счетчики.
+// Склад по умолчанию (depots[0], имя "default") настраивается ключами -s, -c, -r, -B;
+// на нем работают POPWAIT, выдача по марке, резервы, подписка и журнал.
+// Остальные склады задаются файлом конфигурации (ключ -D) и отвечают на "POP имя [n]"
+// и "SIZE имя". Общих мьютексов у складов нет, операции с одним складом не мешают другим
+const int MAX_DEPOTS = 16;
+const int DEPOT_NAME_LEN = 32;
+
+struct Depot
+{
+    char name[DEPOT_NAME_LEN];
+    StorageBackend backend;
+    int capacity;
+
+    // Хранилище склада - по backend (grade и priority - общие корзины)
+    FuelRing<MAX_STORAGE_CAPACITY> ring;
+    std::queue<int> queue;
+    pthread_mutex_t queue_mutex;
+    ShardedStore shards;
+    FuelBuckets buckets;
+    InventoryCounter inventory;
+    std::atomic<int> reserved; // Единицы в резервах (RESERVE): сняты со склада, но занимают место
+
+    // Производитель: частота, размер партии и ожидание свободного места
+    double produce_rate; // Единиц в секунду
+    int produce_burst;   // Единиц за один такт
+    pthread_mutex_t space_mutex;
+    pthread_cond_t space_cond; // Условие "на складе есть место"
+    std::atomic<bool> producer_waiting;
+    std::atomic<long> produced_units;
+    std::atomic<long> producer_full_waits;
+    pthread_t producer_thread;
+};
+
+Depot depots[MAX_DEPOTS];
+int depot_count = 1;
+
+static Depot *DefaultDepot()
+{
+    return &depots[0];
+}
+
+// Склад по имени или NULL
+static Depot *FindDepot(const char *name)
+{
+    for (int i = 0; i < depot_count; i++)
+    {
+        if (strcmp(depots[i].name, name) == 0)
+            return &depots[i];
+    }
+    return NULL;
+}
+
+// Журнал операций для восстановления после перезапуска
+FuelWal fuel_wal;
+bool wal_enabled = false;
+
+// Размер сегмента журнала (операций) и период контрольных точек
+const size_t WAL_SEGMENT_RECORDS = 1 << 20;
+const int WAL_SYNC_MS = 10;
+const int WAL_SNAPSHOT_SEC = 30;
+
+// Текущее время по монотонным часам, мс
+static long long NowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// Команды протокола для счетчиков STATS
+enum StatsCommand
+{
+    CMD_POP,
+    CMD_POP_BATCH,
+    CMD_POPWAIT,
+    CMD_SIZE,
+    CMD_STATS,
+    CMD_POPMIN,
+    CMD_POPMAX,
+    CMD_POPEXACT,
+    CMD_SUBSCRIBE,
+    CMD_RESERVE,
+    CMD_COMMIT,
+    CMD_RELEASE,
+    CMD_UNKNOWN,
+    CMD_COUNT
+};
+
+const char *command_names[CMD_COUNT] = {"POP", "POP_N", "POPWAIT", "SIZE", "STATS",
+                                        "POPMIN", "POPMAX", "POPEXACT", "SUBSCRIBE", "RESERVE",
+                                        "COMMIT", "RELEASE", "ERR"};
+
+// Соединения: открытые сейчас и принятые за все время
+std::atomic<int> active_connections(0);
+std::atomic<long> total_connections(0);
+std::atomic<long> rejected_connections(0);
+long long start_time_ms = 0;
+
+// История глубины очереди: выборка раз в секунду, последние DEPTH_SAMPLES значений
+const int DEPTH_SAMPLES = 60;
+const int DEPTH_INTERVAL_MS = 1000;
+std::atomic<int> depth_history[DEPTH_SAMPLES];
+std::atomic<long> depth_taken(0);
+
+// Захват мьютекса очереди склада с учетом времени ожидания.
+// Свободный мьютекс берется trylock без обращения к часам и записывается как нулевое ожидание
+static void LockStorage(Depot *depot)
+{
+    if (pthread_mutex_trylock(&depot->queue_mutex) == 0)
+    {
+        LocalStats()->lock_wait.Record(0);
+        return;
+    }
+    uint64_t start = NowNs();
+    pthread_mutex_lock(&depot->queue_mutex);
+    LocalStats()->lock_wait.Record(NowNs() - start);
+}
+
+// Добавление в хранилище склада без журналирования и учета в inventory
+static bool PushToBackend(Depot *depot, int mark)
+{
+    if (depot->backend == STORAGE_RING)
+    {
+        // Кроме производителя вставляют потоки клиентов (RELEASE) и таймер резервов, поэтому
+        // емкость склада проверяет сам Push при захвате позиции, а не отдельный Size()
+        return depot->ring.Push(mark, depot->capacity);
+    }
+    if (depot->backend == STORAGE_SHARDS)
+        return depot->shards.Push(mark);
+    if (GradedBackend(depot->backend))
+        return depot->buckets.Push(mark);
+
+    LockStorage(depot);
+    bool pushed = (int)depot->queue.size() < depot->capacity;
+    if (pushed)
+        depot->queue.push(mark);
+    pthread_mutex_unlock(&depot->queue_mutex);
+    return pushed;
+}
+
+// Добавление в хранилище склада без журналирования
+static bool BackendPush(Depot *depot, int mark)
+{
+    depot->inventory.units.fetch_add(1);
+    if (PushToBackend(depot, mark))
+        return true;
+    depot->inventory.units.fetch_sub(1);
+    return false;
+}
+
+// Извлечение из хранилища склада без журналирования
+static int BackendPop(Depot *depot)
+{
+    int mark = -1;
+    if (depot->backend == STORAGE_RING)
+    {
+        if (!depot->ring.Pop(&mark))
+            mark = -1;
+    }
+    else if (depot->backend == STORAGE_SHARDS)
+    {
+        if (!depot->shards.Pop(&mark))
+            mark = -1;
+    }
+    else if (depot->backend == STORAGE_GRADE)
+    {
+        mark = depot->buckets.Pop();
+    }
+    else if (depot->backend == STORAGE_PRIORITY)
+    {
+        // Марка - это время горения котла, поэтому высокие марки уходят первыми:
+        // за один рейс грузовик привозит больше топлива
+        mark = depot->buckets.PopMax();
+    }
+    else
+    {
+        LockStorage(depot);
+        if (!depot->queue.empty())
+        {
+            mark = depot->queue.front();
+            depot->queue.pop();
+        }
+        pthread_mutex_unlock(&depot->queue_mutex);
+    }
+    if (mark > 0)
+        depot->inventory.units.fetch_sub(1);
+    return mark;
+}
+
+// Пробуждение производителя, ждущего свободного места. Мьютекс захватывается,
+// только если производитель действительно ждет
+static void WakeProducer(Depot *depot)
+{
+    // Парный барьер к установке producer_waiting в WaitForSpace(): либо производитель
+    // увидит освободившееся место при повторной проверке, либо потребитель увидит флаг
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (depot->producer_waiting.load(std::memory_order_relaxed))
+    {
+        pthread_mutex_lock(&depot->space_mutex);
+        pthread_cond_signal(&depot->space_cond);
+        pthread_mutex_unlock(&depot->space_mutex);
+    }
+}
+
+// Подписка на изменения хранилища (SUBSCRIBE).
+//
+// Соединение, выполнившее "SUBSCRIBE [интервал_мс [порог]]", перестает принимать команды
+// и получает строки "INV size added state": текущий размер, число единиц, выпущенных
+// с прошлого события, и положение относительно порога (above - size >= порог, below - меньше).
+// Событие отправляется, только если размер изменился (топливо добавилось или его забрали),
+// и не чаще одного раза за интервал: изменения за интервал сливаются в одно событие.
+// Подписчиков обслуживает один поток (SubscriptionThread): он ждет в poll() на их сокетах
+// и на канале пробуждения, в который пишут производитель и потребители.
+const int SUBSCRIBE_DEFAULT_INTERVAL_MS = 100;
+const int SUBSCRIBE_MAX_INTERVAL_MS = 60000;
+
+struct SubscribeRequest
+{
+    int interval_ms;
+    int threshold;
+};
+
+std::atomic<int> subscriber_count(0);
+std::atomic<bool> subscriber_wake_pending(false);
+int subscriber_pipe[2] = {-1, -1};
+
+// Пробуждение потока подписок. Пока он не проснулся, повторные вызовы ничего не пишут,
+// поэтому на горячем пути POP это одна атомарная проверка
+static void WakeSubscribers()
+{
+    if (subscriber_count.load(std::memory_order_relaxed) == 0)
+        return;
+    if (subscriber_wake_pending.exchange(true))
+        return;
+    char byte = 1;
+    write(subscriber_pipe[1], &byte, 1);
+}
+
+// Добавление единицы топлива на склад. Возвращает false, если склад заполнен.
+// В журнал пишутся только операции склада по умолчанию. Запись делается до вставки:
+// единица, которую вернул клиент (RELEASE), не пропадает, если процесс упадет между
+// журналом и хранилищем. Если склад оказался полон, запись отменяется записью POP
+bool DepotPush(Depot *depot, int mark)
+{
+    bool logged = wal_enabled && depot == DefaultDepot();
+    if (logged)
+        fuel_wal.Append(WAL_PUSH, mark);
+    if (BackendPush(depot, mark))
+        return true;
+    if (logged)
+        fuel_wal.Append(WAL_POP, mark);
+    return false;
+}
+
+// Извлечение единицы топлива со склада. Возвращает марку или -1, если склад пуст.
+// Марка известна только после извлечения, поэтому POP журналируется после него, но до
+// ответа клиенту: при падении между ними единица, которую клиент не получил, восстановится.
+// Окно потери - падение после записи POP и до отправки ответа
+int DepotPop(Depot *depot)
+{
+    int mark = BackendPop(depot);
+    if (mark > 0)
+    {
+        WakeProducer(depot);
+        if (depot == DefaultDepot())
+        {
+            if (wal_enabled)
+                fuel_wal.Append(WAL_POP, mark);
+            WakeSubscribers();
+        }
+    }
+    return mark;
+}
+
+// Число единиц на складе (без блокировок, см. InventoryCounter)
+int DepotSize(Depot *depot)
+{
+    return depot->inventory.units.load(std::memory_order_relaxed);
+}
+
+// Операции со складом по умолчанию
+bool StoragePush(int mark)
+{
+    return DepotPush(DefaultDepot(), mark);
+}
+
+int StoragePop()
+{
+    return DepotPop(DefaultDepot());
+}
+
+int StorageSize()
+{
+    return DepotSize(DefaultDepot());
+}
+
+// Склад заполнен с учетом отложенных в резервы единиц
+static bool DepotFull(Depot *depot)
+{
+    return DepotSize(depot) + depot->reserved.load() >= depot->capacity;
+}
+
+// Запросы по марке (только в хранилищах STORAGE_GRADE и STORAGE_PRIORITY)
+enum GradeQuery
+{
+    GRADE_MIN,   // Самая низкая марка не ниже заданной
+    GRADE_MAX,   // Самая высокая марка
+    GRADE_EXACT  // Ровно заданная марка
+};
+
+// Извлечение единицы по марке. Возвращает марку или -1, если подходящей нет
+int StoragePopGrade(GradeQuery query, int mark)
+{
+    Depot *depot = DefaultDepot();
+    if (query == GRADE_MIN)
+        mark = depot->buckets.PopMin(mark);
+    else if (query == GRADE_MAX)
+        mark = depot->buckets.PopMax();
+    else
+        mark = depot->buckets.PopExact(mark);
+
+    if (mark > 0)
+    {
+        depot->inventory.units.fetch_sub(1);
+        if (wal_enabled)
+            fuel_wal.Append(WAL_POP, mark); // До ответа клиенту, как в DepotPop
+        WakeProducer(depot);
+        WakeSubscribers();
+    }
+    return mark;
+}
+
+// Поток групповой фиксации журнала: сброс записей на диск и периодические снимки
+void *WalSyncThread(void *arg)
+{
+    long long last_snapshot = NowMs();
+    while (run_flag)
+    {
+        usleep(WAL_SYNC_MS * 1000);
+        fuel_wal.Sync();
+        if (NowMs() - last_snapshot >= WAL_SNAPSHOT_SEC * 1000LL)
+        {
+            fuel_wal.Checkpoint(false);
+            last_snapshot = NowMs();
+        }
+    }
+    fuel_wal.Sync();
+    return NULL;
+}
+
+// Ожидание топлива командой POPWAIT: производитель будит ожидающих через условную переменную
+pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t fuel_cond;
+
+// Максимальное время ожидания в POPWAIT, мс
+const int MAX_WAIT_MS = 60000;
+
+#ifdef __linux__
+static void WakeEventLoops();
+static uint64_t LoopSyscalls();
+#endif
+
+// Условная переменная ждет по монотонным часам, чтобы перевод системного времени не влиял на тайм-аут
+static void InitWaitCondition()
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&fuel_cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Извлечение с ожиданием: если хранилище пусто, поток спит до появления топлива
+// или до истечения timeout_ms. Возвращает марку или -1 по тайм-ауту
+int StoragePopWait(int timeout_ms)
+{
+    int mark = StoragePop();
+    if (mark > 0 || timeout_ms <= 0)
+        return mark;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    // Повторная проверка под wait_mutex: производитель сигналит под тем же мьютексом,
+    // поэтому добавленная между проверкой и ожиданием единица не будет пропущена
+    pthread_mutex_lock(&wait_mutex);
+    while ((mark = StoragePop()) < 0 && run_flag)
+    {
+        if (pthread_cond_timedwait(&fuel_cond, &wait_mutex, &deadline) == ETIMEDOUT)
+        {
+            mark = StoragePop();
+            break;
+        }
+    }
+    pthread_mutex_unlock(&wait_mutex);
+    return mark;
+}
+
+// Оповещение ожидающих POPWAIT о новой единице топлива
+void NotifyFuelAvailable()
+{
+    pthread_mutex_lock(&wait_mutex);
+    pthread_cond_signal(&fuel_cond);
+    pthread_mutex_unlock(&wait_mutex);
+#ifdef __linux__
+    WakeEventLoops();
+#endif
+}
+
+// Максимальное число единиц в одном ответе на "POP n" и в одном резерве
+const int MAX_BATCH = 64;
+
+
+// Резервирование топлива (RESERVE / COMMIT / RELEASE).
+//
+// "RESERVE n ttl_ms" сразу снимает до n единиц с хранилища и откладывает их под номером
+// резерва: клиент узнает, есть ли топливо, заранее, а забирает его позже командой COMMIT.
+// Незабранный резерв через ttl_ms возвращается в хранилище сам. Сроки отслеживает колесо
+// таймеров с тактом RESERVE_TICK_MS, которое проворачивает поток ReservationThread.
+//
+// Отложенные единицы занимают место в хранилище: производитель считает хранилище полным,
+// когда хранимое вместе с отложенным (Depot::reserved) достигает емкости (DepotFull),
+// поэтому возврат резерва всегда помещается обратно. Резервы есть только у склада по умолчанию.
+const int RESERVE_TICK_MS = 10;
+const int RESERVE_WHEEL_SLOTS = 512; // Один оборот - 5,12 с
+const int MAX_RESERVE_TTL_MS = 60000;
+
+struct Reservation
+{
+    int count;
+    int marks[MAX_BATCH];
+};
+
+pthread_mutex_t reservations_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::map<long, Reservation> reservations;
+TimerWheel<RESERVE_WHEEL_SLOTS> reservation_wheel;
+long next_reservation_id = 1;
+std::atomic<long> reservations_committed(0);
+std::atomic<long> reservations_released(0);
+std::atomic<long> reservations_expired(0);
+std::atomic<long> reserved_dropped(0); // Единицы, не поместившиеся обратно (шард заполнен)
+
+static uint64_t ReservationTick()
+{
+    return (NowMs() - start_time_ms) / RESERVE_TICK_MS;
+}
+
+
+// Резервирование до n единиц на ttl_ms. Возвращает номер резерва и марки в *res,
+// или -1, если хранилище пусто
+static long ReserveFuel(int n, int ttl_ms, Reservation *res)
+{
+    // Место учитывается до извлечения: иначе производитель успел бы занять его,
+    // и возврат резерва не поместился бы
+    DefaultDepot()->reserved.fetch_add(n);
+    res->count = 0;
+    while (res->count < n)
+    {
+        int fuel = StoragePop();
+        if (fuel < 0)
+            break;
+        res->marks[res->count++] = fuel;
+    }
+    DefaultDepot()->reserved.fetch_sub(n - res->count);
+    if (res->count == 0)
+        return -1;
+
+    pthread_mutex_lock(&reservations_mutex);
+    long id = next_reservation_id++;
+    reservations[id] = *res;
+    reservation_wheel.Schedule(ReservationTick() + (ttl_ms + RESERVE_TICK_MS - 1) / RESERVE_TICK_MS, id);
+    pthread_mutex_unlock(&reservations_mutex);
+    return id;
+}
+
+// Снятие резерва из таблицы. false, если резерва нет (забран, возвращен или истек)
+static bool TakeReservation(long id, Reservation *res)
+{
+    pthread_mutex_lock(&reservations_mutex);
+    std::map<long, Reservation>::iterator it = reservations.find(id);
+    bool found = it != reservations.end();
+    if (found)
+    {
+        *res = it->second;
+        reservations.erase(it);
+    }
+    pthread_mutex_unlock(&reservations_mutex);
+    return found;
+}
+
+// Возврат единиц резерва в хранилище
+static void ReturnReservation(const Reservation &res)
+{
+    for (int i = 0; i < res.count; i++)
+    {
+        if (!StoragePush(res.marks[i]))
+            reserved_dropped.fetch_add(1);
+    }
+    DefaultDepot()->reserved.fetch_sub(res.count);
+    NotifyFuelAvailable();
+    WakeSubscribers();
+}
+
+// Поток сроков резервов: раз в такт проворачивает колесо и возвращает истекшие резервы
+void *ReservationThread(void *arg)
+{
+    std::vector<long> expired;
+    std::vector<Reservation> returned;
+    while (run_flag)
+    {
+        usleep(RESERVE_TICK_MS * 1000);
+
+        pthread_mutex_lock(&reservations_mutex);
+        reservation_wheel.Advance(ReservationTick(), expired);
+        for (size_t i = 0; i < expired.size(); i++)
+        {
+            std::map<long, Reservation>::iterator it = reservations.find(expired[i]);
+            if (it == reservations.end())
+                continue; // Уже забран или возвращен
+            returned.push_back(it->second);
+            reservations.erase(it);
+        }
+        pthread_mutex_unlock(&reservations_mutex);
+        expired.clear();
+
+        for (size_t i = 0; i < returned.size(); i++)
+        {
+            ReturnReservation(returned[i]);
+            reservations_expired.fetch_add(1);
+        }
+        returned.clear();
+    }
+
+    // При остановке незабранное топливо возвращается в хранилище (и в журнал)
+    pthread_mutex_lock(&reservations_mutex);
+    for (std::map<long, Reservation>::iterator it = reservations.begin(); it != reservations.end(); ++it)
+    {
+        returned.push_back(it->second);
+    }
+    reservations.clear();
+    pthread_mutex_unlock(&reservations_mutex);
+    for (size_t i = 0; i < returned.size(); i++)
+    {
+        ReturnReservation(returned[i]);
+    }
+    return NULL;
+}
+
+// Марки резерва в ответ: " m1 m2 ... mk\n"
+static void AppendMarks(std::string &out, const Reservation &res)
+{
+    char buffer[16];
+    for (int i = 0; i < res.count; i++)
+    {
+        snprintf(buffer, sizeof(buffer), " %d", res.marks[i]);
+        out += buffer;
+    }
+    out += '\n';
+}
+
+// Ответ на STATS: метрики всех потоков одной строкой JSON
+static void AppendStats(std::string &out)
+{
+    uint64_t commands[STATS_MAX_COMMANDS];
+    LatencyHistogram service;
+    LatencyHistogram lock_wait;
+    MergeStats(commands, &service, &lock_wait);
+
+    char buffer[128];
+    snprintf(buffer, sizeof(buffer), "{\"uptime_ms\":%lld,\"connections\":{\"active\":%d,\"total\":%ld,\"rejected\":%ld,\"subscribers\":%d},\"commands\":{",
+             NowMs() - start_time_ms, active_connections.load(), total_connections.load(),
+             rejected_connections.load(), subscriber_count.load());
+    out += buffer;
+    for (int i = 0; i < CMD_COUNT; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s\"%s\":%llu", i ? "," : "", command_names[i],
+                 (unsigned long long)commands[i]);
+        out += buffer;
+    }
+
+    out += "},\"service_ns\":";
+    service.AppendJson(out);
+    out += ",\"lock_wait_ns\":";
+    lock_wait.AppendJson(out);
+
+    // Выборки глубины от старой к новой
+    snprintf(buffer, sizeof(buffer), ",\"depth\":{\"current\":%d,\"capacity\":%d,\"interval_ms\":%d,\"samples\":[",
+             StorageSize(), DefaultDepot()->capacity, DEPTH_INTERVAL_MS);
+    out += buffer;
+    long taken = depth_taken.load();
+    long first = taken > DEPTH_SAMPLES ? taken - DEPTH_SAMPLES : 0;
+    for (long i = first; i < taken; i++)
+    {
+        snprintf(buffer, sizeof(buffer), "%s%d", i > first ? "," : "", depth_history[i % DEPTH_SAMPLES].load());
+        out += buffer;
+    }
+    Depot *depot = DefaultDepot();
+    snprintf(buffer, sizeof(buffer), "]},\"producer\":{\"rate\":%g,\"burst\":%d,\"produced\":%ld,\"full_waits\":%ld}",
+             depot->produce_rate, depot->produce_burst, depot->produced_units.load(),
+             depot->producer_full_waits.load());
+    out += buffer;
+
+    // Все склады, включая склад по умолчанию
+    out += ",\"depots\":{";
+    for (int i = 0; i < depot_count; i++)
+    {
+        depot = &depots[i];
+        out += i ? ",\"" : "\"";
+        out += depot->name;
+        snprintf(buffer, sizeof(buffer), "\":{\"size\":%d,\"capacity\":%d,\"rate\":%g,",
+                 DepotSize(depot), depot->capacity, depot->produce_rate);
+        out += buffer;
+        snprintf(buffer, sizeof(buffer), "\"produced\":%ld,\"full_waits\":%ld}",
+                 depot->produced_units.load(), depot->producer_full_waits.load());
+        out += buffer;
+    }
+    out += "}";
+    pthread_mutex_lock(&reservations_mutex);
+    size_t active_reservations = reservations.size();
+    pthread_mutex_unlock(&reservations_mutex);
+    snprintf(buffer, sizeof(buffer), ",\"reservations\":{\"active\":%zu,\"units\":%d,\"committed\":%ld,",
+             active_reservations, DefaultDepot()->reserved.load(), reservations_committed.load());
+    out += buffer;
+    snprintf(buffer, sizeof(buffer), "\"released\":%ld,\"expired\":%ld,\"dropped\":%ld}",
+             reservations_released.load(), reservations_expired.load(), reserved_dropped.load());
+    out += buffer;
+#ifdef __linux__
+    // Системные вызовы ввода-вывода циклов epoll и io_uring
+    snprintf(buffer, sizeof(buffer), ",\"io\":{\"syscalls\":%llu}", (unsigned long long)LoopSyscalls());
+    out += buffer;
+#endif
+    snprintf(buffer, sizeof(buffer), ",\"log_dropped\":%llu}\n", (unsigned long long)LogDropped());
+    out += buffer;
+}
+
+// Подписчик: сокет и состояние на момент последнего отправленного события
+struct Subscriber
+{
+    int fd;
+    SubscribeRequest request;
+    long long last_sent; // мс
+    long last_added;     // produced_units в последнем событии; -1 - событий еще не было
+    int last_size;       // Размер в последнем событии
+    bool closed;
+    std::string backlog; // Еще не отправленные данные (сокет клиента был заполнен)
+};
+
+// Подписчики, переданные обслуживающими потоками и еще не принятые потоком подписок
+pthread_mutex_t subscribers_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::vector<Subscriber> new_subscribers;
+
+// Передача соединения потоку подписок. pending - ответы на команды до SUBSCRIBE,
+// которые обслуживающий поток еще не отправил. Соединение остается открытым
+static void AddSubscriber(int fd, const SubscribeRequest &request, const std::string &pending)
+{
+    Subscriber sub;
+    sub.fd = fd;
+    sub.request = request;
+    sub.last_sent = 0;
+    sub.last_added = -1;
+    sub.last_size = 0;
+    sub.closed = false;
+    sub.backlog = pending + "OK\n";
+
+    pthread_mutex_lock(&subscribers_mutex);
+    new_subscribers.push_back(sub);
+    pthread_mutex_unlock(&subscribers_mutex);
+    subscriber_count.fetch_add(1);
+    WakeSubscribers();
+}
+
+// Событие для подписчика, если есть что сообщить и прошел интервал
+static void QueueSubscriberEvent(Subscriber &sub, long long now, int size, long added)
+{
+    bool above = size >= sub.request.threshold;
+    bool changed = sub.last_added < 0 || added != sub.last_added || size != sub.last_size;
+    if (!changed || now - sub.last_sent < sub.request.interval_ms || !sub.backlog.empty())
+        return;
+
+    char line[64];
+    snprintf(line, sizeof(line), "INV %d %ld %s\n", size, sub.last_added < 0 ? 0 : added - sub.last_added,
+             above ? "above" : "below");
+    sub.backlog += line;
+    sub.last_sent = now;
+    sub.last_added = added;
+    sub.last_size = size;
+}
+
+// Время до ближайшего события, которое ждет конца интервала; -1 - таких нет
+static int NextSubscriberTimeout(const std::vector<Subscriber> &subs, long long now, int size, long added)
+{
+    int timeout = -1;
+    for (size_t i = 0; i < subs.size(); i++)
+    {
+        const Subscriber &sub = subs[i];
+        if (sub.last_added >= 0 && added == sub.last_added && size == sub.last_size)
+            continue;
+        long long left = sub.last_sent + sub.request.interval_ms - now;
+        if (left < 0)
+            left = 0;
+        if (timeout < 0 || left < timeout)
+            timeout = left;
+    }
+    return timeout;
+}
+
+// Поток подписок
+void *SubscriptionThread(void *arg)
+{
+    std::vector<Subscriber> subs;
+    std::vector<struct pollfd> fds;
+    while (run_flag)
+    {
+        int timeout = NextSubscriberTimeout(subs, NowMs(), StorageSize(), DefaultDepot()->produced_units.load());
+        if (timeout < 0 || timeout > 1000)
+            timeout = 1000; // Периодическая проверка run_flag
+
+        fds.resize(subs.size() + 1);
+        fds[0].fd = subscriber_pipe[0];
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < subs.size(); i++)
+        {
+            fds[i + 1].fd = subs[i].fd;
+            fds[i + 1].events = POLLIN | (subs[i].backlog.empty() ? 0 : POLLOUT);
+            fds[i + 1].revents = 0;
+        }
+        if (poll(&fds[0], fds.size(), timeout) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            break;
+        }
+
+        // Сначала сбрасываем флаг, затем читаем состояние: изменение после чтения разбудит снова
+        char drain[64];
+        while (read(subscriber_pipe[0], drain, sizeof(drain)) > 0)
+        {
+        }
+        subscriber_wake_pending.store(false);
+
+        // Подписчик не присылает команд: данные игнорируются, конец потока - отписка
+        for (size_t i = 0; i < subs.size(); i++)
+        {
+            if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t n = recv(subs[i].fd, drain, sizeof(drain), MSG_DONTWAIT);
+                if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+                    subs[i].closed = true;
+            }
+        }
+
+        pthread_mutex_lock(&subscribers_mutex);
+        subs.insert(subs.end(), new_subscribers.begin(), new_subscribers.end());
+        new_subscribers.clear();
+        pthread_mutex_unlock(&subscribers_mutex);
+
+        long long now = NowMs();
+        int size = StorageSize();
+        long added = DefaultDepot()->produced_units.load();
+        for (size_t i = 0; i < subs.size(); i++)
+        {
+            Subscriber &sub = subs[i];
+            if (sub.closed)
+                continue;
+            QueueSubscriberEvent(sub, now, size, added);
+            if (sub.backlog.empty())
+                continue;
+            ssize_t n = send(sub.fd, sub.backlog.data(), sub.backlog.size(), MSG_DONTWAIT);
+            if (n > 0)
+                sub.backlog.erase(0, n);
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                sub.closed = true;
+        }
+
+        for (size_t i = 0; i < subs.size();)
+        {
+            if (!subs[i].closed)
+            {
+                i++;
+                continue;
+            }
+            close(subs[i].fd);
+            subs[i] = subs.back();
+            subs.pop_back();
+            subscriber_count.fetch_sub(1);
+            active_connections.fetch_sub(1);
+        }
+    }
+
+    for (size_t i = 0; i < subs.size(); i++)
+    {
+        close(subs[i].fd);
+    }
+    return NULL;
+}
+
+// Результат ProcessInput: соединение выполнило SUBSCRIBE и передается потоку подписок
+const int INPUT_SUBSCRIBED = -1;
+
+// Максимальная длина строки запроса
+const size_t MAX_LINE = 256;
+
+// Единица, выданная клиенту текущим запросом
+struct DispensedUnit
+{
+    Depot *depot;
+    int mark;
+};
+
+// Список выдачи текущего запроса. Его ведут только потоки ячеек разделяемой памяти:
+// там клиент может отменить запрос по тайм-ауту, и выданное нужно вернуть (ShmSlotThread).
+// Резервы сюда не попадают - незабранный резерв и так вернется по сроку
+static __thread std::vector<DispensedUnit> *dispensed_units = NULL;
+
+static void NoteDispensed(Depot *depot, int mark)
+{
+    if (dispensed_units != NULL && mark > 0)
+    {
+        DispensedUnit unit = {depot, mark};
+        dispensed_units->push_back(unit);
+    }
+}
+
+// Выполнение одной команды протокола (строка без '\n')
+// Ответ вместе с завершающим '\n' добавляется в out.
+// Если can_block == false и POPWAIT должен ждать, ответ не формируется,
+// а возвращается время ожидания в мс - вызывающий цикл событий сам отложит запрос.
+// SUBSCRIBE заполняет *subscribe и возвращает INPUT_SUBSCRIBED; subscribe == NULL -
+// транспорт без сокета (разделяемая память), подписка невозможна.
+int ExecuteCommand(const char *line, std::string &out, bool can_block, SubscribeRequest *subscribe)
+{
+    uint64_t start = NowNs();
+    ThreadStats *stats = LocalStats();
+    char cmd[16];
+    long value = 0; // Номер резерва (COMMIT, RELEASE) целиком, он может превысить int
+    int nargs = sscanf(line, "%15s %ld", cmd, &value);
+    int arg = value > INT_MAX ? INT_MAX : value < INT_MIN ? INT_MIN : (int)value;
+    char response[32];
+
+    // "POP имя [n]" и "SIZE имя" - запрос к именованному складу (имя начинается с буквы)
+    Depot *depot = DefaultDepot();
+    char depot_name[DEPOT_NAME_LEN];
+    if (nargs == 1 && (strcmp(cmd, "POP") == 0 || strcmp(cmd, "SIZE") == 0) &&
+        sscanf(line, "%*s %31s", depot_name) == 1)
+    {
+        depot = FindDepot(depot_name);
+        if (depot == NULL)
+        {
+            stats->Count(CMD_UNKNOWN);
+            out += "ERR unknown depot\n";
+            stats->service.Record(NowNs() - start);
+            return 0;
+        }
+        nargs = sscanf(line, "%*s %*s %d", &arg) == 1 ? 2 : 1;
+    }
+
+    if (nargs == 1 && strcmp(cmd, "POP") == 0)
+    {
+        stats->Count(CMD_POP);
+        int fuel = DepotPop(depot);
+        if (fuel > 0)
+        {
+            NoteDispensed(depot, fuel);
+            LogEvent(LOG_LEVEL_INFO, EV_DISPENSED, fuel, DepotSize(depot));
+        }
+        else
+        {
+            LogEvent(LOG_LEVEL_INFO, EV_EMPTY);
+        }
+
+        snprintf(response, sizeof(response), "%d\n", fuel);
+        out += response;
+    }
+    else if (nargs == 2 && strcmp(cmd, "POP") == 0)
+    {
+        // Пакетная выдача: "POP n" -> "k m1 m2 ... mk", k <= n
+        stats->Count(CMD_POP_BATCH);
+        if (arg < 0)
+            arg = 0;
+        if (arg > MAX_BATCH)
+            arg = MAX_BATCH;
+
+        int marks[MAX_BATCH];
+        int count = 0;
+        while (count < arg)
+        {
+            int fuel = DepotPop(depot);
+            if (fuel < 0)
+                break;
+            NoteDispensed(depot, fuel);
+            marks[count++] = fuel;
+        }
+        LogEvent(LOG_LEVEL_INFO, EV_BATCH, count, arg, DepotSize(depot));
+
+        snprintf(response, sizeof(response), "%d", count);
+        out += response;
+        for (int i = 0; i < count; i++)
+        {
+            snprintf(response, sizeof(response), " %d", marks[i]);
+            out += response;
+        }
+        out += '\n';
+    }
+    else if (nargs == 2 && strcmp(cmd, "POPWAIT") == 0)
+    {
+        // Долгий опрос: "POPWAIT ms" -> марка или -1, если за ms топливо не появилось
+        // Время обслуживания отложенного запроса учитывает цикл событий при ответе
+        stats->Count(CMD_POPWAIT);
+        if (arg < 0)
+            arg = 0;
+        if (arg > MAX_WAIT_MS)
+            arg = MAX_WAIT_MS;
+
+        int fuel = StoragePop();
+        if (fuel < 0 && arg > 0)
+        {
+            if (!can_block)
+                return arg;
+            fuel = StoragePopWait(arg);
+        }
+        if (fuel > 0)
+        {
+            NoteDispensed(DefaultDepot(), fuel);
+            LogEvent(LOG_LEVEL_INFO, EV_DISPENSED, fuel, StorageSize());
+        }
+
+        snprintf(response, sizeof(response), "%d\n", fuel);
+        out += response;
+    }
+    else if ((nargs == 2 && (strcmp(cmd, "POPMIN") == 0 || strcmp(cmd, "POPEXACT") == 0)) ||
+             (nargs == 1 && strcmp(cmd, "POPMAX") == 0))
+    {
+        // Выдача по марке: "POPMIN x" - марка не ниже x, "POPMAX" - самая высокая,
+        // "POPEXACT x" - ровно x. Ответ - марка или -1, как у POP
+        GradeQuery query = GRADE_MAX;
+        int command = CMD_POPMAX;
+        if (strcmp(cmd, "POPMIN") == 0)
+        {
+            query = GRADE_MIN;
+            command = CMD_POPMIN;
+        }
+        else if (strcmp(cmd, "POPEXACT") == 0)
+        {
+            query = GRADE_EXACT;
+            command = CMD_POPEXACT;
+        }
+        stats->Count(command);
+
+        if (!GradedBackend(storage_backend))
+        {
+            out += "ERR grade queries need -s grade or -s priority\n";
+        }
+        else
+        {
+            int fuel = StoragePopGrade(query, arg);
+            NoteDispensed(DefaultDepot(), fuel);
+            if (fuel > 0)
+                LogEvent(LOG_LEVEL_INFO, EV_DISPENSED, fuel, StorageSize());
+            else
+                LogEvent(LOG_LEVEL_INFO, EV_EMPTY);
+            snprintf(response, sizeof(response), "%d\n", fuel);
+            out += response;
+        }
+    }
+    else if (nargs == 1 && strcmp(cmd, "SIZE") == 0)
+    {
+        stats->Count(CMD_SIZE);
+        snprintf(response, sizeof(response), "%d\n", DepotSize(depot));
+        out += response;
+    }
+    else if (nargs == 1 && strcmp(cmd, "STATS") == 0)
+    {
+        stats->Count(CMD_STATS);
+        AppendStats(out);
+    }
+    else if (strcmp(cmd, "RESERVE") == 0)
+    {
+        // "RESERVE n ttl_ms" -> "id k m1 ... mk" или -1, если хранилище пусто
+        stats->Count(CMD_RESERVE);
+        int ttl_ms = 0;
+        if (sscanf(line, "%*s %d %d", &arg, &ttl_ms) != 2 || arg < 1 || ttl_ms < 1)
+        {
+            out += "ERR usage: RESERVE n ttl_ms\n";
+        }
+        else
+        {
+            if (arg > MAX_BATCH)
+                arg = MAX_BATCH;
+            if (ttl_ms > MAX_RESERVE_TTL_MS)
+                ttl_ms = MAX_RESERVE_TTL_MS;
+            Reservation res;
+            long id = ReserveFuel(arg, ttl_ms, &res);
+            if (id < 0)
+            {
+                out += "-1\n";
+            }
+            else
+            {
+                snprintf(response, sizeof(response), "%ld %d", id, res.count);
+                out += response;
+                AppendMarks(out, res);
+            }
+        }
+    }
+    else if (nargs == 2 && strcmp(cmd, "COMMIT") == 0)
+    {
+        // "COMMIT id" -> "k m1 ... mk", как у "POP n"; -1, если резерва уже нет
+        stats->Count(CMD_COMMIT);
+        Reservation res;
+        if (!TakeReservation(value, &res))
+        {
+            out += "-1\n";
+        }
+        else
+        {
+            DefaultDepot()->reserved.fetch_sub(res.count);
+            reservations_committed.fetch_add(1);
+            WakeProducer(DefaultDepot());
+            for (int i = 0; i < res.count; i++)
+            {
+                NoteDispensed(DefaultDepot(), res.marks[i]);
+            }
+            LogEvent(LOG_LEVEL_INFO, EV_BATCH, res.count, res.count, StorageSize());
+            snprintf(response, sizeof(response), "%d", res.count);
+            out += response;
+            AppendMarks(out, res);
+        }
+    }
+    else if (nargs == 2 && strcmp(cmd, "RELEASE") == 0)
+    {
+        // "RELEASE id" -> "OK" (топливо вернулось в хранилище) или -1
+        stats->Count(CMD_RELEASE);
+        Reservation res;
+        if (!TakeReservation(value, &res))
+        {
+            out += "-1\n";
+        }
+        else
+        {
+            ReturnReservation(res);
+            reservations_released.fetch_add(1);
+            out += "OK\n";
+        }
+    }
+    else if (strcmp(cmd, "SUBSCRIBE") == 0)
+    {
+        // "SUBSCRIBE [интервал_мс [порог]]" -> "OK", затем поток событий "INV ..."
+        stats->Count(CMD_SUBSCRIBE);
+        if (subscribe == NULL)
+        {
+            out += "ERR SUBSCRIBE needs a socket connection\n";
+        }
+        else
+        {
+            subscribe->interval_ms = SUBSCRIBE_DEFAULT_INTERVAL_MS;
+            subscribe->threshold = 1;
+            sscanf(line, "%*s %d %d", &subscribe->interval_ms, &subscribe->threshold);
+            if (subscribe->interval_ms < 1)
+                subscribe->interval_ms = 1;
+            if (subscribe->interval_ms > SUBSCRIBE_MAX_INTERVAL_MS)
+                subscribe->interval_ms = SUBSCRIBE_MAX_INTERVAL_MS;
+            stats->service.Record(NowNs() - start);
+            return INPUT_SUBSCRIBED;
+        }
+    }
+    else
+    {
+        stats->Count(CMD_UNKNOWN);
+        out += "ERR unknown command\n";
+    }
+    stats->service.Record(NowNs() - start);
+    return 0;
+}
+
+// Разбор накопленных запросов. Каждая команда завершается '\n',
+// поэтому несколько запросов в одном пакете ("POP\nPOP\n") выполняются по очереди.
+// Обработанные байты удаляются из буфера, неполная строка остается до следующего чтения.
+// Возвращает время ожидания POPWAIT (мс), если обработка остановилась на нем,
+// INPUT_SUBSCRIBED после SUBSCRIBE (остаток ввода не выполняется), иначе 0.
+int ProcessInput(char *in, size_t *in_len, std::string &out, bool can_block, SubscribeRequest *subscribe)
+{
+    size_t pos = 0;
+    int wait_ms = 0;
+    while (pos < *in_len && wait_ms == 0)
+    {
+        char *line = in + pos;
+        char *eol = (char *)memchr(line, '\n', *in_len - pos);
+        if (eol == NULL)
+            break;
+
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r')
+            eol[-1] = '\0';
+        if (line[0] != '\0')
+            wait_ms = ExecuteCommand(line, out, can_block, subscribe);
+        pos = eol - in + 1;
+    }
+
+    // Слишком длинная строка без разделителя не может быть командой
+    if (pos == 0 && *in_len >= MAX_LINE)
+    {
+        out += "ERR line too long\n";
+        *in_len = 0;
+        return 0;
+    }
+
+    memmove(in, in + pos, *in_len - pos);
+    *in_len -= pos;
+    return wait_ms;
+}
+
+// Запись всего буфера в блокирующий сокет
+static bool WriteAll(int fd, const char *data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Обслуживание соединения в блокирующем режиме до его закрытия.
+// Буферы передаются снаружи, чтобы рабочие потоки пула использовали их повторно
+static void ServeConnection(int client_socket, char *buffer, std::string &response)
+{
+    size_t buffer_len = 0;
+    ssize_t n;
+    response.clear();
+
+    while ((n = read(client_socket, buffer + buffer_len, MAX_LINE - buffer_len)) > 0 && run_flag)
+    {
+        buffer_len += n;
+        SubscribeRequest subscribe;
+        if (ProcessInput(buffer, &buffer_len, response, true, &subscribe) == INPUT_SUBSCRIBED)
+        {
+            // Соединение вместе с неотправленными ответами переходит к потоку подписок
+            AddSubscriber(client_socket, subscribe, response);
+            response.clear();
+            return;
+        }
+
+        // Отправляем ответы на все полученные запросы одной записью
+        if (!response.empty())
+        {
+            if (!WriteAll(client_socket, response.data(), response.size()))
+                break;
+            response.clear();
+        }
+    }
+
+    close(client_socket);
+    active_connections.fetch_sub(1);
+}
+
+// Функция для обработки клиентских запросов
+void *HandleClient(void *arg)
+{
+    int client_socket = *((int *)arg);
+    free(arg);
+
+    char buffer[MAX_LINE];
+    std::string response;
+    ServeConnection(client_socket, buffer, response);
+    return NULL;
+}
+
+// Ограниченная очередь принятых соединений для пула рабочих потоков
+struct ConnectionQueue
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    int *fds;
+    int capacity; // Соединений, ожидающих рабочего потока
+    int slots;    // Размер массива: capacity плюс по месту на каждый рабочий поток
+    int head;
+    int count;
+    int idle;     // Рабочие потоки, ждущие соединения
+};
+
+ConnectionQueue pool_queue;
+
+static void InitConnectionQueue(ConnectionQueue *queue, int capacity, int workers)
+{
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->slots = capacity + workers;
+    queue->fds = new int[queue->slots];
+    queue->capacity = capacity;
+    queue->head = 0;
+    queue->count = 0;
+    queue->idle = 0;
+}
+
+// Есть ли место: соединения, которые сразу заберут свободные рабочие потоки, не считаются
+// ожидающими, даже если потоки еще не успели проснуться
+static bool HasRoom(ConnectionQueue *queue)
+{
+    return queue->count - queue->idle < queue->capacity;
+}
+
+// Постановка соединения в очередь. Если очередь заполнена, при wait == true ждем
+// освобождения места (новые соединения копятся в очереди listen ядра), иначе возвращаем false
+static bool EnqueueConnection(ConnectionQueue *queue, int fd, bool wait)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while (!HasRoom(queue) && wait && run_flag)
+    {
+        pthread_cond_wait(&queue->not_full, &queue->mutex);
+    }
+    bool queued = HasRoom(queue);
+    if (queued)
+    {
+        queue->fds[(queue->head + queue->count) % queue->slots] = fd;
+        queue->count++;
+        pthread_cond_signal(&queue->not_empty);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return queued;
+}
+
+// Извлечение соединения; -1 при остановке сервера
+static int DequeueConnection(ConnectionQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->idle++;
+    while (queue->count == 0 && run_flag)
+    {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    queue->idle--;
+    int fd = -1;
+    if (queue->count > 0)
+    {
+        fd = queue->fds[queue->head];
+        queue->head = (queue->head + 1) % queue->slots;
+        queue->count--;
+        pthread_cond_signal(&queue->not_full);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return fd;
+}
+
+// Рабочий поток пула: обслуживает соединения из очереди одно за другим,
+// буферы чтения и ответа выделяются один раз на весь срок жизни потока
+void *PoolWorkerThread(void *arg)
+{
+    char buffer[MAX_LINE];
+    std::string response;
+    response.reserve(1024);
+
+    int client_socket;
+    while ((client_socket = DequeueConnection(&pool_queue)) >= 0)
+    {
+        ServeConnection(client_socket, buffer, response);
+    }
+    return NULL;
+}
+
+// Отказ в обслуживании при переполненной очереди
+static void RejectConnection(int fd)
+{
+    const char busy[] = "ERR server busy\n";
+    write(fd, busy, sizeof(busy) - 1);
+    close(fd);
+    active_connections.fetch_sub(1);
+    rejected_connections.fetch_add(1);
+}
+
+#ifdef __linux__
+struct EventLoop;
+
+// Состояние соединения в режиме epoll: буферы чтения и записи
+struct Connection
+{
+    int fd;
+    char in[MAX_LINE];
+    size_t in_len;
+    std::string out;
+    bool peer_closed;    // Клиент закрыл свою сторону соединения
+    bool parked;         // Соединение ждет топливо по POPWAIT
+    long long deadline;  // Момент окончания ожидания, мс
+    uint64_t parked_at;  // Момент получения POPWAIT, нс (для времени обслуживания)
+    bool subscribed;     // Выполнен SUBSCRIBE: соединение передается потоку подписок
+    SubscribeRequest subscribe;
+};
+
+// Цикл событий: свой epoll, eventfd для пробуждения производителем
+// и очередь соединений, отложенных командой POPWAIT
+struct EventLoop
+{
+    int epfd;
+    int wake_fd;
+    int listen_fd; // Свой слушающий сокет в режиме reuseport, иначе -1
+    std::atomic<int> parked_count;
+    std::list<Connection *> parked;
+    std::atomic<uint64_t> syscalls; // epoll_wait, accept, read, write, close; пишет только поток цикла
+};
+
+EventLoop *loops = NULL;
+std::atomic<unsigned> next_loop(0); // Соединения принимают потоки TCP и сокета Unix
+
+// Учет системного вызова потоком цикла (один писатель, атомарная операция не нужна)
+static inline void CountSyscall(std::atomic<uint64_t> &counter)
+{
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+static void WakeUringLoops();
+
+// Перевод сокета в неблокирующий режим
+static int SetNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags < 0)
+        return -1;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+// Пробуждение циклов, в которых есть ожидающие POPWAIT
+static void WakeEventLoops()
+{
+    // Парный барьер к увеличению parked_count в Park(): либо цикл увидит
+    // новую единицу при повторной проверке, либо производитель увидит ожидающего
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for (int i = 0; loops != NULL && i < loop_count; i++)
+    {
+        if (loops[i].parked_count.load() > 0)
+        {
+            uint64_t one = 1;
+            write(loops[i].wake_fd, &one, sizeof(one));
+        }
+    }
+    WakeUringLoops();
+}
+
+// Отправка накопленных ответов. Возвращает false при ошибке сокета
+static bool FlushOutput(EventLoop *loop, Connection *conn)
+{
+    while (!conn->out.empty())
+    {
+        ssize_t n = write(conn->fd, conn->out.data(), conn->out.size());
+        CountSyscall(loop->syscalls);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return true; // Допишем по событию EPOLLOUT
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        conn->out.erase(0, n);
+    }
+    return true;
+}
+
+// Откладывание соединения до появления топлива или до тайм-аута
+static void Park(EventLoop *loop, Connection *conn, int wait_ms)
+{
+    conn->parked = true;
+    conn->deadline = NowMs() + wait_ms;
+    conn->parked_at = NowNs();
+    loop->parked.push_back(conn);
+    loop->parked_count.fetch_add(1);
+}
+
+// Выполнение накопленных команд; останавливается на POPWAIT при пустом хранилище
+static void Advance(EventLoop *loop, Connection *conn)
+{
+    int wait_ms = ProcessInput(conn->in, &conn->in_len, conn->out, false, &conn->subscribe);
+    if (wait_ms > 0)
+        Park(loop, conn, wait_ms);
+    else if (wait_ms == INPUT_SUBSCRIBED)
+        conn->subscribed = true;
+}
+
+// Чтение всех доступных данных (edge-triggered). Возвращает false при ошибке сокета.
+// Отложенное соединение не читается: остаток данных будет прочитан после ответа на POPWAIT
+static bool ReadInput(EventLoop *loop, Connection *conn)
+{
+    while (!conn->parked && !conn->peer_closed && !conn->subscribed)
+    {
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, sizeof(conn->in) - conn->in_len);
+        CountSyscall(loop->syscalls);
+        if (n > 0)
+        {
+            conn->in_len += n;
+            Advance(loop, conn);
+            continue;
+        }
+        if (n == 0)
+            conn->peer_closed = true;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return true;
+        else if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+// Соединение можно закрыть, когда клиент ушел и все ответы отправлены
+static bool Finished(Connection *conn)
+{
+    return conn->peer_closed && !conn->parked && conn->out.empty();
+}
+
+// Передача соединения после SUBSCRIBE потоку подписок: цикл перестает его обслуживать,
+// неотправленные ответы дописывает поток подписок
+static void HandOffSubscriber(EventLoop *loop, Connection *conn)
+{
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    AddSubscriber(conn->fd, conn->subscribe, conn->out);
+    delete conn;
+}
+
+static void CloseConnection(EventLoop *loop, Connection *conn)
+{
+    if (conn->parked)
+    {
+        loop->parked.remove(conn);
+        loop->parked_count.fetch_sub(1);
+    }
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    CountSyscall(loop->syscalls);
+    delete conn;
+    active_connections.fetch_sub(1);
+}
+
+// Ответ отложенным соединениям: по порядку ожидания, пока есть топливо,
+// и значением -1 тем, у кого истек тайм-аут
+static void ServeParked(EventLoop *loop)
+{
+    long long now = NowMs();
+    bool empty = false;
+    std::list<Connection *>::iterator it = loop->parked.begin();
+    while (it != loop->parked.end())
+    {
+        Connection *conn = *it;
+        int fuel = empty ? -1 : StoragePop();
+        if (fuel < 0)
+        {
+            empty = true;
+            if (now < conn->deadline)
+            {
+                ++it;
+                continue;
+            }
+        }
+
+        it = loop->parked.erase(it);
+        loop->parked_count.fetch_sub(1);
+        conn->parked = false;
+
+        if (fuel > 0)
+        {
+            LogEvent(LOG_LEVEL_INFO, EV_DISPENSED, fuel, StorageSize());
+        }
+        char response[32];
+        snprintf(response, sizeof(response), "%d\n", fuel);
+        conn->out += response;
+        LocalStats()->service.Record(NowNs() - conn->parked_at);
+
+        // Продолжаем конвейер: команды после POPWAIT и непрочитанные данные
+        Advance(loop, conn);
+        bool alive = ReadInput(loop, conn) && FlushOutput(loop, conn);
+        if (alive && conn->subscribed)
+            HandOffSubscriber(loop, conn);
+        else if (!alive || Finished(conn))
+            CloseConnection(loop, conn);
+    }
+}
+
+// Время до ближайшего тайм-аута POPWAIT (не больше секунды)
+static int NextTimeout(EventLoop *loop)
+{
+    int timeout = 1000;
+    long long now = NowMs();
+    for (std::list<Connection *>::iterator it = loop->parked.begin(); it != loop->parked.end(); ++it)
+    {
+        long long left = (*it)->deadline - now;
+        if (left < 0)
+            left = 0;
+        if (left < timeout)
+            timeout = left;
+    }
+    return timeout;
+}
+
+static bool AddToLoop(EventLoop *loop, int client_socket);
+
+// Прием всех ожидающих соединений со своего слушающего сокета (режим reuseport).
+// Входящие соединения между сокетами SO_REUSEPORT распределяет ядро по хешу адресов,
+// поэтому циклы принимают соединения параллельно, без общего потока accept()
+static void AcceptConnections(EventLoop *loop)
+{
+    while (true)
+    {
+        int client_fd = accept(loop->listen_fd, NULL, NULL);
+        CountSyscall(loop->syscalls);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept");
+            return;
+        }
+
+        LogEvent(LOG_LEVEL_INFO, EV_CONNECTED);
+        active_connections.fetch_add(1);
+        total_connections.fetch_add(1);
+        if (!AddToLoop(loop, client_fd))
+        {
+            close(client_fd);
+            active_connections.fetch_sub(1);
+        }
+    }
+}
+
+// Поток цикла событий
+void *EventLoopThread(void *arg)
+{
+    EventLoop *loop = (EventLoop *)arg;
+    struct epoll_event events[64];
+
+    while (run_flag)
+    {
+        int n = epoll_wait(loop->epfd, events, 64, NextTimeout(loop));
+        CountSyscall(loop->syscalls);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++)
+        {
+            // Пробуждение от производителя: отложенные запросы обслуживаются ниже
+            if (events[i].data.ptr == NULL)
+            {
+                uint64_t count;
+                read(loop->wake_fd, &count, sizeof(count));
+                continue;
+            }
+            if (events[i].data.ptr == loop)
+            {
+                AcceptConnections(loop);
+                continue;
+            }
+
+            Connection *conn = (Connection *)events[i].data.ptr;
+            bool alive = !(events[i].events & (EPOLLERR | EPOLLHUP));
+
+            if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP)))
+                alive = ReadInput(loop, conn);
+            if (alive)
+                alive = FlushOutput(loop, conn);
+
+            if (alive && conn->subscribed)
+                HandOffSubscriber(loop, conn);
+            else if (!alive || Finished(conn))
+                CloseConnection(loop, conn);
+        }
+
+        if (!loop->parked.empty())
+            ServeParked(loop);
+    }
+    return NULL;
+}
+
+// Создание цикла событий
+static bool InitEventLoop(EventLoop *loop)
+{
+    loop->epfd = epoll_create1(0);
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK);
+    loop->listen_fd = -1;
+    loop->parked_count.store(0);
+    loop->syscalls.store(0);
+    if (loop->epfd < 0 || loop->wake_fd < 0)
+    {
+        perror("epoll_create1/eventfd");
+        return false;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev) == 0;
+}
+
+// Регистрация нового соединения в цикле событий
+static bool AddToLoop(EventLoop *loop, int client_socket)
+{
+    if (SetNonBlocking(client_socket) < 0)
+    {
+        perror("fcntl");
+        return false;
+    }
+
+    Connection *conn = new Connection;
+    conn->fd = client_socket;
+    conn->in_len = 0;
+    conn->peer_closed = false;
+    conn->parked = false;
+    conn->deadline = 0;
+    conn->parked_at = 0;
+    conn->subscribed = false;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, client_socket, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        delete conn;
+        return false;
+    }
+    return true;
+}
+
+// Передача нового соединения одному из циклов событий (по кругу)
+static bool AddToEventLoop(int client_socket)
+{
+    return AddToLoop(&loops[next_loop.fetch_add(1) % loop_count], client_socket);
+}
+
+// Слушающий сокет цикла в режиме reuseport: регистрируется в epoll цикла,
+// data.ptr = сам цикл отличает его от соединений и eventfd
+static bool AttachListener(EventLoop *loop, int listen_fd)
+{
+    if (SetNonBlocking(listen_fd) < 0)
+    {
+        perror("fcntl");
+        return false;
+    }
+    loop->listen_fd = listen_fd;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = loop;
+    return epoll_ctl(loop->epfd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+}
+
+// Цикл io_uring. Вместо готовности сокетов (epoll) ядру сразу передаются операции:
+//  - прием соединений одним запросом multishot accept на свой сокет SO_REUSEPORT;
+//  - чтение и запись через зарегистрированный буфер (READ_FIXED, WRITE_FIXED): у каждого
+//    соединения своя часть общей области, закрепленной в ядре один раз при запуске;
+//  - запись ответа и следующее чтение отправляются связанной парой (IOSQE_IO_LINK):
+//    ядро начнет чтение, только когда ответ записан;
+//  - все запросы, подготовленные при разборе пачки завершений, отправляются одним
+//    io_uring_enter, который заодно ждет следующих завершений.
+// Отложенные POPWAIT устроены как в цикле epoll; производитель будит цикл через eventfd,
+// чтение которого тоже стоит в кольце.
+const int URING_MAX_CONNECTIONS = 1024; // Соединений на один цикл
+const unsigned URING_ENTRIES = 1024;
+const unsigned URING_CQ_ENTRIES = 4096; // На соединение в ядре не больше двух запросов
+const size_t URING_OUT_SIZE = 4096;     // Часть ответа, передаваемая одной записью
+
+// Операции в user_data: номер соединения << 8 | операция
+enum UringOp
+{
+    URING_ACCEPT,
+    URING_READ,
+    URING_WRITE,
+    URING_WAKE
+};
+
+struct UringConnection
+{
+    int fd;           // -1 - ячейка свободна
+    char *in;         // MAX_LINE байт в зарегистрированном буфере
+    char *out_buf;    // URING_OUT_SIZE байт там же
+    size_t in_len;
+    std::string out;  // Ответы, еще не переданные в out_buf
+    unsigned writing; // Байт out_buf в записи; 0 - записи в ядре нет
+    bool reading;     // Чтение в ядре
+    bool peer_closed;
+    bool failed;      // Ошибка сокета: закрыть, когда ядро вернет все запросы
+    bool parked;
+    long long deadline;
+    uint64_t parked_at;
+    bool subscribed;  // Выполнен SUBSCRIBE: передать потоку подписок, когда запросов в ядре не останется
+    SubscribeRequest subscribe;
+    int next_free;
+};
+
+struct UringLoop
+{
+    UringRing ring;
+    int listen_fd;
+    int wake_fd;
+    uint64_t wake_value;
+    bool multishot; // Ядро принимает multishot accept (5.19+)
+    std::atomic<int> parked_count;
+    std::list<int> parked; // Номера отложенных соединений
+    char *arena;           // Зарегистрированный буфер всех соединений
+    UringConnection *conns;
+    int free_conn;
+    std::atomic<uint64_t> syscalls; // io_uring_enter и close
+};
+
+UringLoop *uring_loops = NULL;
+
+static inline uint64_t UringData(int index, UringOp op)
+{
+    return ((uint64_t)index << 8) | op;
+}
+
+static void WakeUringLoops()
+{
+    for (int i = 0; uring_loops != NULL && i < loop_count; i++)
+    {
+        if (uring_loops[i].parked_count.load() > 0)
+        {
+            uint64_t one = 1;
+            write(uring_loops[i].wake_fd, &one, sizeof(one));
+        }
+    }
+}
+
+// Сумма системных вызовов ввода-вывода всех циклов для STATS
+static uint64_t LoopSyscalls()
+{
+    uint64_t total = 0;
+    for (int i = 0; loops != NULL && i < loop_count; i++)
+    {
+        total += loops[i].syscalls.load(std::memory_order_relaxed);
+    }
+    for (int i = 0; uring_loops != NULL && i < loop_count; i++)
+    {
+        total += uring_loops[i].syscalls.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+// Запись запроса; если кольцо отправки заполнено, накопленное отправляется сразу
+static struct io_uring_sqe *UringSqe(UringLoop *loop)
+{
+    struct io_uring_sqe *sqe = UringGetSqe(&loop->ring);
+    while (sqe == NULL)
+    {
+        UringEnter(&loop->ring, 0, 0);
+        CountSyscall(loop->syscalls);
+        sqe = UringGetSqe(&loop->ring);
+    }
+    return sqe;
+}
+
+static void ArmAccept(UringLoop *loop)
+{
+    UringPrepAccept(UringSqe(loop), loop->listen_fd, loop->multishot, UringData(0, URING_ACCEPT));
+}
+
+static void ArmWake(UringLoop *loop)
+{
+    UringPrepRead(UringSqe(loop), loop->wake_fd, &loop->wake_value, sizeof(loop->wake_value),
+                  UringData(0, URING_WAKE));
+}
+
+// Освобождение ячейки соединения; сокет закрывается, если close_fd
+static void ReleaseUringConnection(UringLoop *loop, int index, bool close_fd)
+{
+    UringConnection *conn = &loop->conns[index];
+    if (conn->parked)
+    {
+        loop->parked.remove(index);
+        loop->parked_count.fetch_sub(1);
+        conn->parked = false;
+    }
+    if (close_fd)
+    {
+        close(conn->fd);
+        CountSyscall(loop->syscalls);
+        active_connections.fetch_sub(1);
+    }
+    conn->fd = -1;
+    conn->out.clear();
+    conn->next_free = loop->free_conn;
+    loop->free_conn = index;
+}
+
+static void CloseUringConnection(UringLoop *loop, int index)
+{
+    ReleaseUringConnection(loop, index, true);
+}
+
+// Следующие запросы соединения: запись накопленных ответов и (связанное с ней) чтение.
+// Соединение закрывается, когда клиент ушел, ответы записаны и в ядре нет его запросов
+static void UringContinue(UringLoop *loop, int index)
+{
+    UringConnection *conn = &loop->conns[index];
+    if (conn->subscribed && !conn->failed)
+    {
+        // Неотправленные ответы допишет поток подписок
+        if (conn->writing == 0 && !conn->reading)
+        {
+            AddSubscriber(conn->fd, conn->subscribe, conn->out);
+            ReleaseUringConnection(loop, index, false);
+        }
+        return;
+    }
+    if (conn->failed || (conn->peer_closed && !conn->parked && conn->out.empty()))
+    {
+        if (conn->writing == 0 && !conn->reading)
+            CloseUringConnection(loop, index);
+        return;
+    }
+
+    bool want_read = !conn->reading && !conn->parked && !conn->peer_closed && conn->in_len < MAX_LINE;
+    if (conn->writing == 0 && !conn->out.empty())
+    {
+        size_t len = conn->out.size() < URING_OUT_SIZE ? conn->out.size() : URING_OUT_SIZE;
+        memcpy(conn->out_buf, conn->out.data(), len);
+        conn->out.erase(0, len);
+        conn->writing = len;
+
+        struct io_uring_sqe *sqe = UringSqe(loop);
+        UringPrepFixed(sqe, IORING_OP_WRITE_FIXED, conn->fd, conn->out_buf, len, UringData(index, URING_WRITE));
+        // Чтение следующих команд начнется после записи ответа. Если запись окажется
+        // неполной, ядро отменит чтение (-ECANCELED), и пара будет отправлена заново
+        if (want_read)
+            sqe->flags |= IOSQE_IO_LINK;
+    }
+    if (want_read)
+    {
+        UringPrepFixed(UringSqe(loop), IORING_OP_READ_FIXED, conn->fd, conn->in + conn->in_len,
+                       MAX_LINE - conn->in_len, UringData(index, URING_READ));
+        conn->reading = true;
+    }
+}
+
+static void UringPark(UringLoop *loop, int index, int wait_ms)
+{
+    UringConnection *conn = &loop->conns[index];
+    conn->parked = true;
+    conn->deadline = NowMs() + wait_ms;
+    conn->parked_at = NowNs();
+    loop->parked.push_back(index);
+    loop->parked_count.fetch_add(1);
+}
+
+// Выполнение накопленных команд; останавливается на POPWAIT при пустом хранилище
+static void UringAdvance(UringLoop *loop, int index)
+{
+    UringConnection *conn = &loop->conns[index];
+    int wait_ms = ProcessInput(conn->in, &conn->in_len, conn->out, false, &conn->subscribe);
+    if (wait_ms > 0)
+        UringPark(loop, index, wait_ms);
+    else if (wait_ms == INPUT_SUBSCRIBED)
+        conn->subscribed = true;
+}
+
+static void UringAccepted(UringLoop *loop, int client_fd)
+{
+    int index = loop->free_conn;
+    if (index < 0)
+    {
+        close(client_fd);
+        CountSyscall(loop->syscalls);
+        rejected_connections.fetch_add(1);
+        return;
+    }
+    loop->free_conn = loop->conns[index].next_free;
+
+    LogEvent(LOG_LEVEL_INFO, EV_CONNECTED);
+    active_connections.fetch_add(1);
+    total_connections.fetch_add(1);
+
+    UringConnection *conn = &loop->conns[index];
+    conn->fd = client_fd;
+    conn->in_len = 0;
+    conn->writing = 0;
+    conn->reading = false;
+    conn->peer_closed = false;
+    conn->failed = false;
+    conn->parked = false;
+    conn->deadline = 0;
+    conn->parked_at = 0;
+    conn->subscribed = false;
+    UringContinue(loop, index);
+}
+
+// Обработка одного завершения
+static void UringComplete(UringLoop *loop, uint64_t user_data, int res, unsigned flags)
+{
+    int index = (int)(user_data >> 8);
+    UringOp op = (UringOp)(user_data & 0xff);
+    UringConnection *conn = &loop->conns[index];
+
+    switch (op)
+    {
+    case URING_ACCEPT:
+        if (res >= 0)
+            UringAccepted(loop, res);
+        else if (res == -EINVAL && loop->multishot)
+            loop->multishot = false; // Старое ядро: принимаем по одному запросу на соединение
+        else if (res != -EINTR && res != -ECONNABORTED)
+            fprintf(stderr, "io_uring accept: %s\n", strerror(-res));
+        if (!(flags & IORING_CQE_F_MORE))
+            ArmAccept(loop);
+        return;
+    case URING_WAKE:
+        ArmWake(loop);
+        return;
+    case URING_READ:
+        conn->reading = false;
+        if (res > 0)
+        {
+            conn->in_len += res;
+            UringAdvance(loop, index);
+        }
+        else if (res == 0)
+        {
+            conn->peer_closed = true;
+        }
+        else if (res != -ECANCELED)
+        {
+            conn->failed = true;
+        }
+        break;
+    case URING_WRITE:
+        if (res < 0)
+        {
+            conn->failed = true;
+            shutdown(conn->fd, SHUT_RDWR); // Завершить ожидающее чтение
+        }
+        else if ((unsigned)res < conn->writing)
+        {
+            conn->out.insert(0, conn->out_buf + res, conn->writing - res);
+        }
+        conn->writing = 0;
+        break;
+    }
+    UringContinue(loop, index);
+}
+
+// Ответ отложенным соединениям: как ServeParked в цикле epoll
+static void UringServeParked(UringLoop *loop)
+{
+    long long now = NowMs();
+    bool empty = false;
+    std::list<int>::iterator it = loop->parked.begin();
+    while (it != loop->parked.end())
+    {
+        int index = *it;
+        UringConnection *conn = &loop->conns[index];
+        int fuel = empty ? -1 : StoragePop();
+        if (fuel < 0)
+        {
+            empty = true;
+            if (now < conn->deadline)
+            {
+                ++it;
+                continue;
+            }
+        }
+
+        it = loop->parked.erase(it);
+        loop->parked_count.fetch_sub(1);
+        conn->parked = false;
+
+        if (fuel > 0)
+        {
+            LogEvent(LOG_LEVEL_INFO, EV_DISPENSED, fuel, StorageSize());
+        }
+        char response[32];
+        snprintf(response, sizeof(response), "%d\n", fuel);
+        conn->out += response;
+        LocalStats()->service.Record(NowNs() - conn->parked_at);
+
+        UringAdvance(loop, index);
+        UringContinue(loop, index);
+    }
+}
+
+static int NextUringTimeout(UringLoop *loop)
+{
+    int timeout = 1000;
+    long long now = NowMs();
+    for (std::list<int>::iterator it = loop->parked.begin(); it != loop->parked.end(); ++it)
+    {
+        long long left = loop->conns[*it].deadline - now;
+        if (left < 0)
+            left = 0;
+        if (left < timeout)
+            timeout = left;
+    }
+    return timeout;
+}
+
+// Поток цикла io_uring
+void *UringLoopThread(void *arg)
+{
+    UringLoop *loop = (UringLoop *)arg;
+    ArmAccept(loop);
+    ArmWake(loop);
+
+    while (run_flag)
+    {
+        // Отправка всех подготовленных запросов и ожидание завершений - один системный вызов
+        int ret = UringEnter(&loop->ring, 1, NextUringTimeout(loop));
+        CountSyscall(loop->syscalls);
+        if (ret < 0 && errno != ETIME && errno != EINTR && errno != EBUSY && errno != EAGAIN)
+        {
+            perror("io_uring_enter");
+            break;
+        }
+
+        struct io_uring_cqe *cqe;
+        while ((cqe = UringPeekCqe(&loop->ring)) != NULL)
+        {
+            uint64_t user_data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            UringCqeSeen(&loop->ring);
+            UringComplete(loop, user_data, res, flags);
+        }
+
+        if (!loop->parked.empty())
+            UringServeParked(loop);
+    }
+    return NULL;
+}
+
+// Создание цикла io_uring со своим слушающим сокетом
+static bool InitUringLoop(UringLoop *loop, int listen_fd)
+{
+    loop->listen_fd = listen_fd;
+    loop->multishot = true;
+    loop->parked_count.store(0);
+    loop->syscalls.store(0);
+    loop->wake_fd = eventfd(0, 0);
+    if (loop->wake_fd < 0 || !UringSetup(&loop->ring, URING_ENTRIES, URING_CQ_ENTRIES))
+    {
+        perror("io_uring_setup/eventfd");
+        return false;
+    }
+
+    size_t per_connection = MAX_LINE + URING_OUT_SIZE;
+    void *memory = NULL;
+    if (posix_memalign(&memory, 4096, per_connection * URING_MAX_CONNECTIONS) != 0)
+        return false;
+    loop->arena = (char *)memory;
+    if (!UringRegisterBuffer(&loop->ring, loop->arena, per_connection * URING_MAX_CONNECTIONS))
+    {
+        perror("io_uring_register");
+        return false;
+    }
+
+    loop->conns = new UringConnection[URING_MAX_CONNECTIONS];
+    for (int i = 0; i < URING_MAX_CONNECTIONS; i++)
+    {
+        loop->conns[i].fd = -1;
+        loop->conns[i].in = loop->arena + i * per_connection;
+        loop->conns[i].out_buf = loop->conns[i].in + MAX_LINE;
+        loop->conns[i].next_free = i + 1 < URING_MAX_CONNECTIONS ? i + 1 : -1;
+    }
+    loop->free_conn = 0;
+    return true;
+}
+
+// Доступен ли io_uring с нужными возможностями (ядро может быть старым или запрещать его)
+static bool UringAvailable()
+{
+    UringRing ring;
+    if (!UringSetup(&ring, 8, 16))
+        return false;
+    UringClose(&ring);
+    return true;
+}
+#endif
+
+// Передача принятого соединения (TCP или сокет Unix) в выбранный режим обслуживания
+static void DispatchConnection(int client_fd)
+{
+    LogEvent(LOG_LEVEL_INFO, EV_CONNECTED);
+    active_connections.fetch_add(1);
+    total_connections.fetch_add(1);
 
-// Функция для обработки клиентских запросов
-void *HandleClient(void *arg)
+#ifdef __linux__
+    if (server_mode == MODE_EPOLL || server_mode == MODE_REUSEPORT)
+    {
+        // В режиме reuseport сюда попадают только соединения через сокет Unix
+        if (!AddToEventLoop(client_fd))
+        {
+            close(client_fd);
+            active_connections.fetch_sub(1);
+        }
+        return;
+    }
+#endif
+
+    if (server_mode == MODE_POOL)
+    {
+        if (!EnqueueConnection(&pool_queue, client_fd, !pool_reject))
+            RejectConnection(client_fd);
+        return;
+    }
+
+    // Создаем поток для обработки клиента (в режиме uring так обслуживается сокет Unix)
+    int *client_socket = (int *)malloc(sizeof(int));
+    *client_socket = client_fd;
+    pthread_t client_thread;
+    pthread_create(&client_thread, NULL, HandleClient, client_socket);
+    pthread_detach(client_thread);
+}
+
+// Создание слушающего сокета TCP на порту 8080; -1 при ошибке.
+// reuse_port: на одном порту можно открыть несколько сокетов (SO_REUSEPORT),
+// ядро распределяет входящие соединения между ними
+static int ListenTcp(bool reuse_port)
 {
-    int client_socket = *((int *)arg);
-    free(arg);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
 
-    char buffer[256];
-    int n;
+    // Перезапущенный сервер сразу занимает порт, не дожидаясь, пока соединения прежнего
+    // процесса выйдут из TIME_WAIT: клиенты переподключаются без долгой паузы
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 
-    while ((n = read(client_socket, buffer, sizeof(buffer) - 1)) > 0 && run_flag)
+#ifdef SO_REUSEPORT
+    if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
     {
-        buffer[n] = '\0';
+        perror("setsockopt SO_REUSEPORT");
+        close(fd);
+        return -1;
+    }
+#endif
 
-        if (strncmp(buffer, "POP", 3) == 0)
-        {
-            pthread_mutex_lock(&mutex);
-            int fuel = -1;
-            if (!fuel_storage.empty())
-            {
-                fuel = fuel_storage.front();
-                fuel_storage.pop();
-                printf("Dispensed fuel: %d, Storage size: %zu\n", fuel, fuel_storage.size());
-            }
-            else
-            {
-                printf("Storage empty, cannot dispense fuel\n");
-            }
-            pthread_mutex_unlock(&mutex);
+    // Настройка адреса сервера
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_port = htons(8080);
 
-            // Отправляем ответ
-            char response[32];
-            snprintf(response, sizeof(response), "%d", fuel);
-            write(client_socket, response, strlen(response));
-        }
-        else if (strncmp(buffer, "SIZE", 4) == 0)
-        {
-            pthread_mutex_lock(&mutex);
-            int size = fuel_storage.size();
-            pthread_mutex_unlock(&mutex);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror("bind");
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, listen_backlog) < 0)
+    {
+        perror("listen");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-            char response[32];
-            snprintf(response, sizeof(response), "%d", size);
-            write(client_socket, response, strlen(response));
+// Прием соединений через сокет Unix: локальные клиенты обходят стек TCP
+void *UnixAcceptThread(void *arg)
+{
+    int unix_fd = *((int *)arg);
+    while (run_flag)
+    {
+        int client_fd = accept(unix_fd, NULL, NULL);
+        if (client_fd < 0)
+        {
+            if (errno != EINTR)
+                perror("accept unix");
+            continue;
         }
+        DispatchConnection(client_fd);
+    }
+    return NULL;
+}
+
+// Создание слушающего сокета Unix; -1 при ошибке
+static int ListenUnix(const char *path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+    {
+        perror("socket unix");
+        return -1;
     }
 
-    close(client_socket);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+    // Файл сокета мог остаться от прошлого запуска
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(fd, listen_backlog) < 0)
+    {
+        perror("bind unix");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Сегмент разделяемой памяти для локальных клиентов
+ShmSegment *shm_segment = NULL;
+
+// Возврат на склады топлива, выданного по запросу, который клиент отменил
+static void ReturnDispensed(const std::vector<DispensedUnit> &units)
+{
+    int returned = 0;
+    bool to_default = false;
+    for (size_t i = 0; i < units.size(); i++)
+    {
+        if (!DepotPush(units[i].depot, units[i].mark))
+            continue; // Склад успел заполниться - единица пропадает, как лишняя у производителя
+        returned++;
+        if (units[i].depot == DefaultDepot())
+            to_default = true;
+    }
+    if (to_default)
+    {
+        NotifyFuelAvailable();
+        WakeSubscribers();
+    }
+    LogEvent(LOG_LEVEL_WARN, EV_SHM_RETURNED, returned, (int)units.size());
+}
+
+// Поток, обслуживающий одну ячейку сегмента. POPWAIT в ячейке ждет,
+// не задерживая других клиентов, у которых свои ячейки и свои потоки.
+// Если клиент не дождался ответа (ShmClaimReply не удался), выданное топливо
+// возвращается на склад, а не пропадает в ячейке
+void *ShmSlotThread(void *arg)
+{
+    ShmSlot *slot = (ShmSlot *)arg;
+    char buffer[MAX_LINE];
+    std::string response;
+    std::vector<DispensedUnit> units;
+    uint32_t seq = 0;
+    dispensed_units = &units;
+
+    while (run_flag)
+    {
+        int len = ShmWaitRequest(slot, &seq, buffer, sizeof(buffer));
+        if (len < 0)
+            continue;
+        if (slot->pending_seq.load() != seq)
+            continue; // Отменен раньше, чем поток до него дошел
+
+        size_t buffer_len = len;
+        response.clear();
+        units.clear();
+        ProcessInput(buffer, &buffer_len, response, true, NULL);
+        if (ShmClaimReply(slot, seq))
+            ShmReply(slot, seq, response.data(), response.size());
+        else if (!units.empty())
+            ReturnDispensed(units);
+    }
+    dispensed_units = NULL;
     return NULL;
 }
 
-// Поток для генерации топлива
+// Ожидание свободного места на заполненном складе. Будит потребитель, забравший единицу;
+// тайм-аут нужен только для проверки run_flag
+static void WaitForSpace(Depot *depot)
+{
+    depot->producer_full_waits.fetch_add(1);
+    pthread_mutex_lock(&depot->space_mutex);
+    depot->producer_waiting.store(true);
+    while (run_flag && DepotFull(depot))
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += 1;
+        pthread_cond_timedwait(&depot->space_cond, &depot->space_mutex, &deadline);
+    }
+    depot->producer_waiting.store(false);
+    pthread_mutex_unlock(&depot->space_mutex);
+}
+
+// Выпущенная партия: учет, журнал и пробуждение ожидающих POPWAIT и подписчиков
+// (они есть только у склада по умолчанию)
+static void PublishBatch(Depot *depot, int count, int last_mark)
+{
+    if (count == 0)
+        return;
+    depot->produced_units.fetch_add(count);
+    if (depot != DefaultDepot())
+    {
+        LogEvent(LOG_LEVEL_INFO, EV_DEPOT_GENERATED, depot - depots, count, DepotSize(depot));
+        return;
+    }
+    if (count == 1)
+        LogEvent(LOG_LEVEL_INFO, EV_GENERATED, last_mark, StorageSize());
+    else
+        LogEvent(LOG_LEVEL_INFO, EV_GENERATED_BATCH, count, StorageSize());
+    NotifyFuelAvailable();
+    WakeSubscribers();
+}
+
+static void AddNs(struct timespec *ts, long long ns)
+{
+    ts->tv_sec += ns / 1000000000LL;
+    ts->tv_nsec += ns % 1000000000LL;
+    if (ts->tv_nsec >= 1000000000L)
+    {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// Поток генерации топлива для склада arg. Каждый такт выпускается партия из produce_burst
+// единиц, такты идут с периодом burst / rate по абсолютным моментам времени (clock_nanosleep
+// с TIMER_ABSTIME), поэтому время на саму вставку и задержки планировщика не накапливаются.
+// При заполненном складе производитель спит до освобождения места, а не пропускает такты
 void *StorageThread(void *arg)
 {
+    Depot *depot = (Depot *)arg;
+    long long period_ns = (long long)(1e9 * depot->produce_burst / depot->produce_rate);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
     while (run_flag)
     {
-        pthread_mutex_lock(&mutex);
-        if (fuel_storage.size() < 20)
+        int pending = depot->produce_burst; // Осталось выпустить в этом такте
+        int made = 0;                // Выпущено, но еще не объявлено потребителям
+        int last_mark = 0;
+        while (pending > 0 && run_flag)
         {
             int mark = rand() % 10 + 1;
-            fuel_storage.push(mark);
-            printf("Generated fuel: %d, Storage size: %zu\n", mark, fuel_storage.size());
+            if (!DepotFull(depot) && DepotPush(depot, mark))
+            {
+                pending--;
+                made++;
+                last_mark = mark;
+                continue;
+            }
+
+            // Хранилище заполнено: уже выпущенное отдаем ожидающим и ждем места.
+            // Остаток партии выпускается сразу после пробуждения, отсчет тактов начинается заново
+            PublishBatch(depot, made, last_mark);
+            made = 0;
+            WaitForSpace(depot);
+            clock_gettime(CLOCK_MONOTONIC, &next);
         }
-        pthread_mutex_unlock(&mutex);
-        usleep(1000000);
+        PublishBatch(depot, made, last_mark);
+
+        // Следующий такт. Если поток отстал больше чем на такт (долгая остановка),
+        // пропущенные такты не наверстываются
+        AddNs(&next, period_ns);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((now.tv_sec - next.tv_sec) * 1000000000LL + (now.tv_nsec - next.tv_nsec) > period_ns)
+            next = now;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR && run_flag)
+        {
+        }
+    }
+    return NULL;
+}
+
+// Поток выборки глубины очереди для STATS
+void *DepthSampleThread(void *arg)
+{
+    while (run_flag)
+    {
+        long taken = depth_taken.load();
+        depth_history[taken % DEPTH_SAMPLES].store(StorageSize());
+        depth_taken.store(taken + 1);
+        usleep(DEPTH_INTERVAL_MS * 1000);
     }
     return NULL;
 }
 
-int main()
+// Подготовка склада: мьютексы, условная переменная по монотонным часам и хранилище.
+// Возвращает false, если не удалось выделить шарды
+static bool InitDepot(Depot *depot, const char *name, StorageBackend backend, int capacity,
+                      double rate, int burst)
+{
+    snprintf(depot->name, sizeof(depot->name), "%s", name);
+    depot->backend = backend;
+    depot->capacity = capacity;
+    depot->produce_rate = rate;
+    depot->produce_burst = burst;
+    pthread_mutex_init(&depot->queue_mutex, NULL);
+    pthread_mutex_init(&depot->space_mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&depot->space_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    if (backend == STORAGE_SHARDS)
+    {
+        if (shard_count <= 0)
+            shard_count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (!depot->shards.Init(shard_count, capacity))
+            return false;
+    }
+    if (GradedBackend(backend))
+        depot->buckets.Init(capacity);
+    return true;
+}
+
+static bool ParseBackend(const char *name, StorageBackend *backend)
+{
+    if (strcmp(name, "ring") == 0)
+        *backend = STORAGE_RING;
+    else if (strcmp(name, "queue") == 0)
+        *backend = STORAGE_QUEUE;
+    else if (strcmp(name, "shards") == 0)
+        *backend = STORAGE_SHARDS;
+    else if (strcmp(name, "grade") == 0)
+        *backend = STORAGE_GRADE;
+    else if (strcmp(name, "priority") == 0)
+        *backend = STORAGE_PRIORITY;
+    else
+        return false;
+    return true;
+}
+
+// Чтение файла складов (ключ -D). Строка: "имя емкость скорость [партия [хранилище]]",
+// пустые строки и строки, начинающиеся с '#', пропускаются. Имя начинается с буквы,
+// чтобы "POP имя" не путалось с "POP n". Склады добавляются после склада по умолчанию
+static bool LoadDepotConfig(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return false;
+    }
+
+    char line[256];
+    int line_no = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_no++;
+        char first;
+        if (sscanf(line, " %c", &first) != 1 || first == '#')
+            continue;
+
+        char name[DEPOT_NAME_LEN];
+        char backend_name[16] = "ring";
+        int capacity = 0;
+        double rate = 0;
+        int burst = 1;
+        StorageBackend backend;
+        int fields = sscanf(line, "%31s %d %lf %d %15s", name, &capacity, &rate, &burst, backend_name);
+        if (fields < 3 || !isalpha((unsigned char)name[0]) || capacity < 1 ||
+            capacity > MAX_STORAGE_CAPACITY || rate <= 0 || burst < 1 || !ParseBackend(backend_name, &backend))
+        {
+            fprintf(stderr, "%s:%d: expected \"name capacity rate [burst [ring|queue|shards|grade|priority]]\"\n",
+                    path, line_no);
+            ok = false;
+        }
+        else if (FindDepot(name) != NULL)
+        {
+            fprintf(stderr, "%s:%d: duplicate depot %s\n", path, line_no, name);
+            ok = false;
+        }
+        else if (depot_count == MAX_DEPOTS)
+        {
+            fprintf(stderr, "%s:%d: too many depots (at most %d)\n", path, line_no, MAX_DEPOTS);
+            ok = false;
+        }
+        else if (!InitDepot(&depots[depot_count], name, backend, capacity, rate, burst))
+        {
+            fprintf(stderr, "Failed to allocate storage shards for depot %s\n", name);
+            ok = false;
+        }
+        else
+        {
+            depot_count++;
+        }
+    }
+    fclose(file);
+    return ok;
+}
+
+static void PrintUsage(const char *prog)
 {
+    fprintf(stderr, "Usage: %s [-m threads|epoll|pool|reuseport|uring] [-t loops] [-p workers] [-q queue] [-a wait|reject] [-b backlog]\n"
+                    "          [-s ring|queue|shards|grade|priority] [-S shards] [-w dir] [-l level] [-u path] [-M name]\n"
+                    "          [-r rate] [-B burst] [-c capacity] [-D depots.conf]\n", prog);
+    fprintf(stderr, "  -m  режим обслуживания клиентов (по умолчанию threads)\n");
+    fprintf(stderr, "  -t  число потоков цикла событий в режимах epoll, reuseport и uring (по умолчанию 1);\n");
+    fprintf(stderr, "      в режимах reuseport и uring у каждого потока свой слушающий сокет\n");
+    fprintf(stderr, "  -p  число рабочих потоков в режиме pool (по умолчанию 4)\n");
+    fprintf(stderr, "  -q  длина очереди соединений в режиме pool (по умолчанию 64)\n");
+    fprintf(stderr, "  -a  при заполненной очереди: wait - не принимать новые соединения,\n");
+    fprintf(stderr, "      reject - отвечать \"ERR server busy\" и закрывать (по умолчанию wait)\n");
+    fprintf(stderr, "  -b  длина очереди listen (по умолчанию 128)\n");
+    fprintf(stderr, "  -u  путь сокета Unix для локальных клиентов, none - выключить\n");
+    fprintf(stderr, "      (по умолчанию /tmp/fuel_storage.sock)\n");
+    fprintf(stderr, "  -M  имя сегмента разделяемой памяти, none - выключить (по умолчанию /fuel_storage)\n");
+    fprintf(stderr, "  -s  хранилище: очередь без блокировок, std::queue с мьютексом\n");
+    fprintf(stderr, "      очереди по ядрам с кражей работы или корзины по маркам для POPMIN,\n");
+    fprintf(stderr, "      POPMAX, POPEXACT; priority - те же корзины, POP выдает самую высокую\n");
+    fprintf(stderr, "      марку первой (по умолчанию ring)\n");
+    fprintf(stderr, "  -S  число шардов в режиме shards (по умолчанию по числу процессоров)\n");
+    fprintf(stderr, "  -w  каталог журнала: хранилище сохраняется и восстанавливается при перезапуске\n");
+    fprintf(stderr, "  -l  уровень сообщений: debug, info, warn, error, off (по умолчанию info)\n");
+    fprintf(stderr, "  -r  скорость производства топлива, единиц в секунду (по умолчанию 1)\n");
+    fprintf(stderr, "  -B  единиц топлива за один такт производства (по умолчанию 1)\n");
+    fprintf(stderr, "  -c  емкость хранилища, не больше %d (по умолчанию 20)\n", MAX_STORAGE_CAPACITY);
+    fprintf(stderr, "  -D  файл именованных складов, строка: имя емкость скорость [партия [хранилище]];\n");
+    fprintf(stderr, "      запросы к ним - \"POP имя [n]\" и \"SIZE имя\"\n");
+}
+
+int main(int argc, char *argv[])
+{
+    // Разбор параметров командной строки
+    int opt;
+    while ((opt = getopt(argc, argv, "m:t:p:q:a:b:s:S:w:l:u:M:r:B:c:D:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            if (strcmp(optarg, "threads") == 0)
+                server_mode = MODE_THREADS;
+            else if (strcmp(optarg, "epoll") == 0)
+                server_mode = MODE_EPOLL;
+            else if (strcmp(optarg, "pool") == 0)
+                server_mode = MODE_POOL;
+            else if (strcmp(optarg, "reuseport") == 0)
+                server_mode = MODE_REUSEPORT;
+            else if (strcmp(optarg, "uring") == 0)
+                server_mode = MODE_URING;
+            else
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 't':
+            loop_count = atoi(optarg);
+            if (loop_count < 1)
+                loop_count = 1;
+            break;
+        case 'p':
+            pool_size = atoi(optarg);
+            if (pool_size < 1)
+                pool_size = 1;
+            break;
+        case 'q':
+            pool_queue_size = atoi(optarg);
+            if (pool_queue_size < 1)
+                pool_queue_size = 1;
+            break;
+        case 'a':
+            if (strcmp(optarg, "wait") == 0)
+                pool_reject = false;
+            else if (strcmp(optarg, "reject") == 0)
+                pool_reject = true;
+            else
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'b':
+            listen_backlog = atoi(optarg);
+            if (listen_backlog < 1)
+                listen_backlog = 1;
+            break;
+        case 's':
+            if (!ParseBackend(optarg, &storage_backend))
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            shard_count = atoi(optarg);
+            break;
+        case 'w':
+            wal_dir = optarg;
+            break;
+        case 'u':
+            unix_path = strcmp(optarg, "none") == 0 ? NULL : optarg;
+            break;
+        case 'M':
+            shm_name = strcmp(optarg, "none") == 0 ? NULL : optarg;
+            break;
+        case 'l':
+            log_level_option = ParseLogLevel(optarg);
+            if (log_level_option < 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            produce_rate = atof(optarg);
+            if (produce_rate <= 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'B':
+            produce_burst = atoi(optarg);
+            if (produce_burst < 1)
+                produce_burst = 1;
+            break;
+        case 'c':
+            storage_capacity = atoi(optarg);
+            if (storage_capacity < 1)
+                storage_capacity = 1;
+            if (storage_capacity > MAX_STORAGE_CAPACITY)
+                storage_capacity = MAX_STORAGE_CAPACITY;
+            break;
+        case 'D':
+            depot_config = optarg;
+            break;
+        default:
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef __linux__
+    if (server_mode == MODE_EPOLL || server_mode == MODE_REUSEPORT || server_mode == MODE_URING)
+    {
+        fprintf(stderr, "epoll is not available, falling back to threads mode\n");
+        server_mode = MODE_THREADS;
+    }
+#else
+    if (server_mode == MODE_URING && !UringAvailable())
+    {
+        fprintf(stderr, "io_uring is not available, falling back to epoll mode\n");
+        server_mode = MODE_REUSEPORT;
+    }
+#endif
+
+    // Запись в закрытый клиентом сокет не должна завершать сервер
+    signal(SIGPIPE, SIG_IGN);
+
+    InitWaitCondition();
+    // Ключ -l важнее переменной окружения FUEL_LOG_LEVEL
+    StartAsyncLog(event_formats, EV_COUNT, LOG_LEVEL_INFO, stdout);
+    if (log_level_option >= 0)
+        SetLogLevel(log_level_option);
+    start_time_ms = NowMs();
+
+    if (!InitDepot(DefaultDepot(), "default", storage_backend, storage_capacity, produce_rate, produce_burst))
+    {
+        fprintf(stderr, "Failed to allocate storage shards\n");
+        return 1;
+    }
+    if (storage_backend == STORAGE_SHARDS)
+        printf("Sharded storage with %d shard(s)\n", DefaultDepot()->shards.Shards());
+    if (depot_config != NULL && !LoadDepotConfig(depot_config))
+        return 1;
+    for (int i = 1; i < depot_count; i++)
+    {
+        printf("Depot %d: %s, capacity %d, %g units/s\n", i, depots[i].name, depots[i].capacity,
+               depots[i].produce_rate);
+    }
+
     // Инициализация случайного генератора
     srand(time(NULL));
 
-    // Инициализация хранилища
-    for (int i = 0; i < 10; i++)
+    // Инициализация хранилища: из журнала, если он включен и что-то сохранил, иначе случайным
+    // топливом. Склад, опустевший до перезапуска, остается пустым
+    int restored = 0;
+    bool had_state = false;
+    if (wal_dir != NULL)
+    {
+        long long start = NowMs();
+        if (!fuel_wal.Open(wal_dir, WAL_SEGMENT_RECORDS))
+        {
+            fprintf(stderr, "Failed to open storage log in %s\n", wal_dir);
+            return 1;
+        }
+        // Единицы, не поместившиеся в хранилище с меньшей емкостью (-c, -s), списываются
+        // записью POP: иначе журнал продолжал бы их считать и вернул бы после перезапуска
+        int dropped = 0;
+        for (int mark = 1; mark <= WAL_MAX_MARK; mark++)
+        {
+            int saved = fuel_wal.Count(mark);
+            for (int i = 0; i < saved; i++)
+            {
+                if (BackendPush(DefaultDepot(), mark))
+                {
+                    restored++;
+                }
+                else
+                {
+                    fuel_wal.Append(WAL_POP, mark);
+                    dropped++;
+                }
+            }
+        }
+        had_state = fuel_wal.HadState();
+        printf("Restored %d units from %s in %lld ms\n", restored, wal_dir, NowMs() - start);
+        if (dropped > 0)
+        {
+            fuel_wal.Checkpoint(false); // Снимок сразу совпадает с хранилищем
+            printf("Dropped %d logged units that do not fit into capacity %d\n", dropped, storage_capacity);
+        }
+    }
+    wal_enabled = wal_dir != NULL;
+    if (!had_state)
     {
-        fuel_storage.push(rand() % 10 + 1);
+        for (int i = 0; i < 10 && i < storage_capacity; i++)
+        {
+            StoragePush(rand() % 10 + 1);
+        }
     }
-    printf("Storage initialized with %zu units\n", fuel_storage.size());
+    printf("Storage initialized with %d units\n", StorageSize());
 
-    // Создание серверного сокета
-    int server_fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (server_fd < 0)
+    // Именованные склады начинают так же, как склад по умолчанию без журнала
+    for (int d = 1; d < depot_count; d++)
     {
-        perror("socket");
-        return 1;
+        for (int i = 0; i < 10 && i < depots[d].capacity; i++)
+        {
+            BackendPush(&depots[d], rand() % 10 + 1);
+        }
     }
 
-    // Настройка адреса сервера
-    struct sockaddr_in address;
-    int addrlen = sizeof(address);
-    address.sin_family = AF_INET;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_port = htons(8080);
+    // Создание серверного сокета. В режимах reuseport и uring у каждого цикла свой сокет,
+    // они создаются вместе с циклами
+    int server_fd = -1;
+    if (server_mode != MODE_REUSEPORT && server_mode != MODE_URING)
+    {
+        server_fd = ListenTcp(false);
+        if (server_fd < 0)
+            return 1;
+        printf("Storage server listening on port 8080\n");
+    }
 
-    if (bind(server_fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    // Локальные транспорты: сокет Unix и разделяемая память
+    int unix_fd = -1;
+    if (unix_path != NULL)
     {
-        perror("bind");
-        close(server_fd);
-        return 1;
+        unix_fd = ListenUnix(unix_path);
+        if (unix_fd >= 0)
+            printf("Storage server listening on %s\n", unix_path);
+    }
+    if (shm_name != NULL)
+    {
+        shm_segment = CreateShmSegment(shm_name);
+        if (shm_segment != NULL)
+            printf("Shared memory transport %s with %d slots\n", shm_name, SHM_SLOTS);
     }
 
-    if (listen(server_fd, 5) < 0)
+    // Запуск потоков генерации топлива, по одному на склад
+    for (int i = 0; i < depot_count; i++)
     {
-        perror("listen");
-        close(server_fd);
+        pthread_create(&depots[i].producer_thread, NULL, StorageThread, &depots[i]);
+    }
+
+    pthread_t wal_thread;
+    if (wal_enabled)
+        pthread_create(&wal_thread, NULL, WalSyncThread, NULL);
+
+    pthread_t depth_thread;
+    pthread_create(&depth_thread, NULL, DepthSampleThread, NULL);
+
+    // Поток подписок и его канал пробуждения
+    pthread_t subscription_thread;
+    if (pipe(subscriber_pipe) < 0)
+    {
+        perror("pipe");
         return 1;
     }
+    fcntl(subscriber_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(subscriber_pipe[1], F_SETFL, O_NONBLOCK);
+    pthread_create(&subscription_thread, NULL, SubscriptionThread, NULL);
+
+    pthread_t reservation_thread;
+    pthread_create(&reservation_thread, NULL, ReservationThread, NULL);
+
+#ifdef __linux__
+    // Запуск циклов событий
+    pthread_t *loop_threads = NULL;
+    if (server_mode == MODE_EPOLL || server_mode == MODE_REUSEPORT)
+    {
+        loops = new EventLoop[loop_count];
+        loop_threads = new pthread_t[loop_count];
+        for (int i = 0; i < loop_count; i++)
+        {
+            if (!InitEventLoop(&loops[i]))
+                return 1;
+            if (server_mode == MODE_REUSEPORT)
+            {
+                int listen_fd = ListenTcp(true);
+                if (listen_fd < 0 || !AttachListener(&loops[i], listen_fd))
+                    return 1;
+            }
+            pthread_create(&loop_threads[i], NULL, EventLoopThread, &loops[i]);
+        }
+        if (server_mode == MODE_REUSEPORT)
+            printf("Storage server listening on port 8080 with %d SO_REUSEPORT listener(s)\n", loop_count);
+        printf("Serving clients with %d epoll loop(s)\n", loop_count);
+    }
+
+    // Запуск циклов io_uring
+    if (server_mode == MODE_URING)
+    {
+        uring_loops = new UringLoop[loop_count];
+        loop_threads = new pthread_t[loop_count];
+        for (int i = 0; i < loop_count; i++)
+        {
+            int listen_fd = ListenTcp(true);
+            if (listen_fd < 0 || !InitUringLoop(&uring_loops[i], listen_fd))
+                return 1;
+        }
+        for (int i = 0; i < loop_count; i++)
+        {
+            pthread_create(&loop_threads[i], NULL, UringLoopThread, &uring_loops[i]);
+        }
+        printf("Storage server listening on port 8080 with %d SO_REUSEPORT listener(s)\n", loop_count);
+        printf("Serving clients with %d io_uring loop(s)\n", loop_count);
+    }
+#endif
 
-    printf("Storage server listening on port 8080\n");
+    // Запуск пула рабочих потоков
+    pthread_t *pool_threads = NULL;
+    if (server_mode == MODE_POOL)
+    {
+        InitConnectionQueue(&pool_queue, pool_queue_size, pool_size);
+        pool_threads = new pthread_t[pool_size];
+        for (int i = 0; i < pool_size; i++)
+        {
+            pthread_create(&pool_threads[i], NULL, PoolWorkerThread, NULL);
+        }
+        printf("Serving clients with %d worker(s), queue of %d, %s when full\n",
+               pool_size, pool_queue_size, pool_reject ? "reject" : "wait");
+    }
+
+    pthread_t unix_thread;
+    if (unix_fd >= 0)
+        pthread_create(&unix_thread, NULL, UnixAcceptThread, &unix_fd);
+
+    pthread_t shm_threads[SHM_SLOTS];
+    if (shm_segment != NULL)
+    {
+        for (int i = 0; i < SHM_SLOTS; i++)
+        {
+            pthread_create(&shm_threads[i], NULL, ShmSlotThread, &shm_segment->slots[i]);
+        }
+    }
 
-    // Запуск потока генерации топлива
-    pthread_t storage_thread;
-    pthread_create(&storage_thread, NULL, StorageThread, NULL);
+    // В режиме reuseport соединения принимают сами циклы событий
+    while (run_flag && server_fd < 0)
+    {
+        pause();
+    }
 
     // Основной цикл сервера
     while (run_flag)
     {
-        int *client_socket = (int *)malloc(sizeof(int));
-        *client_socket = accept(server_fd, (struct sockaddr *)&address, (socklen_t *)&addrlen);
+        int client_fd = accept(server_fd, NULL, NULL);
 
-        if (*client_socket < 0)
+        if (client_fd < 0)
         {
             perror("accept");
-            free(client_socket);
             continue;
         }
 
-        printf("New client connected\n");
-
-        // Создаем поток для обработки клиента
-        pthread_t client_thread;
-        pthread_create(&client_thread, NULL, HandleClient, client_socket);
-        pthread_detach(client_thread);
+        DispatchConnection(client_fd);
     }
 
     // Очистка
-    close(server_fd);
-    pthread_join(storage_thread, NULL);
+    if (server_fd >= 0)
+        close(server_fd);
+    if (unix_fd >= 0)
+    {
+        shutdown(unix_fd, SHUT_RDWR);
+        pthread_join(unix_thread, NULL);
+        close(unix_fd);
+        unlink(unix_path);
+    }
+    if (shm_segment != NULL)
+    {
+        // Будим потоки ячеек, чтобы они увидели run_flag
+        for (int i = 0; i < SHM_SLOTS; i++)
+        {
+            sem_post(&shm_segment->slots[i].request_ready);
+        }
+        for (int i = 0; i < SHM_SLOTS; i++)
+        {
+            pthread_join(shm_threads[i], NULL);
+        }
+        CloseShmSegment(shm_segment);
+        shm_unlink(shm_name);
+    }
+    for (int i = 0; i < depot_count; i++)
+    {
+        pthread_join(depots[i].producer_thread, NULL);
+    }
+    pthread_join(depth_thread, NULL);
+    pthread_join(subscription_thread, NULL);
+    pthread_join(reservation_thread, NULL);
+    if (wal_enabled)
+    {
+        pthread_join(wal_thread, NULL);
+        fuel_wal.Close();
+    }
+
+#ifdef __linux__
+    if (server_mode == MODE_EPOLL || server_mode == MODE_REUSEPORT)
+    {
+        for (int i = 0; i < loop_count; i++)
+        {
+            pthread_join(loop_threads[i], NULL);
+            close(loops[i].epfd);
+            close(loops[i].wake_fd);
+            if (loops[i].listen_fd >= 0)
+                close(loops[i].listen_fd);
+        }
+        delete[] loop_threads;
+        delete[] loops;
+    }
+    if (server_mode == MODE_URING)
+    {
+        for (int i = 0; i < loop_count; i++)
+        {
+            pthread_join(loop_threads[i], NULL);
+            UringClose(&uring_loops[i].ring);
+            close(uring_loops[i].wake_fd);
+            close(uring_loops[i].listen_fd);
+        }
+        delete[] loop_threads;
+    }
+#endif
+
+    if (server_mode == MODE_POOL)
+    {
+        pthread_mutex_lock(&pool_queue.mutex);
+        pthread_cond_broadcast(&pool_queue.not_empty);
+        pthread_mutex_unlock(&pool_queue.mutex);
+        for (int i = 0; i < pool_size; i++)
+        {
+            pthread_join(pool_threads[i], NULL);
+        }
+        delete[] pool_threads;
+        delete[] pool_queue.fds;
+    }
 
+    StopAsyncLog();
     printf("Storage server stopped\n");
     return 0;
 }
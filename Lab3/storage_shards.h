@@ -0,0 +1,149 @@
+#ifndef STORAGE_SHARDS_H_INCLUDED
+#define STORAGE_SHARDS_H_INCLUDED
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <new>
+#include <queue>
+#include <atomic>
+#include "fuel_ring.h"
+
+// Одна часть (шард) хранилища: своя очередь, свой мьютекс и счетчик.
+// Размер структуры кратен строке кэша, чтобы соседние шарды не делили строки
+struct alignas(CACHE_LINE) FuelShard
+{
+    pthread_mutex_t mutex;
+    std::queue<int> queue;
+    std::atomic<int> count; // Читается без мьютекса для SIZE и быстрого пропуска пустых шардов
+};
+
+// Шард, закрепленный за текущим потоком (назначается по кругу при первом обращении)
+static __thread int home_shard = -1;
+
+// Хранилище, разбитое на шарды (по одному на рабочее ядро).
+// Производитель раскладывает топливо по шардам по кругу, потребитель берет из своего шарда,
+// а если он пуст - "крадет" у соседей. Общая емкость соблюдается глобальным счетчиком total:
+// место резервируется до вставки, поэтому в сумме единиц никогда не больше capacity.
+class ShardedStore
+{
+public:
+    ShardedStore() : shard_count(0), capacity(0), shards(NULL)
+    {
+        total.store(0);
+        next_push.store(0);
+        next_home.store(0);
+    }
+
+    ~ShardedStore()
+    {
+        for (int i = 0; i < shard_count; i++)
+        {
+            pthread_mutex_destroy(&shards[i].mutex);
+            shards[i].~FuelShard();
+        }
+        free(shards);
+    }
+
+    bool Init(int shards_wanted, int max_units)
+    {
+        shard_count = shards_wanted > 0 ? shards_wanted : 1;
+        capacity = max_units;
+
+        // new не гарантирует выравнивание на строку кэша, поэтому память выделяется явно
+        void *memory = NULL;
+        if (posix_memalign(&memory, CACHE_LINE, sizeof(FuelShard) * shard_count) != 0)
+            return false;
+        shards = (FuelShard *)memory;
+        for (int i = 0; i < shard_count; i++)
+        {
+            new (&shards[i]) FuelShard();
+            pthread_mutex_init(&shards[i].mutex, NULL);
+            shards[i].count.store(0);
+        }
+        return true;
+    }
+
+    // Добавление в следующий по кругу шард. Возвращает false, если хранилище заполнено
+    bool Push(int mark)
+    {
+        if (total.fetch_add(1) >= capacity)
+        {
+            total.fetch_sub(1);
+            return false;
+        }
+
+        FuelShard &shard = shards[next_push.fetch_add(1) % shard_count];
+        pthread_mutex_lock(&shard.mutex);
+        shard.queue.push(mark);
+        shard.count.fetch_add(1);
+        pthread_mutex_unlock(&shard.mutex);
+        return true;
+    }
+
+    // Извлечение: сначала из своего шарда, затем по очереди у соседей
+    bool Pop(int *mark)
+    {
+        int home = HomeShard();
+        for (int i = 0; i < shard_count; i++)
+        {
+            if (PopFrom(shards[(home + i) % shard_count], mark))
+            {
+                total.fetch_sub(1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Приблизительный размер: сумма счетчиков шардов без захвата мьютексов
+    int Size() const
+    {
+        int size = 0;
+        for (int i = 0; i < shard_count; i++)
+        {
+            size += shards[i].count.load(std::memory_order_relaxed);
+        }
+        return size;
+    }
+
+    int Shards() const
+    {
+        return shard_count;
+    }
+
+private:
+    int HomeShard()
+    {
+        if (home_shard < 0)
+            home_shard = next_home.fetch_add(1);
+        return home_shard % shard_count;
+    }
+
+    static bool PopFrom(FuelShard &shard, int *mark)
+    {
+        // Пустой шард пропускается без захвата мьютекса
+        if (shard.count.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        bool found = false;
+        pthread_mutex_lock(&shard.mutex);
+        if (!shard.queue.empty())
+        {
+            *mark = shard.queue.front();
+            shard.queue.pop();
+            shard.count.fetch_sub(1);
+            found = true;
+        }
+        pthread_mutex_unlock(&shard.mutex);
+        return found;
+    }
+
+    int shard_count;
+    int capacity;
+    FuelShard *shards;
+    alignas(CACHE_LINE) std::atomic<int> total;        // Занятые и зарезервированные места
+    alignas(CACHE_LINE) std::atomic<unsigned> next_push; // Шард для следующей вставки
+    std::atomic<int> next_home;                          // Счетчик для назначения шардов потокам
+};
+
+#endif
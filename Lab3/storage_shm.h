@@ -0,0 +1,261 @@
+#ifndef STORAGE_SHM_H_INCLUDED
+#define STORAGE_SHM_H_INCLUDED
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <atomic>
+
+// Обмен с сервером хранилища через разделяемую память POSIX, когда клиент и сервер
+// работают на одной машине.
+//
+// Сегмент содержит SHM_SLOTS ячеек, по одной на клиента. Клиент занимает свободную ячейку,
+// записывает в нее запрос (те же строки протокола, что и по TCP, можно несколько строк
+// сразу) и будит обслуживающий ячейку поток сервера семафором request_ready. Сервер
+// записывает ответ и будит клиента семафором response_ready. Семафоры разделяются между
+// процессами (sem_init с pshared = 1) и в Linux построены на futex: пока никто не спит,
+// системный вызов не нужен.
+// Номер запроса (seq) возвращается в ответе: ответ на запрос, который клиент перестал
+// ждать по тайм-ауту, распознается и пропускается.
+// Тайм-аут клиента - это отмена: номер ожидаемого запроса лежит в pending_seq, и клиент
+// и сервер снимают его одной операцией compare_exchange. Если первым успел клиент, сервер
+// не отвечает, а выданное по запросу топливо возвращает на склад; если сервер - клиент
+// дожидается уже отправляемого ответа. Так единицы не теряются в брошенной ячейке.
+
+const char *const SHM_DEFAULT_NAME = "/fuel_storage";
+const uint32_t SHM_MAGIC = 0x46534847; // "FSHG"
+const int SHM_SLOTS = 16;
+const int SHM_REQUEST_SIZE = 256;
+const int SHM_RESPONSE_SIZE = 4096;
+
+struct ShmSlot
+{
+    std::atomic<int> owner; // pid клиента; 0 - ячейка свободна
+    sem_t request_ready;
+    sem_t response_ready;
+    std::atomic<uint32_t> pending_seq; // Запрос, ответа на который ждет клиент; 0 - никто не ждет
+    uint32_t request_seq;
+    uint32_t response_seq;
+    uint32_t request_len;
+    uint32_t response_len;
+    char request[SHM_REQUEST_SIZE];
+    char response[SHM_RESPONSE_SIZE];
+};
+
+struct ShmSegment
+{
+    uint32_t magic;
+    uint32_t slot_count;
+    int32_t server_pid; // Сегмент, оставшийся от завершившегося сервера, клиенты не используют
+    ShmSlot slots[SHM_SLOTS];
+};
+
+// Создание сегмента сервером. Сегмент, оставшийся от прошлого запуска, пересоздается
+static inline ShmSegment *CreateShmSegment(const char *name)
+{
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0666);
+    if (fd < 0)
+    {
+        perror("shm_open");
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(ShmSegment)) < 0)
+    {
+        perror("ftruncate shm");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    void *memory = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap shm");
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ShmSegment *segment = (ShmSegment *)memory;
+    segment->slot_count = SHM_SLOTS;
+    segment->server_pid = getpid();
+    for (int i = 0; i < SHM_SLOTS; i++)
+    {
+        ShmSlot *slot = &segment->slots[i];
+        slot->owner.store(0);
+        sem_init(&slot->request_ready, 1, 0);
+        sem_init(&slot->response_ready, 1, 0);
+        slot->pending_seq.store(0);
+        slot->request_seq = 0;
+        slot->response_seq = 0;
+        slot->request_len = 0;
+        slot->response_len = 0;
+    }
+    // Клиенты проверяют magic, поэтому он записывается последним
+    std::atomic_thread_fence(std::memory_order_release);
+    segment->magic = SHM_MAGIC;
+    return segment;
+}
+
+// Подключение клиента к существующему сегменту; NULL, если сервер его не создал
+static inline ShmSegment *OpenShmSegment(const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+        return NULL;
+    void *memory = mmap(NULL, sizeof(ShmSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+        return NULL;
+
+    ShmSegment *segment = (ShmSegment *)memory;
+    if (segment->magic != SHM_MAGIC || segment->slot_count != (uint32_t)SHM_SLOTS ||
+        (kill(segment->server_pid, 0) < 0 && errno == ESRCH))
+    {
+        munmap(memory, sizeof(ShmSegment));
+        return NULL;
+    }
+    return segment;
+}
+
+static inline void CloseShmSegment(ShmSegment *segment)
+{
+    munmap(segment, sizeof(ShmSegment));
+}
+
+// Захват свободной ячейки. Ячейки процессов, которые завершились, не освободив их,
+// забираются повторно. Возвращает номер ячейки или -1
+static inline int ClaimShmSlot(ShmSegment *segment)
+{
+    int pid = getpid();
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (int i = 0; i < SHM_SLOTS; i++)
+        {
+            int owner = segment->slots[i].owner.load();
+            bool stale = pass == 1 && owner != 0 && kill(owner, 0) < 0 && errno == ESRCH;
+            if ((owner == 0 || stale) && segment->slots[i].owner.compare_exchange_strong(owner, pid))
+                return i;
+        }
+    }
+    return -1;
+}
+
+static inline void ReleaseShmSlot(ShmSegment *segment, int slot)
+{
+    segment->slots[slot].owner.store(0);
+}
+
+// Ожидание семафора не дольше timeout_ms. Возвращает false по тайм-ауту
+static inline bool WaitShmSemaphore(sem_t *sem, int timeout_ms)
+{
+    // sem_timedwait принимает абсолютное время по системным часам
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    while (sem_timedwait(sem, &deadline) < 0)
+    {
+        if (errno != EINTR)
+            return false;
+    }
+    return true;
+}
+
+// Запрос клиента: строки протокола, каждая завершается '\n'.
+// Ответ (с '\n' после каждой строки) копируется в response с завершающим нулем.
+// Возвращает длину ответа или -1 при тайм-ауте или слишком длинном запросе.
+// Запрос, отмененный тайм-аутом, сервер откатывает сам (см. ShmClaimReply)
+static inline int ShmRequest(ShmSegment *segment, int slot_index, const char *request,
+                             char *response, size_t size, int timeout_ms)
+{
+    ShmSlot *slot = &segment->slots[slot_index];
+    size_t len = strlen(request);
+    if (len > SHM_REQUEST_SIZE || size == 0)
+        return -1;
+
+    memcpy(slot->request, request, len);
+    slot->request_len = len;
+    uint32_t seq = ++slot->request_seq;
+    slot->pending_seq.store(seq);
+    sem_post(&slot->request_ready);
+
+    // Ответы на прежние запросы, которые не дождались, пропускаются
+    bool claimed = false; // Сервер уже отвечает, отменять поздно
+    do
+    {
+        if (!WaitShmSemaphore(&slot->response_ready, timeout_ms))
+        {
+            uint32_t expected = seq;
+            if (claimed || slot->pending_seq.compare_exchange_strong(expected, 0))
+                return -1;
+            claimed = true;
+        }
+    } while (slot->response_seq != seq);
+
+    size_t got = slot->response_len;
+    if (got >= size)
+        got = size - 1;
+    memcpy(response, slot->response, got);
+    response[got] = '\0';
+    return got;
+}
+
+// Ожидание запроса потоком сервера, обслуживающим ячейку. Запрос копируется в buffer,
+// его номер - в *seq. Возвращает длину запроса или -1, если пробуждение не принесло
+// нового запроса (повторный sem_post после тайм-аута клиента или остановка сервера)
+static inline int ShmWaitRequest(ShmSlot *slot, uint32_t *seq, char *buffer, size_t size)
+{
+    while (sem_wait(&slot->request_ready) < 0)
+    {
+        if (errno != EINTR)
+            return -1;
+    }
+    uint32_t current = slot->request_seq;
+    if (current == *seq)
+        return -1;
+    *seq = current;
+
+    size_t len = slot->request_len;
+    if (len > size)
+        len = size;
+    memcpy(buffer, slot->request, len);
+    return len;
+}
+
+// Сервер выполнил запрос seq и забирает право ответить. false - клиент уже отменил
+// запрос по тайм-ауту: ответ не отправляется, выданное по запросу нужно вернуть
+static inline bool ShmClaimReply(ShmSlot *slot, uint32_t seq)
+{
+    uint32_t expected = seq;
+    return slot->pending_seq.compare_exchange_strong(expected, 0);
+}
+
+// Ответ на запрос seq после ShmClaimReply. Слишком длинный ответ заменяется сообщением об ошибке
+static inline void ShmReply(ShmSlot *slot, uint32_t seq, const char *response, size_t len)
+{
+    const char error[] = "ERR response too long\n";
+    if (len > (size_t)SHM_RESPONSE_SIZE)
+    {
+        response = error;
+        len = sizeof(error) - 1;
+    }
+    memcpy(slot->response, response, len);
+    slot->response_len = len;
+    slot->response_seq = seq;
+    sem_post(&slot->response_ready);
+}
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef STORAGE_STATS_H_INCLUDED
+#define STORAGE_STATS_H_INCLUDED
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <atomic>
+
+// Гистограмма задержек в стиле HDR: логарифмические интервалы (степени двойки),
+// каждый разбит на 16 равных частей, поэтому относительная погрешность не больше 1/16.
+// Значения до 16 хранятся точно, диапазон - до 2^48 (около 3 суток в наносекундах).
+// Запись рассчитана на один пишущий поток (обычные load/store без атомарных RMW),
+// читать и сливать гистограммы можно из любого потока.
+const int HIST_SUB_BUCKETS = 16;
+const int HIST_SUB_BITS = 4;
+const int HIST_RANGES = 45;
+const int HIST_BUCKETS = HIST_SUB_BUCKETS * (HIST_RANGES + 1);
+
+class LatencyHistogram
+{
+public:
+    LatencyHistogram()
+    {
+        Reset();
+    }
+
+    void Reset()
+    {
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            counts[i].store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+    }
+
+    // Номер интервала для значения
+    static int BucketOf(uint64_t value)
+    {
+        if (value < (uint64_t)HIST_SUB_BUCKETS)
+            return (int)value;
+        int msb = 63 - __builtin_clzll(value);
+        int shift = msb - HIST_SUB_BITS;
+        if (shift >= HIST_RANGES)
+            return HIST_BUCKETS - 1;
+        int sub = (int)((value >> shift) & (HIST_SUB_BUCKETS - 1));
+        return HIST_SUB_BUCKETS * (shift + 1) + sub;
+    }
+
+    // Верхняя граница интервала
+    static uint64_t BucketLimit(int bucket)
+    {
+        if (bucket < HIST_SUB_BUCKETS)
+            return bucket;
+        int shift = bucket / HIST_SUB_BUCKETS - 1;
+        uint64_t sub = bucket % HIST_SUB_BUCKETS;
+        return ((HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+    }
+
+    // Запись значения (только из потока-владельца)
+    void Record(uint64_t value)
+    {
+        Bump(counts[BucketOf(value)], 1);
+        Bump(total, 1);
+        Bump(sum, value);
+        if (value > max.load(std::memory_order_relaxed))
+            max.store(value, std::memory_order_relaxed);
+    }
+
+    // Добавление чужой гистограммы (чтение без блокировок)
+    void Merge(const LatencyHistogram &other)
+    {
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            Bump(counts[i], other.counts[i].load(std::memory_order_relaxed));
+        }
+        Bump(total, other.total.load(std::memory_order_relaxed));
+        Bump(sum, other.sum.load(std::memory_order_relaxed));
+        uint64_t other_max = other.max.load(std::memory_order_relaxed);
+        if (other_max > max.load(std::memory_order_relaxed))
+            max.store(other_max, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t Max() const
+    {
+        return max.load(std::memory_order_relaxed);
+    }
+
+    double Mean() const
+    {
+        uint64_t count = Count();
+        return count ? (double)sum.load(std::memory_order_relaxed) / count : 0.0;
+    }
+
+    // Значение, не превышаемое долей p записей (0 < p <= 1)
+    uint64_t Percentile(double p) const
+    {
+        uint64_t count = Count();
+        if (count == 0)
+            return 0;
+        uint64_t rank = (uint64_t)(p * count + 0.5);
+        if (rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+            {
+                uint64_t limit = BucketLimit(i);
+                return limit < Max() ? limit : Max();
+            }
+        }
+        return Max();
+    }
+
+    // Сводка в формате JSON: {"count":..,"mean":..,"p50":..,"p90":..,"p99":..,"p999":..,"max":..}
+    void AppendJson(std::string &out) const
+    {
+        char buffer[256];
+        snprintf(buffer, sizeof(buffer),
+                 "{\"count\":%llu,\"mean\":%.0f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                 (unsigned long long)Count(), Mean(),
+                 (unsigned long long)Percentile(0.5), (unsigned long long)Percentile(0.9),
+                 (unsigned long long)Percentile(0.99), (unsigned long long)Percentile(0.999),
+                 (unsigned long long)Max());
+        out += buffer;
+    }
+
+private:
+    static void Bump(std::atomic<uint64_t> &counter, uint64_t delta)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counts[HIST_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// Текущее время по монотонным часам, нс
+static inline uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Метрики одного потока. Поток пишет только в свой блок, поэтому горячий путь
+// не захватывает мьютексов; при запросе STATS блоки всех потоков складываются.
+// Блок завершившегося потока возвращается в список свободных и достается следующему
+// потоку, так что в режиме "поток на соединение" число блоков не растет без ограничений.
+const int STATS_MAX_COMMANDS = 32;
+
+struct ThreadStats
+{
+    std::atomic<uint64_t> commands[STATS_MAX_COMMANDS];
+    LatencyHistogram service;   // Время обслуживания запроса, нс
+    LatencyHistogram lock_wait; // Ожидание мьютекса хранилища, нс
+    ThreadStats *next;          // Список всех блоков
+    ThreadStats *next_free;     // Список свободных блоков
+
+    void Count(int command)
+    {
+        commands[command].store(commands[command].load(std::memory_order_relaxed) + 1,
+                                std::memory_order_relaxed);
+    }
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadStats *stats_all = NULL;
+static ThreadStats *stats_free = NULL;
+static pthread_key_t stats_key;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static __thread ThreadStats *local_stats = NULL;
+
+static inline void ReleaseThreadStats(void *block)
+{
+    pthread_mutex_lock(&stats_mutex);
+    ((ThreadStats *)block)->next_free = stats_free;
+    stats_free = (ThreadStats *)block;
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+static inline void CreateStatsKey()
+{
+    pthread_key_create(&stats_key, ReleaseThreadStats);
+}
+
+// Блок метрик текущего потока (мьютекс захватывается только при первом обращении потока)
+static inline ThreadStats *LocalStats()
+{
+    if (local_stats != NULL)
+        return local_stats;
+
+    pthread_once(&stats_once, CreateStatsKey);
+    pthread_mutex_lock(&stats_mutex);
+    ThreadStats *block = stats_free;
+    if (block != NULL)
+    {
+        stats_free = block->next_free;
+    }
+    else
+    {
+        block = new ThreadStats;
+        for (int i = 0; i < STATS_MAX_COMMANDS; i++)
+        {
+            block->commands[i].store(0);
+        }
+        block->next = stats_all;
+        stats_all = block;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    pthread_setspecific(stats_key, block);
+    local_stats = block;
+    return block;
+}
+
+// Сумма метрик всех потоков
+static inline void MergeStats(uint64_t commands[STATS_MAX_COMMANDS], LatencyHistogram *service, LatencyHistogram *lock_wait)
+{
+    for (int i = 0; i < STATS_MAX_COMMANDS; i++)
+    {
+        commands[i] = 0;
+    }
+
+    pthread_mutex_lock(&stats_mutex);
+    for (ThreadStats *block = stats_all; block != NULL; block = block->next)
+    {
+        for (int i = 0; i < STATS_MAX_COMMANDS; i++)
+        {
+            commands[i] += block->commands[i].load(std::memory_order_relaxed);
+        }
+        service->Merge(block->service);
+        lock_wait->Merge(block->lock_wait);
+    }
+    pthread_mutex_unlock(&stats_mutex);
+}
+
+#endif
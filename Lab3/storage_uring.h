@@ -0,0 +1,224 @@
+#ifndef STORAGE_URING_H_INCLUDED
+#define STORAGE_URING_H_INCLUDED
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+// Минимальная обертка над io_uring через системные вызовы (без liburing).
+//
+// Кольцо отправки (SQ) и кольцо завершений (CQ) разделяются с ядром через mmap.
+// Программа заполняет записи запросов (SQE), а одним вызовом io_uring_enter отправляет
+// все накопленные запросы и ждет завершений (CQE). Пока ядро обрабатывает запросы,
+// системных вызовов на каждое чтение и запись не требуется.
+//
+// Нужны возможности ядра 5.11+: IORING_FEAT_EXT_ARG (ожидание с тайм-аутом)
+// и IORING_FEAT_NODROP (завершения не теряются при переполнении CQ).
+
+struct UringRing
+{
+    int fd;
+    unsigned sq_entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sq_local_tail; // Заполненные, но еще не опубликованные записи
+    unsigned pending;       // Опубликованные, но еще не отправленные записи
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+};
+
+// Создание кольца на entries запросов и cq_entries завершений. false - io_uring недоступен
+static inline bool UringSetup(UringRing *ring, unsigned entries, unsigned cq_entries)
+{
+    memset(ring, 0, sizeof(*ring));
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = cq_entries;
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0)
+        return false;
+    if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP))
+    {
+        close(ring->fd);
+        return false;
+    }
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_ring_size > ring->sq_ring_size)
+        ring->sq_ring_size = ring->cq_ring_size;
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED)
+    {
+        close(ring->fd);
+        return false;
+    }
+    if (single)
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED)
+        {
+            munmap(ring->sq_ring, ring->sq_ring_size);
+            close(ring->fd);
+            return false;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+    {
+        if (!single)
+            munmap(ring->cq_ring, ring->cq_ring_size);
+        munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+        return false;
+    }
+
+    char *sq = (char *)ring->sq_ring;
+    char *cq = (char *)ring->cq_ring;
+    ring->sq_entries = params.sq_entries;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_local_tail = *ring->sq_tail;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static inline void UringClose(UringRing *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring != ring->sq_ring)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+// Регистрация области памяти как буфера с номером 0: запросы READ_FIXED и WRITE_FIXED
+// не закрепляют страницы при каждом обращении
+static inline bool UringRegisterBuffer(UringRing *ring, void *base, size_t len)
+{
+    struct iovec iov;
+    iov.iov_base = base;
+    iov.iov_len = len;
+    return syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+}
+
+// Свободная запись запроса (обнуленная) или NULL, если кольцо отправки заполнено
+static inline struct io_uring_sqe *UringGetSqe(UringRing *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return NULL;
+    unsigned index = ring->sq_local_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sq_local_tail++;
+    ring->pending++;
+    return sqe;
+}
+
+// Отправка накопленных запросов и ожидание хотя бы min_complete завершений,
+// но не дольше timeout_ms. Возвращает результат io_uring_enter (-1 и errno при ошибке;
+// ETIME - истек тайм-аут)
+static inline int UringEnter(UringRing *ring, unsigned min_complete, int timeout_ms)
+{
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+    if (min_complete > 0)
+        flags |= IORING_ENTER_GETEVENTS;
+    int submitted = syscall(__NR_io_uring_enter, ring->fd, ring->pending, min_complete, flags,
+                            &arg, sizeof(arg));
+    if (submitted > 0)
+        ring->pending -= (unsigned)submitted < ring->pending ? (unsigned)submitted : ring->pending;
+    return submitted;
+}
+
+// Очередное завершение или NULL; после обработки вызывается UringCqeSeen
+static inline struct io_uring_cqe *UringPeekCqe(UringRing *ring)
+{
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+static inline void UringCqeSeen(UringRing *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Заполнение запросов
+
+static inline void UringPrepAccept(struct io_uring_sqe *sqe, int fd, bool multishot, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = fd;
+    if (multishot)
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT; // Один запрос принимает соединения, пока не отменен
+    sqe->user_data = user_data;
+}
+
+// Чтение или запись через зарегистрированный буфер 0
+static inline void UringPrepFixed(struct io_uring_sqe *sqe, int opcode, int fd, void *buf, unsigned len,
+                                  uint64_t user_data)
+{
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->buf_index = 0;
+    sqe->user_data = user_data;
+}
+
+static inline void UringPrepRead(struct io_uring_sqe *sqe, int fd, void *buf, unsigned len, uint64_t user_data)
+{
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->user_data = user_data;
+}
+
+#endif
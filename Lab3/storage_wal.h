@@ -0,0 +1,311 @@
+#ifndef STORAGE_WAL_H_INCLUDED
+#define STORAGE_WAL_H_INCLUDED
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+
+// Журнал операций хранилища (write-ahead log) для быстрого перезапуска.
+//
+// Журнал - заранее выделенный файл, отображенный в память (mmap). Каждая операция
+// занимает одну 32-битную запись: позиция резервируется атомарным счетчиком, поэтому
+// потоки пишут параллельно и без мьютекса, а fsync на каждую операцию не нужен.
+// Записи на диск сбрасывает отдельный поток раз в несколько миллисекунд (групповая
+// фиксация, Sync). Данные в отображенной памяти переживают падение процесса сразу,
+// а падение системы - после ближайшего Sync.
+//
+// Состояние хранилища - количество единиц каждой марки. При заполнении сегмента и
+// периодически делается контрольная точка: счетчики записываются в файл снимка, а журнал
+// очищается. Номер поколения (epoch) в снимке и в заголовке журнала защищает от повторного
+// применения записей, если процесс упал между записью снимка и очисткой журнала.
+// Порядок единиц в очереди не сохраняется, восстанавливается состав хранилища.
+
+// Операции в записи журнала (биты 8-15), марка - биты 0-7; нулевая запись - конец журнала
+enum WalOp
+{
+    WAL_PUSH = 1,
+    WAL_POP = 2
+};
+
+const uint32_t WAL_MAGIC = 0x4657414c; // "FWAL"
+const int WAL_MAX_MARK = 10;
+const int WAL_HEADER_WORDS = 2; // magic, epoch
+
+class FuelWal
+{
+public:
+    FuelWal() : fd(-1), words(NULL), records(NULL), capacity(0), epoch(0), had_state(false)
+    {
+        next.store(0);
+        committed.store(0);
+        synced.store(0);
+        for (int i = 0; i <= WAL_MAX_MARK; i++)
+        {
+            counts[i].store(0);
+        }
+        pthread_mutex_init(&checkpoint_mutex, NULL);
+    }
+
+    ~FuelWal()
+    {
+        Close();
+        pthread_mutex_destroy(&checkpoint_mutex);
+    }
+
+    // Открытие (или создание) журнала в каталоге dir и восстановление состояния.
+    // segment_records - сколько операций помещается в сегмент до контрольной точки
+    bool Open(const char *dir, size_t segment_records)
+    {
+        snprintf(log_path, sizeof(log_path), "%s/fuel.wal", dir);
+        snprintf(snap_path, sizeof(snap_path), "%s/fuel.snap", dir);
+        capacity = segment_records;
+
+        fd = open(log_path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0)
+        {
+            perror("open wal");
+            return false;
+        }
+
+        size_t bytes = (capacity + WAL_HEADER_WORDS) * sizeof(uint32_t);
+        struct stat st;
+        fstat(fd, &st);
+        if ((size_t)st.st_size != bytes && ftruncate(fd, bytes) < 0)
+        {
+            perror("ftruncate wal");
+            return false;
+        }
+
+        words = (uint32_t *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (words == MAP_FAILED)
+        {
+            perror("mmap wal");
+            words = NULL;
+            return false;
+        }
+        records = words + WAL_HEADER_WORDS;
+
+        Recover();
+
+        // Прочитанный журнал сразу сворачивается в снимок, новые записи идут с начала сегмента
+        return Checkpoint(false);
+    }
+
+    void Close()
+    {
+        if (words != NULL)
+        {
+            Sync();
+            munmap(words, (capacity + WAL_HEADER_WORDS) * sizeof(uint32_t));
+            words = NULL;
+            records = NULL;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+    }
+
+    // Запись операции. Без блокировок, пока в сегменте есть место
+    void Append(int op, int mark)
+    {
+        if (mark < 1 || mark > WAL_MAX_MARK)
+            return;
+
+        while (true)
+        {
+            size_t idx = next.fetch_add(1);
+            if (idx < capacity)
+            {
+                __atomic_store_n(&records[idx], ((uint32_t)op << 8) | (uint32_t)mark, __ATOMIC_RELAXED);
+                counts[mark].fetch_add(op == WAL_PUSH ? 1 : -1);
+                committed.fetch_add(1, std::memory_order_release);
+                return;
+            }
+
+            // Сегмент заполнен: контрольную точку делает первый пришедший, остальные ждут на мьютексе.
+            // Если снимок записать не удалось, операция не журналируется
+            if (!Checkpoint(true))
+                return;
+        }
+    }
+
+    // Групповая фиксация: сброс на диск всех записей, сделанных с прошлого вызова
+    void Sync()
+    {
+        size_t done = committed.load(std::memory_order_acquire);
+        if (words == NULL || done == synced.load())
+            return;
+        msync(words, (capacity + WAL_HEADER_WORDS) * sizeof(uint32_t), MS_SYNC);
+        synced.store(done);
+    }
+
+    // Контрольная точка: снимок счетчиков и очистка журнала.
+    // При only_if_full == true выполняется, только если сегмент все еще заполнен.
+    // Возвращает false, если снимок записать не удалось
+    bool Checkpoint(bool only_if_full)
+    {
+        pthread_mutex_lock(&checkpoint_mutex);
+        if (only_if_full && next.load() < capacity)
+        {
+            pthread_mutex_unlock(&checkpoint_mutex);
+            return true;
+        }
+
+        // Закрываем сегмент для новых записей и ждем завершения начатых
+        size_t used = next.exchange(capacity);
+        if (used > capacity)
+            used = capacity;
+        while (committed.load(std::memory_order_acquire) < used)
+        {
+            sched_yield();
+        }
+
+        bool ok = WriteSnapshot(epoch + 1);
+        if (ok)
+        {
+            epoch++;
+            memset(records, 0, used * sizeof(uint32_t));
+            words[0] = WAL_MAGIC;
+            words[1] = epoch;
+            msync(words, (capacity + WAL_HEADER_WORDS) * sizeof(uint32_t), MS_SYNC);
+            committed.store(0);
+            synced.store(0);
+            next.store(0);
+        }
+        else
+        {
+            // Снимок не записан: журнал остается как есть, дальнейшие записи теряются до
+            // следующей удачной контрольной точки
+            committed.store(used);
+            next.store(used);
+        }
+        pthread_mutex_unlock(&checkpoint_mutex);
+        return ok;
+    }
+
+    // Количество единиц марки mark по журналу (после Open - восстановленное состояние)
+    int Count(int mark) const
+    {
+        int count = counts[mark].load();
+        return count > 0 ? count : 0;
+    }
+
+    // Был ли при Open сохраненный состав хранилища (снимок или записи журнала).
+    // Пустое хранилище из журнала - тоже состояние, его нельзя заменять новым топливом
+    bool HadState() const
+    {
+        return had_state;
+    }
+
+    // Число операций в текущем сегменте
+    size_t Pending() const
+    {
+        size_t used = next.load();
+        return used < capacity ? used : capacity;
+    }
+
+private:
+    // Восстановление: снимок + записи журнала того же поколения
+    void Recover()
+    {
+        uint32_t snap_epoch = 0;
+        FILE *snap = fopen(snap_path, "rb");
+        if (snap != NULL)
+        {
+            uint32_t header[2];
+            int32_t snap_counts[WAL_MAX_MARK + 1];
+            if (fread(header, sizeof(header), 1, snap) == 1 && header[0] == WAL_MAGIC &&
+                fread(snap_counts, sizeof(snap_counts), 1, snap) == 1)
+            {
+                snap_epoch = header[1];
+                had_state = true;
+                for (int i = 0; i <= WAL_MAX_MARK; i++)
+                {
+                    counts[i].store(snap_counts[i]);
+                }
+            }
+            fclose(snap);
+        }
+        epoch = snap_epoch;
+
+        // Журнал другого поколения пуст или уже учтен в снимке
+        if (words[0] != WAL_MAGIC || words[1] != snap_epoch)
+        {
+            next.store(capacity);
+            committed.store(capacity);
+            return;
+        }
+
+        size_t applied = 0;
+        while (applied < capacity && records[applied] != 0)
+        {
+            uint32_t record = records[applied];
+            int mark = record & 0xff;
+            int op = (record >> 8) & 0xff;
+            if (mark >= 1 && mark <= WAL_MAX_MARK)
+                counts[mark].fetch_add(op == WAL_PUSH ? 1 : -1);
+            applied++;
+        }
+        if (applied > 0)
+            had_state = true;
+        // Неочищенный хвост после первой пустой записи тоже будет обнулен контрольной точкой
+        next.store(capacity);
+        committed.store(capacity);
+    }
+
+    // Запись снимка через временный файл и rename, чтобы снимок всегда был целым
+    bool WriteSnapshot(uint32_t new_epoch)
+    {
+        char tmp_path[300];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snap_path);
+        int snap_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (snap_fd < 0)
+        {
+            perror("open snapshot");
+            return false;
+        }
+
+        uint32_t header[2] = {WAL_MAGIC, new_epoch};
+        int32_t snap_counts[WAL_MAX_MARK + 1];
+        for (int i = 0; i <= WAL_MAX_MARK; i++)
+        {
+            snap_counts[i] = counts[i].load();
+        }
+
+        bool ok = write(snap_fd, header, sizeof(header)) == (ssize_t)sizeof(header) &&
+                  write(snap_fd, snap_counts, sizeof(snap_counts)) == (ssize_t)sizeof(snap_counts) &&
+                  fsync(snap_fd) == 0;
+        close(snap_fd);
+        if (!ok || rename(tmp_path, snap_path) < 0)
+        {
+            perror("write snapshot");
+            return false;
+        }
+        return true;
+    }
+
+    int fd;
+    uint32_t *words;   // Отображенный файл: заголовок и записи
+    uint32_t *records; // Записи сегмента
+    size_t capacity;
+    uint32_t epoch;
+    bool had_state; // Open нашел снимок или записи журнала
+    char log_path[256];
+    char snap_path[256];
+    pthread_mutex_t checkpoint_mutex;
+    std::atomic<int> counts[WAL_MAX_MARK + 1];
+    alignas(64) std::atomic<size_t> next;      // Следующая свободная позиция
+    alignas(64) std::atomic<size_t> committed; // Число полностью записанных позиций
+    std::atomic<size_t> synced;                // committed на момент последнего Sync
+};
+
+#endif
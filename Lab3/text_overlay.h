@@ -0,0 +1,148 @@
+#ifndef TEXT_OVERLAY_H_INCLUDED
+#define TEXT_OVERLAY_H_INCLUDED
+
+#include <stdio.h>
+#include <string.h>
+#include "vingraph.h"
+
+const int TEXT_OVERLAY_SLOTS = 32;
+const int TEXT_OVERLAY_LENGTH = 64;
+const int TEXT_OVERLAY_KEEP_COLOR = -1; // Цвет подписи меняет сама программа
+
+// Надписи окна с запоминанием последней выведенной строки.
+// Прежде каждая отрисовка удаляла все объекты Text и создавала их заново, а подписи
+// прямоугольников получали SetText и SetColor, даже если ничего не изменилось. Здесь у
+// каждого слота постоянный объект: Text создается при первом выводе, дальше SetText
+// вызывается только при смене строки, SetColor - только при смене цвета. Поэтому число
+// графических вызовов зависит от частоты изменений, а не от частоты кадров.
+// Слоты создаются лениво при первом Put или Label, поэтому весь вывод, включая EndFrame,
+// идет из потока отрисовки, а PrintStats вызывается после pthread_join этого потока.
+// Других владельцев у объекта нет, блокировки не нужны.
+class TextOverlay
+{
+public:
+    TextOverlay() : frames(0), calls(0), frame_calls(0), max_frame_calls(0), legacy_calls(0)
+    {
+        memset(slots, 0, sizeof(slots));
+    }
+
+    // Надпись отдельным объектом Text в точке (x, y). Положение задается первым выводом
+    void Put(int slot, int x, int y, const char *text, int color)
+    {
+        Slot &s = slots[slot];
+        legacy_calls += s.id != 0 ? 2 : 1; // Delete + Text
+        if (s.id == 0)
+        {
+            s.id = ::Text(x, y, text, color);
+            s.color = color;
+            Remember(s, text);
+            Count(1);
+            return;
+        }
+        Change(s, text, color);
+    }
+
+    // Подпись существующего объекта ident (прямоугольника). TEXT_OVERLAY_KEEP_COLOR
+    // оставляет цвет объекта программе
+    void Label(int slot, int ident, const char *text, int color)
+    {
+        Slot &s = slots[slot];
+        legacy_calls += color != TEXT_OVERLAY_KEEP_COLOR ? 2 : 1; // SetText + SetColor
+        if (s.id != ident)
+        {
+            // Строка и цвет объекта пока неизвестны, первый вывод выполняется полностью
+            s.id = ident;
+            s.text[0] = '\0';
+            s.valid = false;
+            s.color = TEXT_OVERLAY_KEEP_COLOR;
+        }
+        Change(s, text, color);
+    }
+
+    // Закрывает кадр: вызовы, сделанные после прошлого кадра, относятся к этому
+    void EndFrame()
+    {
+        frames++;
+        if (frame_calls > max_frame_calls)
+            max_frame_calls = frame_calls;
+        frame_calls = 0;
+    }
+
+    long Frames() const
+    {
+        return frames;
+    }
+
+    long Calls() const
+    {
+        return calls;
+    }
+
+    long MaxFrameCalls() const
+    {
+        return max_frame_calls;
+    }
+
+    // Сколько вызовов сделал бы прежний вывод (пересоздание Text, безусловные SetText и SetColor)
+    long LegacyCalls() const
+    {
+        return legacy_calls;
+    }
+
+    // Печатает среднее и наибольшее число графических вызовов надписей за кадр
+    void PrintStats() const
+    {
+        double per_frame = frames > 0 ? (double)calls / frames : 0;
+        double legacy_per_frame = frames > 0 ? (double)legacy_calls / frames : 0;
+        printf("Text overlay: %ld frames, %.2f graphics calls/frame (max %ld), recreating every frame would need %.2f\n",
+               frames, per_frame, max_frame_calls, legacy_per_frame);
+    }
+
+private:
+    struct Slot
+    {
+        int id;
+        int color;
+        bool valid;
+        char text[TEXT_OVERLAY_LENGTH];
+    };
+
+    void Change(Slot &s, const char *text, int color)
+    {
+        if (!s.valid || strncmp(s.text, text, TEXT_OVERLAY_LENGTH - 1) != 0)
+        {
+            ::SetText(s.id, text);
+            Remember(s, text);
+            Count(1);
+        }
+        if (color != TEXT_OVERLAY_KEEP_COLOR && color != s.color)
+        {
+            ::SetColor(s.id, color);
+            s.color = color;
+            Count(1);
+        }
+    }
+
+    static void Remember(Slot &s, const char *text)
+    {
+        size_t length = strnlen(text, TEXT_OVERLAY_LENGTH - 1);
+        memcpy(s.text, text, length);
+        s.text[length] = '\0';
+        s.valid = true;
+    }
+
+    void Count(int n)
+    {
+        calls += n;
+        frame_calls += n;
+    }
+
+    Slot slots[TEXT_OVERLAY_SLOTS];
+    long frames;
+    long calls;
+    long frame_calls;
+    long max_frame_calls;
+    long legacy_calls;
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef TIMER_WHEEL_H_INCLUDED
+#define TIMER_WHEEL_H_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Хешированное колесо таймеров: время делится на такты, таймер со сроком на такте t
+// лежит в ячейке t % SLOTS. Продвижение на один такт просматривает одну ячейку, поэтому
+// стоимость не зависит от числа таймеров. Таймеры со сроком дальше одного оборота колеса
+// остаются в ячейке, пока их такт не наступит.
+//
+// Отмены нет: владелец таймера по id проверяет при срабатывании, нужен ли он еще.
+// Колесо не потокобезопасно - вызывающий защищает его своим мьютексом.
+
+template <int SLOTS>
+class TimerWheel
+{
+public:
+    TimerWheel() : current(0), count(0)
+    {
+    }
+
+    // Таймер id сработает на такте tick (не раньше следующего такта)
+    void Schedule(uint64_t tick, long id)
+    {
+        if (tick <= current)
+            tick = current + 1;
+        Timer timer;
+        timer.tick = tick;
+        timer.id = id;
+        slots[tick % SLOTS].push_back(timer);
+        count++;
+    }
+
+    // Продвижение колеса до такта tick включительно; id сработавших таймеров добавляются в expired
+    void Advance(uint64_t tick, std::vector<long> &expired)
+    {
+        while (current < tick)
+        {
+            if (count == 0)
+            {
+                current = tick; // Пустое колесо проворачивается сразу
+                break;
+            }
+            current++;
+            std::vector<Timer> &slot = slots[current % SLOTS];
+            for (size_t i = 0; i < slot.size();)
+            {
+                if (slot[i].tick > current)
+                {
+                    i++;
+                    continue;
+                }
+                expired.push_back(slot[i].id);
+                slot[i] = slot.back();
+                slot.pop_back();
+                count--;
+            }
+        }
+    }
+
+    // Число таймеров в колесе, включая уже ненужные владельцу
+    size_t Size() const
+    {
+        return count;
+    }
+
+private:
+    struct Timer
+    {
+        uint64_t tick;
+        long id;
+    };
+
+    std::vector<Timer> slots[SLOTS];
+    uint64_t current;
+    size_t count;
+};
+
+#endif
@@ -4,8 +4,12 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <queue>
 #include <termios.h>
+#include "fuel_store.h"
+#include "sim_events.h"
+#include "fuel_bar.h"
+#include "text_overlay.h"
+#include "scene_snapshot.h"
 
 // Состояния элементов
 enum VehicleState
@@ -25,8 +29,18 @@ enum BoilerState
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 volatile int run_flag = 1;
 
+// Тексты событий sim_events.h с номером грузовика
+const char *event_formats[EV_COUNT] = {
+    "Generated fuel: %d, Storage size: %d",
+    NULL,
+    "Truck%d loaded fuel mark %d, target boiler %d",
+    "Truck%d found storage empty",
+    "Truck%d delivered fuel mark %d to boiler %d",
+    "Boiler %d is out of fuel",
+};
+
 // Общие данные
-std::queue<int> fuel_storage;
+FuelStore<32> fuel_storage; // Не требует mutex; порядок выдачи задается ключом -s
 BoilerState boiler_states[4] = {WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL, WAITING_FOR_FUEL};
 int boiler_fuel_level[4] = {0, 0, 0, 0};
 int boiler_fuel_marks[4] = {0, 0, 0, 0};
@@ -45,6 +59,22 @@ int vehicle2_fuel = 0;
 int vehicle2_target_boiler = -1;
 int vehicle2_x = 100, vehicle2_y = 165; // Поднят выше первого грузовика
 
+// Копия общих данных для потока отрисовки
+struct Scene
+{
+    BoilerState boiler_states[4];
+    int boiler_fuel_level[4];
+    int boiler_fuel_marks[4];
+    bool boiler_targeted[4];
+    bool boiler_low_fuel[4];
+    VehicleState vehicle1_state, vehicle2_state;
+    int vehicle1_fuel, vehicle2_fuel;
+    int vehicle1_target_boiler, vehicle2_target_boiler;
+    int vehicle1_x, vehicle1_y, vehicle2_x, vehicle2_y;
+};
+SceneSnapshot<Scene> scene_snapshot; // Последний опубликованный снимок
+const int RENDER_PERIOD_MS = 50;     // Период кадра потока отрисовки
+
 // Размеры объектов (высота:ширина = 2:1)
 const int STORAGE_W = 80, STORAGE_H = 160;
 const int VEHICLE_W = 80, VEHICLE_H = 40;
@@ -68,7 +98,12 @@ const int BOILER_STOP_Y1 = 235;  // Для первого грузовика
 const int BOILER_STOP_Y2 = 165;  // Для второго грузовика (поднята)
 
 // Идентификаторы графических элементов
-int storage_id, vehicle1_id, vehicle2_id, boiler_ids[4], text_ids[15], fuel_bar_ids[4];
+int storage_id, vehicle1_id, vehicle2_id, boiler_ids[4];
+TextOverlay text_overlay; // Надписи окна
+
+// Слоты надписей: 0..14 - строки вверху окна, дальше - подписи объектов
+const int LABEL_STORAGE = 16, LABEL_VEHICLE1 = 17, LABEL_VEHICLE2 = 18, LABEL_BOILER = 20;
+FuelBar fuel_bars[4]; // Индикаторы топлива котлов
 
 // Функция для неблокирующего ввода
 static void set_raw_mode(int enable)
@@ -88,8 +123,31 @@ static void set_raw_mode(int enable)
     }
 }
 
+// Публикация снимка для потока отрисовки. Вызывается под mutex после изменения общих данных
+void PublishScene()
+{
+    Scene scene;
+    memset(&scene, 0, sizeof(scene));
+    memcpy(scene.boiler_states, boiler_states, sizeof(boiler_states));
+    memcpy(scene.boiler_fuel_level, boiler_fuel_level, sizeof(boiler_fuel_level));
+    memcpy(scene.boiler_fuel_marks, boiler_fuel_marks, sizeof(boiler_fuel_marks));
+    memcpy(scene.boiler_targeted, boiler_targeted, sizeof(boiler_targeted));
+    memcpy(scene.boiler_low_fuel, boiler_low_fuel, sizeof(boiler_low_fuel));
+    scene.vehicle1_state = vehicle1_state;
+    scene.vehicle1_fuel = vehicle1_fuel;
+    scene.vehicle1_target_boiler = vehicle1_target_boiler;
+    scene.vehicle1_x = vehicle1_x;
+    scene.vehicle1_y = vehicle1_y;
+    scene.vehicle2_state = vehicle2_state;
+    scene.vehicle2_fuel = vehicle2_fuel;
+    scene.vehicle2_target_boiler = vehicle2_target_boiler;
+    scene.vehicle2_x = vehicle2_x;
+    scene.vehicle2_y = vehicle2_y;
+    scene_snapshot.Publish(scene);
+}
+
 // Функция для плавного перемещения грузовика к целевой позиции
-void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y, int vehicle_id)
+void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y)
 {
     int steps = 20;
     int start_x = *vehicle_x;
@@ -101,36 +159,36 @@ void MoveVehicleTo(int *vehicle_x, int *vehicle_y, int target_x, int target_y, i
         int new_x = start_x + (target_x - start_x) * progress;
         int new_y = start_y + (target_y - start_y) * progress;
 
-        MoveTo(new_x, new_y, vehicle_id);
+        pthread_mutex_lock(&mutex);
+        *vehicle_x = new_x;
+        *vehicle_y = new_y;
+        PublishScene();
+        pthread_mutex_unlock(&mutex);
         usleep(50000);
     }
 
+    pthread_mutex_lock(&mutex);
     *vehicle_x = target_x;
     *vehicle_y = target_y;
+    PublishScene();
+    pthread_mutex_unlock(&mutex);
 }
 
 // Функция для обновления индикатора топлива в котле
-void UpdateBoilerFuelIndicator(int boiler_id)
+void UpdateBoilerFuelIndicator(const Scene &scene, int boiler_id)
 {
-    // Удаляем старый индикатор
-    if (fuel_bar_ids[boiler_id] != 0)
-    {
-        Delete(fuel_bar_ids[boiler_id]);
-        fuel_bar_ids[boiler_id] = 0;
-    }
-
-    // Создаем новый индикатор, если есть топливо
-    if (boiler_fuel_level[boiler_id] > 0)
+    // Показываем индикатор, если есть топливо
+    if (scene.boiler_fuel_level[boiler_id] > 0)
     {
         int max_fuel_height = BOILER_H - 20; // Оставляем отступы
-        int fuel_height = (boiler_fuel_level[boiler_id] * max_fuel_height) / 20;
+        int fuel_height = (scene.boiler_fuel_level[boiler_id] * max_fuel_height) / 20;
         int fuel_y = BOILER_Y + BOILER_H - fuel_height - 10; // Отступ снизу
 
         // Цвет зависит от состояния и уровня топлива
         int color;
-        if (boiler_states[boiler_id] == BURNING)
+        if (scene.boiler_states[boiler_id] == BURNING)
         {
-            if (boiler_low_fuel[boiler_id])
+            if (scene.boiler_low_fuel[boiler_id])
                 color = RGB(255, 0, 0); // Красный при низком уровне
             else
                 color = RGB(255, 165, 0); // Оранжевый при нормальном уровне
@@ -140,13 +198,11 @@ void UpdateBoilerFuelIndicator(int boiler_id)
             color = RGB(0, 200, 0); // Зеленый при ожидании
         }
 
-        fuel_bar_ids[boiler_id] = Rect(
-            BOILER_X[boiler_id] + 10,
-            fuel_y,
-            BOILER_W - 20,
-            fuel_height,
-            0,
-            color);
+        fuel_bars[boiler_id].Update(BOILER_X[boiler_id] + 10, fuel_y, BOILER_W - 20, fuel_height, color);
+    }
+    else
+    {
+        fuel_bars[boiler_id].Hide();
     }
 }
 
@@ -178,98 +234,96 @@ int SelectAvailableBoiler()
 }
 
 // Функция для обновления текстовой информации
-void UpdateTextInfo()
+void UpdateTextInfo(const Scene &scene)
 {
-    // Очистка предыдущих текстовых элементов
-    for (int i = 0; i < 15; i++)
-    {
-        if (text_ids[i] != 0)
-        {
-            Delete(text_ids[i]);
-            text_ids[i] = 0;
-        }
-    }
-
     // Вывод общей информации В ВЕРХУ ОКНА
     int y_offset = 10;
 
     // Информация о первом грузовике
     char vehicle1_fuel_text[50];
-    sprintf(vehicle1_fuel_text, "Truck1 Fuel: %d", vehicle1_fuel);
-    text_ids[0] = Text(10, y_offset, vehicle1_fuel_text, RGB(255, 255, 255));
+    sprintf(vehicle1_fuel_text, "Truck1 Fuel: %d", scene.vehicle1_fuel);
+    text_overlay.Put(0, 10, y_offset, vehicle1_fuel_text, RGB(255, 255, 255));
 
     char vehicle1_target_text[50];
-    if (vehicle1_target_boiler != -1)
+    if (scene.vehicle1_target_boiler != -1)
     {
-        sprintf(vehicle1_target_text, "Truck1 Target: %d", vehicle1_target_boiler + 1);
+        sprintf(vehicle1_target_text, "Truck1 Target: %d", scene.vehicle1_target_boiler + 1);
     }
     else
     {
         sprintf(vehicle1_target_text, "Truck1 Target: None");
     }
-    text_ids[1] = Text(10, y_offset + 20, vehicle1_target_text, RGB(255, 255, 255));
+    text_overlay.Put(1, 10, y_offset + 20, vehicle1_target_text, RGB(255, 255, 255));
 
     // Информация о втором грузовике
     char vehicle2_fuel_text[50];
-    sprintf(vehicle2_fuel_text, "Truck2 Fuel: %d", vehicle2_fuel);
-    text_ids[2] = Text(10, y_offset + 40, vehicle2_fuel_text, RGB(255, 255, 255));
+    sprintf(vehicle2_fuel_text, "Truck2 Fuel: %d", scene.vehicle2_fuel);
+    text_overlay.Put(2, 10, y_offset + 40, vehicle2_fuel_text, RGB(255, 255, 255));
 
     char vehicle2_target_text[50];
-    if (vehicle2_target_boiler != -1)
+    if (scene.vehicle2_target_boiler != -1)
     {
-        sprintf(vehicle2_target_text, "Truck2 Target: %d", vehicle2_target_boiler + 1);
+        sprintf(vehicle2_target_text, "Truck2 Target: %d", scene.vehicle2_target_boiler + 1);
     }
     else
     {
         sprintf(vehicle2_target_text, "Truck2 Target: None");
     }
-    text_ids[3] = Text(10, y_offset + 60, vehicle2_target_text, RGB(255, 255, 255));
+    text_overlay.Put(3, 10, y_offset + 60, vehicle2_target_text, RGB(255, 255, 255));
 
     // Общая информация
     char storage_count_text[50];
-    sprintf(storage_count_text, "Storage: %d units", (int)fuel_storage.size());
-    text_ids[4] = Text(200, y_offset, storage_count_text, RGB(255, 255, 255));
+    sprintf(storage_count_text, "Storage: %d units", (int)fuel_storage.Size());
+    text_overlay.Put(4, 200, y_offset, storage_count_text, RGB(255, 255, 255));
 
     // Состояния грузовиков
     char vehicle1_state_text[50];
     sprintf(vehicle1_state_text, "Truck1 State: %s",
-            vehicle1_state == MOVING_TO_STORAGE ? "To Storage" : vehicle1_state == LOADING        ? "Loading"
-                                                             : vehicle1_state == MOVING_TO_BOILER ? "To Boiler"
-                                                                                                  : "Unloading");
-    text_ids[5] = Text(200, y_offset + 20, vehicle1_state_text, RGB(255, 255, 255));
+            scene.vehicle1_state == MOVING_TO_STORAGE ? "To Storage" : scene.vehicle1_state == LOADING        ? "Loading"
+                                                                   : scene.vehicle1_state == MOVING_TO_BOILER ? "To Boiler"
+                                                                                                              : "Unloading");
+    text_overlay.Put(5, 200, y_offset + 20, vehicle1_state_text, RGB(255, 255, 255));
 
     char vehicle2_state_text[50];
     sprintf(vehicle2_state_text, "Truck2 State: %s",
-            vehicle2_state == MOVING_TO_STORAGE ? "To Storage" : vehicle2_state == LOADING        ? "Loading"
-                                                             : vehicle2_state == MOVING_TO_BOILER ? "To Boiler"
-                                                                                                  : "Unloading");
-    text_ids[6] = Text(200, y_offset + 40, vehicle2_state_text, RGB(255, 255, 255));
+            scene.vehicle2_state == MOVING_TO_STORAGE ? "To Storage" : scene.vehicle2_state == LOADING        ? "Loading"
+                                                                   : scene.vehicle2_state == MOVING_TO_BOILER ? "To Boiler"
+                                                                                                              : "Unloading");
+    text_overlay.Put(6, 200, y_offset + 40, vehicle2_state_text, RGB(255, 255, 255));
 
     // Информация о котлах
     for (int i = 0; i < 4; i++)
     {
         char boiler_mark_text[50];
-        sprintf(boiler_mark_text, "Boiler %d: Mark %d, %s", i + 1, boiler_fuel_marks[i],
-                boiler_low_fuel[i] ? "LOW FUEL!" : (boiler_targeted[i] ? "Targeted" : "Free"));
-        text_ids[7 + i] = Text(375, y_offset + i * 20, boiler_mark_text,
-                               boiler_low_fuel[i] ? RGB(255, 0, 0) : RGB(255, 255, 255));
+        sprintf(boiler_mark_text, "Boiler %d: Mark %d, %s", i + 1, scene.boiler_fuel_marks[i],
+                scene.boiler_low_fuel[i] ? "LOW FUEL!" : (scene.boiler_targeted[i] ? "Targeted" : "Free"));
+        text_overlay.Put(7 + i, 375, y_offset + i * 20, boiler_mark_text,
+                         scene.boiler_low_fuel[i] ? RGB(255, 0, 0) : RGB(255, 255, 255));
     }
 }
 
-// Функция для отрисовки состояния
-void DrawState()
+// Функция для отрисовки состояния. previous - снимок прошлого кадра (NULL в первом кадре):
+// перемещение грузовиков и индикаторы топлива меняются только при отличиях
+void DrawState(const Scene &scene, const Scene *previous)
 {
-    pthread_mutex_lock(&mutex);
+    // Перемещение грузовиков
+    if (previous == NULL || scene.vehicle1_x != previous->vehicle1_x || scene.vehicle1_y != previous->vehicle1_y)
+    {
+        MoveTo(scene.vehicle1_x, scene.vehicle1_y, vehicle1_id);
+    }
+    if (previous == NULL || scene.vehicle2_x != previous->vehicle2_x || scene.vehicle2_y != previous->vehicle2_y)
+    {
+        MoveTo(scene.vehicle2_x, scene.vehicle2_y, vehicle2_id);
+    }
 
     // Обновление хранилища
     char storage_text[50];
-    sprintf(storage_text, "Storage: %d units", (int)fuel_storage.size());
-    SetText(storage_id, storage_text);
-    SetColor(storage_id, RGB(255, 255, 255));
+    sprintf(storage_text, "Storage: %d units", (int)fuel_storage.Size());
+    text_overlay.Label(LABEL_STORAGE, storage_id, storage_text, RGB(255, 255, 255));
 
     // Обновление состояния транспорта
     const char *v1state = "";
-    switch (vehicle1_state)
+    switch (scene.vehicle1_state)
     {
     case MOVING_TO_STORAGE:
         v1state = "To Storage";
@@ -284,10 +338,10 @@ void DrawState()
         v1state = "Unloading";
         break;
     }
-    SetText(vehicle1_id, v1state);
+    text_overlay.Label(LABEL_VEHICLE1, vehicle1_id, v1state, TEXT_OVERLAY_KEEP_COLOR);
 
     const char *v2state = "";
-    switch (vehicle2_state)
+    switch (scene.vehicle2_state)
     {
     case MOVING_TO_STORAGE:
         v2state = "To Storage";
@@ -302,34 +356,70 @@ void DrawState()
         v2state = "Unloading";
         break;
     }
-    SetText(vehicle2_id, v2state);
+    text_overlay.Label(LABEL_VEHICLE2, vehicle2_id, v2state, TEXT_OVERLAY_KEEP_COLOR);
 
     // Обновление котлов
     for (int i = 0; i < 4; i++)
     {
         char boiler_text[100];
-        const char *bstate = boiler_states[i] == BURNING ? "Burning" : "Waiting";
+        const char *bstate = scene.boiler_states[i] == BURNING ? "Burning" : "Waiting";
         sprintf(boiler_text, "Boiler %d: %s", i + 1, bstate);
-        SetText(boiler_ids[i], boiler_text);
 
         // Изменение цвета котла при горении и низком уровне топлива
-        if (boiler_states[i] == BURNING)
+        int color;
+        if (scene.boiler_states[i] == BURNING)
         {
-            if (boiler_low_fuel[i])
-                SetColor(boiler_ids[i], RGB(255, 0, 0)); // Красный при низком уровне
+            if (scene.boiler_low_fuel[i])
+                color = RGB(255, 0, 0); // Красный при низком уровне
             else
-                SetColor(boiler_ids[i], RGB(255, 50, 50)); // Обычный красный при горении
+                color = RGB(255, 50, 50); // Обычный красный при горении
         }
         else
         {
-            SetColor(boiler_ids[i], RGB(200, 100, 100));
+            color = RGB(200, 100, 100);
+        }
+        text_overlay.Label(LABEL_BOILER + i, boiler_ids[i], boiler_text, color);
+
+        // Индикатор топлива
+        if (previous == NULL || scene.boiler_fuel_level[i] != previous->boiler_fuel_level[i] ||
+            scene.boiler_states[i] != previous->boiler_states[i] ||
+            scene.boiler_low_fuel[i] != previous->boiler_low_fuel[i])
+        {
+            UpdateBoilerFuelIndicator(scene, i);
         }
     }
 
     // Обновление текстовой информации
-    UpdateTextInfo();
+    UpdateTextInfo(scene);
+    text_overlay.EndFrame();
+}
 
-    pthread_mutex_unlock(&mutex);
+// Поток отрисовки: с постоянной частотой читает последний снимок и рисует изменения.
+// После запуска потоков графику вызывает только он, поэтому потоки симуляции не ждут
+// графический сервер, а отрисовка не занимает mutex
+void *RenderThread(void *arg)
+{
+    Scene previous, current;
+    bool first = true;
+    timespec next_frame;
+    clock_gettime(CLOCK_MONOTONIC, &next_frame);
+    while (run_flag)
+    {
+        scene_snapshot.Read(&current);
+        DrawState(current, first ? NULL : &previous);
+        previous = current;
+        first = false;
+
+        // Следующий кадр через RENDER_PERIOD_MS от начала текущего
+        next_frame.tv_nsec += RENDER_PERIOD_MS * 1000000L;
+        if (next_frame.tv_nsec >= 1000000000L)
+        {
+            next_frame.tv_sec++;
+            next_frame.tv_nsec -= 1000000000L;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_frame, NULL);
+    }
+    return NULL;
 }
 
 // Поток для хранилища
@@ -337,13 +427,14 @@ void *StorageThread(void *arg)
 {
     while (run_flag)
     {
-        pthread_mutex_lock(&mutex);
-        if (fuel_storage.size() < 20)
+        // Топливо кладет только этот поток, оба грузовика его забирают: если в момент
+        // проверки было меньше 20 единиц, после Push их не станет больше 20
+        if (fuel_storage.Size() < 20)
         {
             int mark = rand() % 10 + 1;
-            fuel_storage.push(mark);
+            fuel_storage.Push(mark);
+            LogEvent(LOG_LEVEL_DEBUG, EV_GENERATED, mark, (int)fuel_storage.Size());
         }
-        pthread_mutex_unlock(&mutex);
         usleep(1000000);
     }
     return NULL;
@@ -358,7 +449,7 @@ void *Vehicle1Thread(void *arg)
         if (vehicle1_state == MOVING_TO_STORAGE)
         {
             // Движение к хранилищу
-            MoveVehicleTo(&vehicle1_x, &vehicle1_y, STORAGE_STOP_X, STORAGE_STOP_Y1, vehicle1_id);
+            MoveVehicleTo(&vehicle1_x, &vehicle1_y, STORAGE_STOP_X, STORAGE_STOP_Y1);
 
             if (!run_flag)
                 break;
@@ -366,20 +457,20 @@ void *Vehicle1Thread(void *arg)
             // Начинаем загрузку
             pthread_mutex_lock(&mutex);
             vehicle1_state = LOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация загрузки
+            // Загрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
-            if (!fuel_storage.empty())
+            int mark;
+            if (fuel_storage.Pop(&mark))
             {
-                vehicle1_fuel = fuel_storage.front();
-                fuel_storage.pop();
+                vehicle1_fuel = mark;
 
                 // Выбор доступного котла
                 vehicle1_target_boiler = SelectAvailableBoiler();
@@ -387,20 +478,22 @@ void *Vehicle1Thread(void *arg)
                 if (vehicle1_target_boiler != -1)
                 {
                     vehicle1_state = MOVING_TO_BOILER;
+                    LogEvent(LOG_LEVEL_INFO, EV_LOADED, 1, mark, vehicle1_target_boiler + 1);
                 }
                 else
                 {
                     // Если нет доступных котлов, ждем
                     vehicle1_state = MOVING_TO_STORAGE;
                 }
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler
-                UpdateTextInfo();
             }
             else
             {
                 vehicle1_state = MOVING_TO_STORAGE;
+                LogEvent(LOG_LEVEL_WARN, EV_STORAGE_EMPTY, 1);
             }
+
+            // Публикуем Vehicle Fuel и Target Boiler
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -409,7 +502,7 @@ void *Vehicle1Thread(void *arg)
         {
             // Движение к котлу
             int target_x = BOILER_X[vehicle1_target_boiler];
-            MoveVehicleTo(&vehicle1_x, &vehicle1_y, target_x, BOILER_STOP_Y1, vehicle1_id);
+            MoveVehicleTo(&vehicle1_x, &vehicle1_y, target_x, BOILER_STOP_Y1);
 
             if (!run_flag)
                 break;
@@ -417,13 +510,13 @@ void *Vehicle1Thread(void *arg)
             // Начинаем разгрузку
             pthread_mutex_lock(&mutex);
             vehicle1_state = UNLOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация разгрузки
+            // Разгрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
@@ -433,6 +526,7 @@ void *Vehicle1Thread(void *arg)
                 boiler_states[vehicle1_target_boiler] = BURNING;
                 boiler_fuel_level[vehicle1_target_boiler] = vehicle1_fuel; // Одна единица = одна секунда горения
                 boiler_fuel_marks[vehicle1_target_boiler] = vehicle1_fuel;
+                LogEvent(LOG_LEVEL_INFO, EV_DELIVERED, 1, vehicle1_fuel, vehicle1_target_boiler + 1);
 
                 // Сбрасываем флаг низкого уровня топлива
                 boiler_low_fuel[vehicle1_target_boiler] = false;
@@ -440,20 +534,13 @@ void *Vehicle1Thread(void *arg)
                 // Освобождаем котел как цель
                 boiler_targeted[vehicle1_target_boiler] = false;
 
-                // Обновляем индикатор топлива в котле
-                UpdateBoilerFuelIndicator(vehicle1_target_boiler);
-
                 vehicle1_fuel = 0;
                 vehicle1_target_boiler = -1;
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler (обнуляем)
-                UpdateTextInfo();
             }
 
-            // Отрисовываем состояние ДО того, как грузовик начнет движение обратно
-            DrawState();
-
+            // Публикуем котел с новым топливом и пустой грузовик перед движением обратно
             vehicle1_state = MOVING_TO_STORAGE;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -471,7 +558,7 @@ void *Vehicle2Thread(void *arg)
         if (vehicle2_state == MOVING_TO_STORAGE)
         {
             // Движение к хранилищу
-            MoveVehicleTo(&vehicle2_x, &vehicle2_y, STORAGE_STOP_X, STORAGE_STOP_Y2, vehicle2_id);
+            MoveVehicleTo(&vehicle2_x, &vehicle2_y, STORAGE_STOP_X, STORAGE_STOP_Y2);
 
             if (!run_flag)
                 break;
@@ -479,20 +566,20 @@ void *Vehicle2Thread(void *arg)
             // Начинаем загрузку
             pthread_mutex_lock(&mutex);
             vehicle2_state = LOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация загрузки
+            // Загрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
-            if (!fuel_storage.empty())
+            int mark;
+            if (fuel_storage.Pop(&mark))
             {
-                vehicle2_fuel = fuel_storage.front();
-                fuel_storage.pop();
+                vehicle2_fuel = mark;
 
                 // Выбор доступного котла
                 vehicle2_target_boiler = SelectAvailableBoiler();
@@ -500,20 +587,22 @@ void *Vehicle2Thread(void *arg)
                 if (vehicle2_target_boiler != -1)
                 {
                     vehicle2_state = MOVING_TO_BOILER;
+                    LogEvent(LOG_LEVEL_INFO, EV_LOADED, 2, mark, vehicle2_target_boiler + 1);
                 }
                 else
                 {
                     // Если нет доступных котлов, ждем
                     vehicle2_state = MOVING_TO_STORAGE;
                 }
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler
-                UpdateTextInfo();
             }
             else
             {
                 vehicle2_state = MOVING_TO_STORAGE;
+                LogEvent(LOG_LEVEL_WARN, EV_STORAGE_EMPTY, 2);
             }
+
+            // Публикуем Vehicle Fuel и Target Boiler
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -522,7 +611,7 @@ void *Vehicle2Thread(void *arg)
         {
             // Движение к котлу
             int target_x = BOILER_X[vehicle2_target_boiler];
-            MoveVehicleTo(&vehicle2_x, &vehicle2_y, target_x, BOILER_STOP_Y2, vehicle2_id);
+            MoveVehicleTo(&vehicle2_x, &vehicle2_y, target_x, BOILER_STOP_Y2);
 
             if (!run_flag)
                 break;
@@ -530,13 +619,13 @@ void *Vehicle2Thread(void *arg)
             // Начинаем разгрузку
             pthread_mutex_lock(&mutex);
             vehicle2_state = UNLOADING;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
 
-            // Анимация разгрузки
+            // Разгрузка
             for (int i = 0; i < 3 && run_flag; i++)
             {
                 usleep(300000);
-                DrawState();
             }
 
             pthread_mutex_lock(&mutex);
@@ -546,6 +635,7 @@ void *Vehicle2Thread(void *arg)
                 boiler_states[vehicle2_target_boiler] = BURNING;
                 boiler_fuel_level[vehicle2_target_boiler] = vehicle2_fuel; // Одна единица = одна секунда горения
                 boiler_fuel_marks[vehicle2_target_boiler] = vehicle2_fuel;
+                LogEvent(LOG_LEVEL_INFO, EV_DELIVERED, 2, vehicle2_fuel, vehicle2_target_boiler + 1);
 
                 // Сбрасываем флаг низкого уровня топлива
                 boiler_low_fuel[vehicle2_target_boiler] = false;
@@ -553,20 +643,13 @@ void *Vehicle2Thread(void *arg)
                 // Освобождаем котел как цель
                 boiler_targeted[vehicle2_target_boiler] = false;
 
-                // Обновляем индикатор топлива в котле
-                UpdateBoilerFuelIndicator(vehicle2_target_boiler);
-
                 vehicle2_fuel = 0;
                 vehicle2_target_boiler = -1;
-
-                // Обновляем информацию о Vehicle Fuel и Target Boiler (обнуляем)
-                UpdateTextInfo();
             }
 
-            // Отрисовываем состояние ДО того, как грузовик начнет движение обратно
-            DrawState();
-
+            // Публикуем котел с новым топливом и пустой грузовик перед движением обратно
             vehicle2_state = MOVING_TO_STORAGE;
+            PublishScene();
             pthread_mutex_unlock(&mutex);
         }
 
@@ -593,23 +676,17 @@ void *BoilerThread(void *arg)
                 {
                     boiler_low_fuel[id] = true;
                 }
-
-                // Обновляем индикатор уровня топлива
-                UpdateBoilerFuelIndicator(id);
             }
             else
             {
                 boiler_states[id] = WAITING_FOR_FUEL;
                 boiler_fuel_marks[id] = 0;
+                LogEvent(LOG_LEVEL_INFO, EV_BOILER_EMPTY, id + 1);
                 boiler_low_fuel[id] = false; // Сбрасываем флаг низкого уровня
-
-                // Удаляем индикатор уровня топлива
-                if (fuel_bar_ids[id] != 0)
-                {
-                    Delete(fuel_bar_ids[id]);
-                    fuel_bar_ids[id] = 0;
-                }
             }
+
+            // Публикуем уровень топлива для индикатора
+            PublishScene();
         }
         pthread_mutex_unlock(&mutex);
 
@@ -618,28 +695,34 @@ void *BoilerThread(void *arg)
     return NULL;
 }
 
-int main()
+int main(int argc, char *argv[])
 {
+    // Порядок выдачи со склада: fifo (по умолчанию) или priority - сначала высокие марки
+    DispensePolicy policy = DISPENSE_FIFO;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:h")) != -1)
+    {
+        if (opt != 's' || !ParseDispensePolicy(optarg, &policy))
+        {
+            fprintf(stderr, "Usage: %s [-s fifo|priority]\n", argv[0]);
+            return 1;
+        }
+    }
+    fuel_storage.SetPolicy(policy);
+
     ConnectGraph("Power Station Simulation");
 
     // Инициализация случайного генератора
     srand(time(NULL));
 
+    StartAsyncLog(event_formats, EV_COUNT, LOG_LEVEL_WARN, stdout);
+
     // Инициализация хранилища
     for (int i = 0; i < 10; i++)
     {
-        fuel_storage.push(rand() % 10 + 1);
+        fuel_storage.Push(rand() % 10 + 1);
     }
 
-    // Инициализация ID
-    for (int i = 0; i < 15; i++)
-    {
-        text_ids[i] = 0;
-    }
-    for (int i = 0; i < 4; i++)
-    {
-        fuel_bar_ids[i] = 0;
-    }
 
     // Создание графических элементов
     storage_id = Rect(STORAGE_X, STORAGE_Y, STORAGE_W, STORAGE_H, 5, RGB(200, 200, 100));
@@ -662,6 +745,12 @@ int main()
         SetText(boiler_ids[i], boiler_name);
     }
 
+    // Индикаторы топлива создаются скрытыми поверх котлов и дальше только меняются
+    for (int i = 0; i < 4; i++)
+    {
+        fuel_bars[i].Create(BOILER_X[i] + 10, BOILER_Y + 10, BOILER_W - 20, BOILER_H - 20, RGB(0, 200, 0));
+    }
+
     // Инструкция вверху окна
     Text(10, 120, "Power Station Simulation - Press 'q' to quit", RGB(255, 255, 255));
 
@@ -672,10 +761,15 @@ int main()
     Line(50, 215, 530, 215, RGB(255, 255, 255)); // Верхняя дорога для второго грузовика (поднята)
     Line(50, 220, 530, 220, RGB(255, 255, 255));
 
-    // Запуск потоков
-    pthread_t storage_thread, vehicle1_thread, vehicle2_thread, boiler_threads[4];
+    timespec started; // Для расчета графических вызовов в секунду
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    // Запуск потоков; первый снимок публикуется до них
+    PublishScene();
+    pthread_t storage_thread, vehicle1_thread, vehicle2_thread, boiler_threads[4], render_thread;
     int boiler_ids_arg[4] = {0, 1, 2, 3};
 
+    pthread_create(&render_thread, NULL, RenderThread, NULL);
     pthread_create(&storage_thread, NULL, StorageThread, NULL);
     pthread_create(&vehicle1_thread, NULL, Vehicle1Thread, NULL);
     pthread_create(&vehicle2_thread, NULL, Vehicle2Thread, NULL);
@@ -689,11 +783,10 @@ int main()
     set_raw_mode(1);
     printf("Power Station Simulation started. Press 'q' to quit\n");
 
-    // Главный цикл визуализации
+    // Главный цикл: отрисовкой занят RenderThread, здесь только ввод
     char c;
     while (run_flag)
     {
-        DrawState();
         usleep(50000);
 
         // Проверка ввода
@@ -720,7 +813,12 @@ int main()
     {
         pthread_join(boiler_threads[i], NULL);
     }
+    pthread_join(render_thread, NULL);
+
+    PrintFuelBarStats(fuel_bars, 4, SecondsSince(started));
+    text_overlay.PrintStats();
 
+    StopAsyncLog();
     CloseGraph();
     return 0;
 }